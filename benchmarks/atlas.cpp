@@ -0,0 +1,171 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <ranges>
+#include <vector>
+#include <nvjpg.hpp>
+
+#include "corpus.hpp"
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Decodes a grid of thumbnails into a SurfaceAtlas, and into a surface per thumbnail
+// Compares the time to allocate and render the whole grid, and the memory taken by each approach,
+// then checks the atlas rectangles hold the same pixels as the separate surfaces
+// Passing -e runs against the in-process driver emulator instead of the kernel
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Thumbnail {
+    std::shared_ptr<std::vector<std::uint8_t>> data;
+    nj::Image image;
+};
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+#ifndef __SWITCH__
+    if (argc >= 2 && !std::strcmp(argv[1], "-e"))
+        nj::NvDevice::set_ops(nj::NvEmulator::get_ops()), first = 2;
+#endif
+
+    auto num_thumbnails = (argc >= first + 1) ? std::max(std::atoi(argv[first]), 1) : 200;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize decoder: %#x\n", rc);
+        return 1;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    // Thumbnails of a few sizes, as in a grid mixing landscape and portrait pictures
+    std::vector<Thumbnail> thumbnails(num_thumbnails);
+    for (int i = 0; i < num_thumbnails; ++i) {
+        constexpr std::uint16_t sizes[][2] = { { 128, 128 }, { 160, 120 }, { 120, 160 }, { 96, 96 } };
+        auto &thumb = thumbnails[i];
+        thumb.data  = std::make_shared<std::vector<std::uint8_t>>(nj::CorpusGenerator::generate({
+            .width = sizes[i % std::size(sizes)][0], .height = sizes[i % std::size(sizes)][1],
+            .seed  = std::uint32_t(i),
+        }));
+        thumb.image = nj::Image(thumb.data);
+        if (auto rc = thumb.image.parse(); rc) {
+            std::fprintf(stderr, "Failed to parse generated image: %#x\n", rc);
+            return 1;
+        }
+    }
+
+    // Separate surfaces
+    std::vector<std::unique_ptr<nj::Surface>> surfaces;
+    std::size_t surfaces_size = 0;
+    auto start = Clock::now();
+    for (auto &thumb: thumbnails) {
+        auto &surf = surfaces.emplace_back(std::make_unique<nj::Surface>(thumb.image.width, thumb.image.height));
+        if (auto rc = surf->allocate(); rc) {
+            std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+            return 1;
+        }
+        if (auto rc = decoder.render(thumb.image, *surf, 255); rc) {
+            std::fprintf(stderr, "Failed to render: %#x\n", rc);
+            return 1;
+        }
+        surfaces_size += surf->size();
+    }
+    for (auto &surf: surfaces)
+        decoder.wait(*surf);
+    auto surfaces_ms = elapsed_ms(start);
+
+    // Atlas 2048 pixels wide, with thumbnails placed tallest first, which packs shelves more tightly
+    // The rectangles are reserved in a first atlas as tall as needed, then again in one sized to them
+    constexpr std::size_t atlas_width = 2048;
+    std::vector<int> order(num_thumbnails);
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::stable_sort(order, std::greater{}, [&](int i) { return thumbnails[i].image.height; });
+
+    std::vector<nj::Surface> cells(num_thumbnails, nj::Surface(0, 0));
+    std::vector<nj::SurfaceAtlas::Rect> rects(num_thumbnails);
+    auto pack = [&](nj::SurfaceAtlas &atlas) {
+        return std::ranges::all_of(order, [&](int i) { return !atlas.add(thumbnails[i].image, cells[i], rects[i]); });
+    };
+
+    start = Clock::now();
+    nj::SurfaceAtlas sizing(atlas_width, std::size_t(num_thumbnails) * std::numeric_limits<std::uint16_t>::max());
+    pack(sizing);
+
+    nj::SurfaceAtlas atlas(atlas_width, sizing.get_used_height());
+    if (auto rc = atlas.allocate(); rc) {
+        std::fprintf(stderr, "Failed to allocate atlas: %#x\n", rc);
+        return 1;
+    }
+    if (!pack(atlas)) {
+        std::fprintf(stderr, "Failed to pack atlas\n");
+        return 1;
+    }
+    for (int i = 0; i < num_thumbnails; ++i) {
+        if (auto rc = decoder.render(thumbnails[i].image, cells[i], 255); rc) {
+            std::fprintf(stderr, "Failed to render: %#x\n", rc);
+            return 1;
+        }
+    }
+    for (auto &cell: cells)
+        decoder.wait(cell);
+    auto atlas_ms = elapsed_ms(start);
+
+    auto &atlas_surf = atlas.get_surface();
+    std::printf("%d thumbnails\n", num_thumbnails);
+    std::printf("Surfaces: %8.2fms, %7.1fKiB in %d allocations\n", surfaces_ms, surfaces_size / 1024.0, num_thumbnails);
+    std::printf("Atlas:    %8.2fms, %7.1fKiB in 1 allocation (%zux%zu, %.1f%% used)\n", atlas_ms,
+        atlas_surf.size() / 1024.0, atlas_surf.width, atlas_surf.height,
+        100.0 * atlas.get_used_area() / (atlas_surf.width * atlas_surf.height));
+
+    for (int i = 0; i < num_thumbnails; ++i) {
+        auto &surf = *surfaces[i];
+        auto *cell = atlas_surf.data() + rects[i].y * atlas_surf.pitch + rects[i].x * atlas_surf.get_bpp();
+        for (std::size_t y = 0; y < surf.height; ++y) {
+            if (std::memcmp(surf.data() + y * surf.pitch, cell + y * atlas_surf.pitch, surf.width * surf.get_bpp())) {
+                std::fprintf(stderr, "Thumbnail %d differs in the atlas\n", i);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Renders the same image to a number of surfaces, once with a submission per image and once as a single batch
+// Small images (thumbnails, icons) show the share of the per-submission kernel overhead
+// Passing -e runs against the in-process driver emulator instead of the kernel
+
+namespace {
+
+double time_ms(int iterations, auto &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        if (auto rc = fn(); rc) {
+            std::fprintf(stderr, "Failed: %#x\n", rc);
+            return -1;
+        }
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+#ifndef __SWITCH__
+    if (argc >= 2 && !std::strcmp(argv[1], "-e"))
+        nj::NvDevice::set_ops(nj::NvEmulator::get_ops()), first = 2;
+#endif
+
+    if (argc < first + 1) {
+        std::fprintf(stderr, "Usage: %s [-e] jpg [batch size] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    auto batch_size = (argc >= first + 2) ? std::max(std::atoi(argv[first + 1]), 1) : 16;
+    auto iterations = (argc >= first + 3) ? std::max(std::atoi(argv[first + 2]), 1) : 100;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Image image(argv[first]);
+    if (!image.is_valid() || image.parse()) {
+        std::perror("Invalid file");
+        return 1;
+    }
+
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(batch_size, 0x500000, nj::Decoder::Backend::Hardware); rc) {
+        std::fprintf(stderr, "Failed to initialize decoder: %#x\n", rc);
+        return 1;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    std::vector<std::unique_ptr<nj::Surface>> surfs;
+    std::vector<nj::Decoder::RenderJob> jobs;
+    for (int i = 0; i < batch_size; ++i) {
+        auto &surf = surfs.emplace_back(std::make_unique<nj::Surface>(image.width, image.height, nj::PixelFormat::RGBA));
+        if (auto rc = surf->allocate(); rc) {
+            std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+            return 1;
+        }
+        jobs.push_back({ image, *surf, 255 });
+    }
+
+    auto wait_all = [&] {
+        for (auto &surf: surfs)
+            NJ_TRY_RET(decoder.wait(*surf));
+        return 0;
+    };
+
+    std::printf("Image: %ux%u, %zu bytes of scan data, batches of %d, %d iterations\n",
+        image.width, image.height, image.get_scan_data().size(), batch_size, iterations);
+
+    auto single = time_ms(iterations, [&] {
+        for (auto &job: jobs)
+            NJ_TRY_RET(decoder.render(job.image, job.surf, job.alpha));
+        return wait_all();
+    });
+
+    auto batched = time_ms(iterations, [&] {
+        NJ_TRY_RET(decoder.render(std::span<const nj::Decoder::RenderJob>(jobs)));
+        return wait_all();
+    });
+
+    if (single < 0 || batched < 0)
+        return 1;
+
+    std::printf("Single : %8.3fms/batch, %8.1f images/s\n", single,  batch_size / single  * 1e3);
+    std::printf("Batched: %8.3fms/batch, %8.1f images/s, x%.2f\n", batched, batch_size / batched * 1e3, single / batched);
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Drives renders from coroutines awaiting Decoder::decode, resumed by a single-threaded event loop
+// Reports the resume latency (from the completion thread handing the coroutine to the loop, to it running again),
+// the round trip of an awaited render compared to a blocking render and wait, and the throughput with
+// increasing numbers of coroutines sharing the ring
+// Passing -e runs against the in-process driver emulator instead of the kernel, -t sets its engine speed
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Fire-and-forget coroutine
+struct Task {
+    struct promise_type {
+        Task get_return_object() {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() { }
+
+        void unhandled_exception() {
+            std::abort();
+        }
+    };
+};
+
+class EventLoop {
+    public:
+        void post(std::coroutine_handle<> coro) {
+            std::scoped_lock lk(this->mutex);
+            this->queue.push_back({ coro, Clock::now() });
+            this->cv.notify_one();
+        }
+
+        void run_until(const int &num_running) {
+            while (num_running) {
+                std::unique_lock lk(this->mutex);
+                this->cv.wait(lk, [this] { return !this->queue.empty(); });
+                auto [coro, posted] = this->queue.front();
+                this->queue.pop_front();
+                lk.unlock();
+
+                this->resume_latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - posted).count());
+                coro.resume();
+            }
+        }
+
+    public:
+        std::vector<double> resume_latencies;
+
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::pair<std::coroutine_handle<>, Clock::time_point>> queue;
+};
+
+struct Stats {
+    double mean, p50, p99;
+};
+
+Stats get_stats(std::vector<double> values) {
+    if (values.empty())
+        return {};
+
+    std::sort(values.begin(), values.end());
+    double sum = 0;
+    for (auto v: values)
+        sum += v;
+    return { sum / values.size(), values[values.size() / 2], values[values.size() * 99 / 100] };
+}
+
+Task client(nj::Decoder &decoder, const nj::Image &image, nj::Surface &surf, int iterations,
+        std::vector<double> &round_trips, int &num_running, int &num_failed) {
+    for (int i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        auto completion = co_await decoder.decode(image, surf, 255);
+        if (completion.rc) {
+            ++num_failed;
+            break;
+        }
+        round_trips.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    --num_running;
+}
+
+struct Run {
+    std::vector<double> round_trips, resume_latencies;
+    double images_per_s;
+};
+
+int run_coroutines(const nj::Image &image, int num_coroutines, int num_entries, int iterations, Run &run) {
+    nj::Decoder decoder;
+    NJ_TRY_RET(decoder.initialize(num_entries, 0x500000, nj::Decoder::Backend::Hardware));
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    std::vector<std::unique_ptr<nj::Surface>> surfs;
+    for (int i = 0; i < num_coroutines; ++i) {
+        auto &surf = surfs.emplace_back(std::make_unique<nj::Surface>(image.width, image.height));
+        NJ_TRY_RET(surf->allocate());
+    }
+
+    EventLoop loop;
+    decoder.resume_executor = [&loop](std::coroutine_handle<> coro) { loop.post(coro); };
+    NJ_TRY_RET(decoder.start_completion_thread());
+
+    // Coroutines run until their first co_await, all submissions then happen on the loop
+    int num_running = num_coroutines, num_failed = 0;
+    auto start = Clock::now();
+    for (auto &surf: surfs)
+        client(decoder, image, *surf, iterations, run.round_trips, num_running, num_failed);
+    loop.run_until(num_running);
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    NJ_TRY_RET(decoder.stop_completion_thread());
+
+    run.resume_latencies = std::move(loop.resume_latencies);
+    run.images_per_s     = num_coroutines * iterations / elapsed;
+    return num_failed ? EIO : 0;
+}
+
+int run_blocking(const nj::Image &image, int iterations, std::vector<double> &round_trips) {
+    nj::Decoder decoder;
+    NJ_TRY_RET(decoder.initialize(1, 0x500000, nj::Decoder::Backend::Hardware));
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    nj::Surface surf(image.width, image.height);
+    NJ_TRY_RET(surf.allocate());
+
+    for (int i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        NJ_TRY_RET(decoder.render(image, surf, 255));
+        NJ_TRY_RET(decoder.wait(surf));
+        round_trips.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+#ifndef __SWITCH__
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+        if (!std::strcmp(argv[first], "-e"))
+            nj::NvDevice::set_ops(nj::NvEmulator::get_ops());
+        else if (!std::strcmp(argv[first], "-t") && first + 1 < argc)
+            nj::NvEmulator::set_engine_throughput(std::atof(argv[++first]));
+    }
+#endif
+
+    if (argc < first + 1) {
+        std::fprintf(stderr, "Usage: %s [-e] [-t mpix/s] jpg [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    auto iterations = (argc >= first + 2) ? std::max(std::atoi(argv[first + 1]), 1) : 200;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Image image(argv[first]);
+    if (!image.is_valid() || image.parse()) {
+        std::perror("Invalid file");
+        return 1;
+    }
+
+    std::printf("Image: %ux%u, %d iterations\n", image.width, image.height, iterations);
+
+    std::vector<double> blocking;
+    Run single;
+    if (run_blocking(image, iterations, blocking) || run_coroutines(image, 1, 1, iterations, single)) {
+        std::fprintf(stderr, "Failed to run\n");
+        return 1;
+    }
+
+    auto b = get_stats(blocking), c = get_stats(single.round_trips), r = get_stats(single.resume_latencies);
+    std::printf("Blocking render + wait: mean %9.1fus, p50 %9.1fus, p99 %9.1fus\n", b.mean, b.p50, b.p99);
+    std::printf("co_await decode:        mean %9.1fus, p50 %9.1fus, p99 %9.1fus\n", c.mean, c.p50, c.p99);
+    std::printf("Resume latency:         mean %9.1fus, p50 %9.1fus, p99 %9.1fus\n", r.mean, r.p50, r.p99);
+
+    // Coroutines beyond the ring depth wait for an entry when submitting, on the loop
+    constexpr int num_entries = 8;
+    for (auto num_coroutines: { 1, 8, 64, 1024 }) {
+        Run run;
+        auto per_coroutine = std::max(iterations / num_coroutines, 2);
+        if (auto rc = run_coroutines(image, num_coroutines, num_entries, per_coroutine, run); rc) {
+            std::fprintf(stderr, "Failed to run %d coroutines: %#x\n", num_coroutines, rc);
+            return 1;
+        }
+
+        auto s = get_stats(run.resume_latencies);
+        std::printf("%4d coroutines, %d entries: %9.1f images/s, resume latency p50 %7.1fus, p99 %7.1fus\n",
+            num_coroutines, num_entries, run.images_per_s, s.p50, s.p99);
+    }
+
+    return 0;
+}
@@ -0,0 +1,488 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nvjpg.hpp>
+
+namespace nj {
+
+// Generates baseline JPEGs of synthetic content (gradients, texture and noise), with the standard Huffman tables
+// and scaled quantization tables of libjpeg, so that a benchmark corpus covers the sizes, sampling formats,
+// restart intervals and quality levels of interest without shipping files. Output is deterministic for a spec
+class CorpusGenerator {
+    public:
+        struct Spec {
+            std::uint16_t  width, height;
+            SamplingFormat sampling         = SamplingFormat::S420;
+            int            quality          = 75;   // 1-100, as in libjpeg
+            std::uint16_t  restart_interval = 0;    // In MCUs, 0 to disable
+            std::uint32_t  seed             = 0;
+
+            std::string name() const {
+                char buf[64];
+                std::snprintf(buf, sizeof(buf), "%ux%u-%s-q%d-r%u", this->width, this->height,
+                    CorpusGenerator::get_sampling_name(this->sampling), this->quality, this->restart_interval);
+                return buf;
+            }
+        };
+
+    public:
+        static const char *get_sampling_name(SamplingFormat sampling) {
+            switch (sampling) {
+                case SamplingFormat::Monochrome:
+                    return "gray";
+                case SamplingFormat::S420:
+                default:
+                    return "420";
+                case SamplingFormat::S422:
+                    return "422";
+                case SamplingFormat::S440:
+                    return "440";
+                case SamplingFormat::S444:
+                    return "444";
+            }
+        }
+
+        // Each axis is varied on its own around a 1280x720 4:2:0 image at quality 75
+        static std::vector<Spec> get_default_specs() {
+            std::vector<Spec> specs;
+
+            for (auto [w, h]: { std::pair{ 64, 64 }, { 256, 256 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 } })
+                specs.push_back({ .width = std::uint16_t(w), .height = std::uint16_t(h) });
+
+            for (auto sampling: { SamplingFormat::Monochrome, SamplingFormat::S422,
+                    SamplingFormat::S440, SamplingFormat::S444 })
+                specs.push_back({ .width = 1280, .height = 720, .sampling = sampling });
+
+            for (auto quality: { 25, 50, 90, 100 })
+                specs.push_back({ .width = 1280, .height = 720, .quality = quality });
+
+            // One marker per MCU row, and one every MCU
+            for (auto interval: { 80, 1 })
+                specs.push_back({ .width = 1280, .height = 720, .restart_interval = std::uint16_t(interval) });
+
+            return specs;
+        }
+
+        static std::vector<std::uint8_t> generate(const Spec &spec) {
+            CorpusGenerator gen(spec);
+            gen.write();
+            return std::move(gen.out);
+        }
+
+    private:
+        struct Component {
+            int samp_h, samp_v;
+            int width, height;                  // In samples
+            int table;                          // Quantization and Huffman tables, 0 for luma, 1 for chroma
+            std::vector<float> samples;
+            int dc_pred = 0;
+        };
+
+        struct HuffmanCode {
+            std::array<std::uint16_t, 256> codes = {};
+            std::array<std::uint8_t,  256> sizes = {};
+        };
+
+        struct HuffmanSpec {
+            std::array<std::uint8_t, 16> bits;
+            std::vector<std::uint8_t>    symbols;
+        };
+
+    private:
+        CorpusGenerator(const Spec &spec): spec(spec) {
+            auto [samp_h, samp_v] = [&spec]() -> std::pair<int, int> {
+                switch (spec.sampling) {
+                    case SamplingFormat::Monochrome:
+                    case SamplingFormat::S444:
+                    default:
+                        return { 1, 1 };
+                    case SamplingFormat::S420:
+                        return { 2, 2 };
+                    case SamplingFormat::S422:
+                        return { 2, 1 };
+                    case SamplingFormat::S440:
+                        return { 1, 2 };
+                }
+            }();
+
+            this->max_h = samp_h, this->max_v = samp_v;
+            this->num_mcu_h = (spec.width  + 8 * samp_h - 1) / (8 * samp_h);
+            this->num_mcu_v = (spec.height + 8 * samp_v - 1) / (8 * samp_v);
+
+            this->components.push_back({ samp_h, samp_v, spec.width, spec.height, 0, {} });
+            if (spec.sampling != SamplingFormat::Monochrome) {
+                auto w = (spec.width + samp_h - 1) / samp_h, h = (spec.height + samp_v - 1) / samp_v;
+                this->components.push_back({ 1, 1, w, h, 1, {} });
+                this->components.push_back({ 1, 1, w, h, 1, {} });
+            }
+
+            this->fill_samples();
+
+            auto scale = (spec.quality < 50) ? 5000 / std::max(spec.quality, 1) : 200 - 2 * std::min(spec.quality, 100);
+            for (int i = 0; i < 64; ++i) {
+                this->quant[0][i] = std::clamp((luma_quant  [i] * scale + 50) / 100, 1, 255);
+                this->quant[1][i] = std::clamp((chroma_quant[i] * scale + 50) / 100, 1, 255);
+            }
+
+            this->dc_codes[0] = make_code(dc_luma_spec);
+            this->dc_codes[1] = make_code(dc_chroma_spec);
+            this->ac_codes[0] = make_code(ac_luma_spec);
+            this->ac_codes[1] = make_code(ac_chroma_spec);
+        }
+
+        // Smooth gradients and low-frequency waves, with a band of fine texture and some noise
+        void fill_samples() {
+            auto rng = this->spec.seed * 2654435761u + 1;
+            auto noise = [&rng] {
+                rng ^= rng << 13, rng ^= rng >> 17, rng ^= rng << 5;
+                return static_cast<float>(rng & 0xff) / 255.0f - 0.5f;
+            };
+
+            float w = this->spec.width, h = this->spec.height;
+            std::vector<std::array<float, 3>> pixels(static_cast<std::size_t>(this->spec.width) * this->spec.height);
+            for (int y = 0; y < this->spec.height; ++y) {
+                for (int x = 0; x < this->spec.width; ++x) {
+                    auto u = x / w, v = y / h;
+                    auto luma = 128.0f + 70.0f * std::sin(6.0f * u + 3.0f * v) * std::cos(4.0f * v)
+                        + 20.0f * std::sin(0.9f * x) * (v > 0.4f && v < 0.6f) + 12.0f * noise();
+                    pixels[static_cast<std::size_t>(y) * this->spec.width + x] = {
+                        std::clamp(luma, 0.0f, 255.0f),
+                        128.0f + 60.0f * (u - 0.5f) + 4.0f * noise(),
+                        128.0f + 60.0f * (v - 0.5f) + 4.0f * noise(),
+                    };
+                }
+            }
+
+            // Box-filter the chroma planes down to their resolution
+            for (std::size_t c = 0; c < this->components.size(); ++c) {
+                auto &comp = this->components[c];
+                auto fh = this->max_h / comp.samp_h, fv = this->max_v / comp.samp_v;
+                comp.samples.resize(static_cast<std::size_t>(comp.width) * comp.height);
+                for (int y = 0; y < comp.height; ++y) {
+                    for (int x = 0; x < comp.width; ++x) {
+                        float sum = 0;
+                        int count = 0;
+                        for (int j = 0; j < fv; ++j) {
+                            for (int i = 0; i < fh; ++i) {
+                                auto sx = std::min(x * fh + i, this->spec.width  - 1);
+                                auto sy = std::min(y * fv + j, this->spec.height - 1);
+                                sum += pixels[static_cast<std::size_t>(sy) * this->spec.width + sx][c], ++count;
+                            }
+                        }
+                        comp.samples[static_cast<std::size_t>(y) * comp.width + x] = sum / count;
+                    }
+                }
+            }
+        }
+
+        static HuffmanCode make_code(const HuffmanSpec &spec) {
+            HuffmanCode code;
+            std::uint32_t val = 0;
+            std::size_t idx = 0;
+            for (int len = 1; len <= 16; ++len, val <<= 1) {
+                for (int i = 0; i < spec.bits[len - 1]; ++i, ++val, ++idx) {
+                    code.codes[spec.symbols[idx]] = static_cast<std::uint16_t>(val);
+                    code.sizes[spec.symbols[idx]] = static_cast<std::uint8_t>(len);
+                }
+            }
+            return code;
+        }
+
+        void put_byte(std::uint8_t byte) {
+            this->out.push_back(byte);
+        }
+
+        void put_be16(std::uint32_t val) {
+            this->put_byte(static_cast<std::uint8_t>(val >> 8));
+            this->put_byte(static_cast<std::uint8_t>(val));
+        }
+
+        void put_marker(std::uint8_t marker) {
+            this->put_byte(0xff);
+            this->put_byte(marker);
+        }
+
+        void put_bits(std::uint32_t bits, int count) {
+            for (int i = count - 1; i >= 0; --i) {
+                this->acc = (this->acc << 1) | ((bits >> i) & 1);
+                if (++this->num_bits == 8) {
+                    this->put_byte(static_cast<std::uint8_t>(this->acc));
+                    if (this->acc == 0xff)
+                        this->put_byte(0x00);
+                    this->acc = 0, this->num_bits = 0;
+                }
+            }
+        }
+
+        // Pads the last byte with 1 bits
+        void flush_bits() {
+            if (this->num_bits)
+                this->put_bits(0x7f, 8 - this->num_bits);
+        }
+
+        void put_dht(int is_ac, int id, const HuffmanSpec &spec) {
+            this->put_marker(0xc4);
+            this->put_be16(2 + 1 + 16 + spec.symbols.size());
+            this->put_byte(static_cast<std::uint8_t>(is_ac << 4 | id));
+            for (auto count: spec.bits)
+                this->put_byte(count);
+            for (auto sym: spec.symbols)
+                this->put_byte(sym);
+        }
+
+        void encode_block(Component &comp, int bx, int by) {
+            std::array<float, 64> block;
+            for (int y = 0; y < 8; ++y) {
+                for (int x = 0; x < 8; ++x) {
+                    // Edge samples are replicated into the MCU padding
+                    auto sx = std::min(bx * 8 + x, comp.width  - 1);
+                    auto sy = std::min(by * 8 + y, comp.height - 1);
+                    block[y * 8 + x] = comp.samples[static_cast<std::size_t>(sy) * comp.width + sx] - 128.0f;
+                }
+            }
+
+            std::array<int, 64> coefs;
+            for (int v = 0; v < 8; ++v) {
+                for (int u = 0; u < 8; ++u) {
+                    float sum = 0;
+                    for (int y = 0; y < 8; ++y)
+                        for (int x = 0; x < 8; ++x)
+                            sum += block[y * 8 + x] * cosines[x][u] * cosines[y][v];
+
+                    auto cu = u ? 1.0f : 1.0f / std::sqrt(2.0f), cv = v ? 1.0f : 1.0f / std::sqrt(2.0f);
+                    auto q  = this->quant[comp.table][v * 8 + u];
+                    coefs[v * 8 + u] = static_cast<int>(std::lround(0.25f * cu * cv * sum / q));
+                }
+            }
+
+            auto category = [](int val) {
+                return val ? 32 - __builtin_clz(static_cast<std::uint32_t>(std::abs(val))) : 0;
+            };
+
+            auto put_symbol = [this](const HuffmanCode &code, int sym, int val, int size) {
+                this->put_bits(code.codes[sym], code.sizes[sym]);
+                if (size)
+                    this->put_bits(static_cast<std::uint32_t>(val < 0 ? val - 1 : val) & ((1u << size) - 1), size);
+            };
+
+            auto diff = coefs[0] - comp.dc_pred;
+            comp.dc_pred = coefs[0];
+            put_symbol(this->dc_codes[comp.table], category(diff), diff, category(diff));
+
+            int run = 0;
+            for (int k = 1; k < 64; ++k) {
+                auto val = coefs[zigzag[k]];
+                if (!val) {
+                    ++run;
+                    continue;
+                }
+
+                for (; run > 15; run -= 16)
+                    put_symbol(this->ac_codes[comp.table], 0xf0, 0, 0);
+
+                put_symbol(this->ac_codes[comp.table], run << 4 | category(val), val, category(val));
+                run = 0;
+            }
+
+            if (run)
+                put_symbol(this->ac_codes[comp.table], 0x00, 0, 0);
+        }
+
+        void write() {
+            this->put_marker(0xd8);
+
+            for (int t = 0; t < ((this->components.size() > 1) ? 2 : 1); ++t) {
+                this->put_marker(0xdb);
+                this->put_be16(2 + 1 + 64);
+                this->put_byte(static_cast<std::uint8_t>(t));
+                for (int k = 0; k < 64; ++k)
+                    this->put_byte(static_cast<std::uint8_t>(this->quant[t][zigzag[k]]));
+            }
+
+            this->put_marker(0xc0);
+            this->put_be16(8 + 3 * this->components.size());
+            this->put_byte(8);
+            this->put_be16(this->spec.height);
+            this->put_be16(this->spec.width);
+            this->put_byte(static_cast<std::uint8_t>(this->components.size()));
+            for (std::size_t i = 0; i < this->components.size(); ++i) {
+                auto &comp = this->components[i];
+                this->put_byte(static_cast<std::uint8_t>(i + 1));
+                this->put_byte(static_cast<std::uint8_t>(comp.samp_h << 4 | comp.samp_v));
+                this->put_byte(static_cast<std::uint8_t>(comp.table));
+            }
+
+            this->put_dht(0, 0, dc_luma_spec);
+            this->put_dht(1, 0, ac_luma_spec);
+            if (this->components.size() > 1) {
+                this->put_dht(0, 1, dc_chroma_spec);
+                this->put_dht(1, 1, ac_chroma_spec);
+            }
+
+            if (this->spec.restart_interval) {
+                this->put_marker(0xdd);
+                this->put_be16(4);
+                this->put_be16(this->spec.restart_interval);
+            }
+
+            this->put_marker(0xda);
+            this->put_be16(6 + 2 * this->components.size());
+            this->put_byte(static_cast<std::uint8_t>(this->components.size()));
+            for (std::size_t i = 0; i < this->components.size(); ++i) {
+                this->put_byte(static_cast<std::uint8_t>(i + 1));
+                this->put_byte(static_cast<std::uint8_t>(this->components[i].table << 4 | this->components[i].table));
+            }
+            this->put_byte(0), this->put_byte(63), this->put_byte(0);
+
+            // A single component is coded non-interleaved, one block per MCU
+            bool single = this->components.size() == 1;
+            auto mcus_h = single ? (this->spec.width  + 7) / 8 : this->num_mcu_h;
+            auto mcus_v = single ? (this->spec.height + 7) / 8 : this->num_mcu_v;
+
+            int num_mcus = 0, num_restarts = 0;
+            for (int my = 0; my < mcus_v; ++my) {
+                for (int mx = 0; mx < mcus_h; ++mx) {
+                    if (this->spec.restart_interval && num_mcus && !(num_mcus % this->spec.restart_interval)) {
+                        this->flush_bits();
+                        this->put_marker(static_cast<std::uint8_t>(0xd0 + (num_restarts++ & 7)));
+                        for (auto &comp: this->components)
+                            comp.dc_pred = 0;
+                    }
+
+                    for (auto &comp: this->components)
+                        for (int v = 0; v < comp.samp_v; ++v)
+                            for (int h = 0; h < comp.samp_h; ++h)
+                                this->encode_block(comp, single ? mx : mx * comp.samp_h + h,
+                                    single ? my : my * comp.samp_v + v);
+                    ++num_mcus;
+                }
+            }
+
+            this->flush_bits();
+            this->put_marker(0xd9);
+        }
+
+    private:
+        constexpr static std::array<int, 64> zigzag = {
+             0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+            12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+            35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+            58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+        };
+
+        // Annex K.1, in natural order
+        constexpr static std::array<int, 64> luma_quant = {
+            16, 11, 10, 16,  24,  40,  51,  61,
+            12, 12, 14, 19,  26,  58,  60,  55,
+            14, 13, 16, 24,  40,  57,  69,  56,
+            14, 17, 22, 29,  51,  87,  80,  62,
+            18, 22, 37, 56,  68, 109, 103,  77,
+            24, 35, 55, 64,  81, 104, 113,  92,
+            49, 64, 78, 87, 103, 121, 120, 101,
+            72, 92, 95, 98, 112, 100, 103,  99,
+        };
+
+        constexpr static std::array<int, 64> chroma_quant = {
+            17, 18, 24, 47, 99, 99, 99, 99,
+            18, 21, 26, 66, 99, 99, 99, 99,
+            24, 26, 56, 99, 99, 99, 99, 99,
+            47, 66, 99, 99, 99, 99, 99, 99,
+            99, 99, 99, 99, 99, 99, 99, 99,
+            99, 99, 99, 99, 99, 99, 99, 99,
+            99, 99, 99, 99, 99, 99, 99, 99,
+            99, 99, 99, 99, 99, 99, 99, 99,
+        };
+
+        // Annex K.3
+        static inline const HuffmanSpec dc_luma_spec = {
+            { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+            { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 },
+        };
+
+        static inline const HuffmanSpec dc_chroma_spec = {
+            { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+            { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 },
+        };
+
+        static inline const HuffmanSpec ac_luma_spec = {
+            { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+            {
+                0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+                0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+                0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+                0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+                0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+                0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+                0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+                0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+                0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+                0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+                0xf9, 0xfa,
+            },
+        };
+
+        static inline const HuffmanSpec ac_chroma_spec = {
+            { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+            {
+                0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+                0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+                0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+                0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+                0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+                0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+                0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+                0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+                0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+                0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+                0xf9, 0xfa,
+            },
+        };
+
+        // cos((2x + 1)uπ/16)
+        static inline const auto cosines = [] {
+            std::array<std::array<float, 8>, 8> table;
+            for (int x = 0; x < 8; ++x)
+                for (int u = 0; u < 8; ++u)
+                    table[x][u] = std::cos((2 * x + 1) * u * 3.14159265358979f / 16.0f);
+            return table;
+        }();
+
+    private:
+        Spec spec;
+        int max_h = 1, max_v = 1;
+        int num_mcu_h = 0, num_mcu_v = 0;
+        std::vector<Component> components;
+        std::array<std::array<int, 64>, 2> quant;
+        std::array<HuffmanCode, 2> dc_codes, ac_codes;
+
+        std::vector<std::uint8_t> out;
+        std::uint32_t acc = 0;
+        int num_bits = 0;
+};
+
+} // namespace nj
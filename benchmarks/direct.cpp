@@ -0,0 +1,139 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <nvjpg.hpp>
+
+#include "corpus.hpp"
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Displays an image in a caller-owned framebuffer, by rendering it to a private surface then copying it
+// line by line (as examples/render-nx.cpp does), and by rendering straight into the framebuffer through a SurfaceView
+// Reports the time per frame of both, and checks they produce the same framebuffer
+// Passing -e runs against the in-process driver emulator instead of the kernel
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t fb_width = 1280, fb_height = 720, fb_pitch = fb_width * 4;
+constexpr std::size_t fb_size  = nj::align_up(fb_pitch * fb_height, std::size_t(0x1000));
+
+struct FreeDeleter {
+    void operator ()(void *ptr) const {
+        std::free(ptr);
+    }
+};
+
+using Framebuffer = std::unique_ptr<std::uint8_t, FreeDeleter>;
+
+Framebuffer make_framebuffer() {
+    auto *fb = static_cast<std::uint8_t *>(std::aligned_alloc(0x1000, fb_size));
+    if (fb)
+        std::memset(fb, 0, fb_size);
+    return Framebuffer(fb);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+#ifndef __SWITCH__
+    if (argc >= 2 && !std::strcmp(argv[1], "-e"))
+        nj::NvDevice::set_ops(nj::NvEmulator::get_ops()), first = 2;
+#endif
+
+    auto iterations = (argc >= first + 1) ? std::max(std::atoi(argv[first]), 1) : 100;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize decoder: %#x\n", rc);
+        return 1;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    auto data = std::make_shared<std::vector<std::uint8_t>>(nj::CorpusGenerator::generate({
+        .width = fb_width, .height = fb_height,
+    }));
+    nj::Image image(data);
+    if (auto rc = image.parse(); rc) {
+        std::fprintf(stderr, "Failed to parse generated image: %#x\n", rc);
+        return 1;
+    }
+
+    auto copied_fb = make_framebuffer(), direct_fb = make_framebuffer();
+    if (!copied_fb || !direct_fb) {
+        std::fprintf(stderr, "Failed to allocate framebuffers\n");
+        return 1;
+    }
+
+    nj::Surface surf(image.width, image.height);
+    if (auto rc = surf.allocate(); rc) {
+        std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+        return 1;
+    }
+
+    nj::SurfaceView view(image.width, image.height);
+    if (auto rc = view.import(direct_fb.get(), fb_size, fb_pitch); rc) {
+        std::fprintf(stderr, "Failed to import framebuffer: %#x\n", rc);
+        return 1;
+    }
+
+    auto copied_start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        if (decoder.render(image, surf, 255) || decoder.wait(surf))
+            return 1;
+        for (std::size_t y = 0; y < std::min(fb_height, surf.height); ++y)
+            std::copy_n(surf.data() + y * surf.pitch, std::min(surf.width, fb_width) * surf.get_bpp(),
+                copied_fb.get() + y * fb_pitch);
+    }
+    auto copied_us = std::chrono::duration<double, std::micro>(Clock::now() - copied_start).count() / iterations;
+
+    auto direct_start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        if (decoder.render(image, view, 255) || decoder.wait(view))
+            return 1;
+    }
+    auto direct_us = std::chrono::duration<double, std::micro>(Clock::now() - direct_start).count() / iterations;
+
+    std::printf("%zux%zu, %d frames\n", fb_width, fb_height, iterations);
+    std::printf("Copied: %8.2fus/frame\n", copied_us);
+    std::printf("Direct: %8.2fus/frame, x%.2f\n", direct_us, copied_us / direct_us);
+
+    if (std::memcmp(copied_fb.get(), direct_fb.get(), fb_size)) {
+        std::fprintf(stderr, "Framebuffers differ\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Runs the whole parse -> submit -> wait loop on one image, keeping up to a given number of renders in flight
+// Reports the throughput and the time between each submission and the moment its completion is observed,
+// which includes the time spent queued behind earlier renders, along with some of the decoder metrics
+// Passing -e runs against the in-process driver emulator instead of the kernel, -t sets its engine speed
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int run(const nj::Image &file, int depth, int iterations) {
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(depth, 0x10000, nj::Decoder::Backend::Hardware); rc) {
+        std::fprintf(stderr, "Failed to initialize decoder: %#x\n", rc);
+        return rc;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    std::vector<std::unique_ptr<nj::Surface>> surfs;
+    for (int i = 0; i < depth; ++i) {
+        auto &surf = surfs.emplace_back(std::make_unique<nj::Surface>(file.width, file.height, nj::PixelFormat::RGBA));
+        if (auto rc = surf->allocate(); rc) {
+            std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+            return rc;
+        }
+    }
+
+    std::vector<Clock::time_point> submitted(depth);
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+
+    auto retire = [&](int slot) {
+        NJ_TRY_RET(decoder.wait(*surfs[slot]));
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - submitted[slot]).count());
+        return 0;
+    };
+
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        auto slot = i % depth;
+        if (i >= depth)
+            NJ_TRY_RET(retire(slot));
+
+        auto image = file;
+        NJ_TRY_RET(image.parse());
+
+        submitted[slot] = Clock::now();
+        if (auto rc = decoder.render(image, *surfs[slot], 255); rc) {
+            std::fprintf(stderr, "Failed to render: %#x\n", rc);
+            return rc;
+        }
+    }
+
+    for (int i = std::max(iterations - depth, 0); i < iterations; ++i)
+        NJ_TRY_RET(retire(i % depth));
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto mean = 0.0;
+    for (auto l: latencies)
+        mean += l / latencies.size();
+
+    std::printf("Depth %2d: %9.1f images/s, latency mean %9.1fus, p50 %9.1fus, p99 %9.1fus\n", depth,
+        iterations / elapsed, mean, latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+
+    auto metrics = decoder.get_metrics();
+    std::printf("          %llu ring stalls, submit p50 %7.1fus p99 %7.1fus, fence wait p50 %9.1fus, "
+        "%.1f%% of the scan data used\n", static_cast<unsigned long long>(metrics.ring_stalls),
+        metrics.submit_ns.percentile(50) / 1e3, metrics.submit_ns.percentile(99) / 1e3,
+        metrics.fence_wait_ns.percentile(50) / 1e3,
+        metrics.scan_bytes ? 100.0 * metrics.used_bytes / metrics.scan_bytes : 0.0);
+    std::printf("          scan arena of %zu KiB after %llu grows, %llu renders waited for space\n",
+        decoder.capacity() / 1024, static_cast<unsigned long long>(metrics.scan_arena_grows),
+        static_cast<unsigned long long>(metrics.scan_arena_waits));
+
+#ifndef __SWITCH__
+    if (&nj::NvDevice::get_ops() == &nj::NvEmulator::get_ops())
+        std::printf("          %zu nvmap handles in use, including %d surfaces\n",
+            nj::NvEmulator::get_stats().num_handles, depth);
+#endif
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+#ifndef __SWITCH__
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+        if (!std::strcmp(argv[first], "-e"))
+            nj::NvDevice::set_ops(nj::NvEmulator::get_ops());
+        else if (!std::strcmp(argv[first], "-t") && first + 1 < argc)
+            nj::NvEmulator::set_engine_throughput(std::atof(argv[++first]));
+    }
+#endif
+
+    if (argc < first + 1) {
+        std::fprintf(stderr, "Usage: %s [-e] [-t mpix/s] jpg [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    auto iterations = (argc >= first + 2) ? std::max(std::atoi(argv[first + 1]), 1) : 200;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Image file(argv[first]);
+    if (!file.is_valid() || file.parse()) {
+        std::perror("Invalid file");
+        return 1;
+    }
+
+    std::printf("Image: %ux%u, %zu bytes of scan data, %d iterations\n",
+        file.width, file.height, file.get_scan_data().size(), iterations);
+
+    for (auto depth: { 1, 2, 4, 8 }) {
+        if (run(file, depth, iterations))
+            return 1;
+    }
+
+    return 0;
+}
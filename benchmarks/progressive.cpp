@@ -0,0 +1,129 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Compares the two ways of decoding progressive images, for each file given on the command line:
+//  - Software:  entropy decoding, IDCT and color conversion on the CPU
+//  - Transcode: re-encoding to a baseline stream on the CPU, the part of the hardware path that isn't offloaded
+//  - NVJPG:     transcoding followed by a render on the engine
+// Passing -e runs against the in-process driver emulator instead of the kernel
+
+namespace {
+
+double time_ms(int iterations, auto &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        if (auto rc = fn(); rc) {
+            std::fprintf(stderr, "Failed: %#x\n", rc);
+            return -1;
+        }
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+void print(const char *name, double ms, const nj::Image &image) {
+    if (ms < 0)
+        return;
+    std::printf("  %-10s: %8.3fms/image, %7.2f Mpix/s\n", name, ms, image.width * image.height / ms / 1e3);
+}
+
+int run_decoder(nj::Decoder::Backend backend, const nj::Image &image, int iterations) {
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(1, 0x500000, backend); rc) {
+        std::fprintf(stderr, "  Failed to initialize decoder: %#x\n", rc);
+        return rc;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    nj::Surface surf(image.width, image.height, nj::PixelFormat::RGBA);
+    if (auto rc = surf.allocate(); rc) {
+        std::fprintf(stderr, "  Failed to allocate surface: %#x\n", rc);
+        return rc;
+    }
+
+    auto ms = time_ms(iterations, [&] {
+        NJ_TRY_RET(decoder.render(image, surf, 255));
+        return decoder.wait(surf);
+    });
+
+    print((backend == nj::Decoder::Backend::Software) ? "Software" : "NVJPG", ms, image);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int iterations = 20, first = 1;
+#ifndef __SWITCH__
+    if (argc >= 2 && !std::strcmp(argv[1], "-e"))
+        nj::NvDevice::set_ops(nj::NvEmulator::get_ops()), first = 2;
+#endif
+    if (argc >= first + 2 && !std::strcmp(argv[first], "-n"))
+        iterations = std::max(std::atoi(argv[first + 1]), 1), first += 2;
+
+    if (argc < first + 1) {
+        std::fprintf(stderr, "Usage: %s [-e] [-n iterations] jpg...\n", argv[0]);
+        return 1;
+    }
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    for (int i = first; i < argc; ++i) {
+        nj::Image image(argv[i]);
+        if (!image.is_valid() || image.parse()) {
+            std::fprintf(stderr, "%s: invalid file\n", argv[i]);
+            continue;
+        }
+
+        if (!image.progressive) {
+            std::fprintf(stderr, "%s: not a progressive image\n", argv[i]);
+            continue;
+        }
+
+        nj::ProgressiveTranscoder transcoder;
+        nj::Image baseline;
+        if (auto rc = transcoder.transcode(image, baseline); rc) {
+            std::fprintf(stderr, "%s: failed to transcode: %d\n", argv[i], rc);
+            continue;
+        }
+
+        std::printf("%s: %ux%u, %zu bytes of progressive scans, %zu bytes once transcoded\n", argv[i],
+            image.width, image.height, image.get_scan_data().size(), baseline.get_scan_data().size());
+
+        run_decoder(nj::Decoder::Backend::Software, image, iterations);
+
+        print("Transcode", time_ms(iterations, [&] { return transcoder.transcode(image, baseline); }), image);
+
+        run_decoder(nj::Decoder::Backend::Hardware, image, iterations);
+    }
+
+    return 0;
+}
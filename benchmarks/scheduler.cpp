@@ -0,0 +1,174 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Decodes a mixed-size corpus (eg. icons alongside photos) in random order through the scheduler,
+// once with each routing policy, rendering a window of images before waiting on them
+// Passing -e runs against the in-process driver emulator instead of the kernel
+
+namespace {
+
+struct Entry {
+    std::unique_ptr<nj::Image>   image;
+    std::unique_ptr<nj::Surface> surf;
+};
+
+const char *policy_name(nj::Scheduler::Policy policy) {
+    switch (policy) {
+        case nj::Scheduler::Policy::Hardware:
+            return "Hardware";
+        case nj::Scheduler::Policy::Software:
+            return "Software";
+        case nj::Scheduler::Policy::CostModel:
+        default:
+            return "CostModel";
+    }
+}
+
+void print_model(const char *name, const nj::CostModel &model) {
+    auto &w = model.get_weights();
+    std::printf("    %s model: %zu samples, %5.1f%% error, weights: bias %.1f, kMCU %.1f, kblock %.1f, KiB %.2f, "
+        "Mpix %.1f, progressive kblock %.1f\n", name, model.get_num_samples(), model.get_error() * 100.0,
+        w[0], w[1], w[2], w[3], w[4], w[5]);
+}
+
+int run(nj::Scheduler::Policy policy, std::vector<Entry> &corpus, const std::vector<std::size_t> &order,
+        std::size_t num_workers, std::size_t window, bool verbose) {
+    nj::Scheduler scheduler;
+    if (auto rc = scheduler.initialize(num_workers, window); rc) {
+        std::fprintf(stderr, "Failed to initialize scheduler: %#x\n", rc);
+        return rc;
+    }
+    NJ_SCOPEGUARD([&scheduler] { scheduler.finalize(); });
+
+    scheduler.policy = policy;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < order.size(); i += window) {
+        auto end = std::min(i + window, order.size());
+
+        for (auto j = i; j < end; ++j) {
+            auto &entry = corpus[order[j]];
+            if (auto rc = scheduler.render(*entry.image, *entry.surf, 255); rc) {
+                std::fprintf(stderr, "Failed to render image: %#x\n", rc);
+                return rc;
+            }
+
+            if (verbose) {
+                auto &d = scheduler.get_last_decision();
+                std::printf("    %4ux%-4u %7zu bytes -> %-8s (hw %8.1f + %8.1fus, depth %zu | sw %8.1f + %8.1fus, depth %zu)\n",
+                    entry.image->width, entry.image->height, d.job.scan_size,
+                    (d.target == nj::Scheduler::Target::Hardware) ? "Hardware" : "Software",
+                    d.hw_wait_us, d.hw_service_us, d.hw_queue_depth, d.sw_wait_us, d.sw_service_us, d.sw_queue_depth);
+            }
+        }
+
+        for (auto j = i; j < end; ++j)
+            scheduler.wait(*corpus[order[j]].surf);
+    }
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    auto stats = scheduler.get_stats();
+    std::printf("%-9s: %9.3fms, %8.1f images/s, %zu on the engine, %zu on the CPU\n", policy_name(policy),
+        ms, order.size() / ms * 1e3, stats.num_hardware, stats.num_software);
+
+    if (policy == nj::Scheduler::Policy::CostModel) {
+        print_model("Hardware", scheduler.get_model(nj::Scheduler::Target::Hardware));
+        print_model("Software", scheduler.get_model(nj::Scheduler::Target::Software));
+    }
+
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s [-e] [-n passes] [-w workers] [-q window] [-v] jpg...\n", argv[0]);
+        return 1;
+    }
+
+    int passes = 20, num_workers = 2, window = 4, first = 1;
+    bool verbose = false;
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+#ifndef __SWITCH__
+        if (!std::strcmp(argv[first], "-e"))
+            nj::NvDevice::set_ops(nj::NvEmulator::get_ops());
+        else
+#endif
+        if (!std::strcmp(argv[first], "-v"))
+            verbose = true;
+        else if (first + 1 < argc && !std::strcmp(argv[first], "-n"))
+            passes = std::max(std::atoi(argv[++first]), 1);
+        else if (first + 1 < argc && !std::strcmp(argv[first], "-w"))
+            num_workers = std::max(std::atoi(argv[++first]), 0);
+        else if (first + 1 < argc && !std::strcmp(argv[first], "-q"))
+            window = std::max(std::atoi(argv[++first]), 1);
+    }
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    std::vector<Entry> corpus;
+    for (int i = first; i < argc; ++i) {
+        auto image = std::make_unique<nj::Image>(argv[i]);
+        if (!image->is_valid() || image->parse()) {
+            std::fprintf(stderr, "%s: invalid file\n", argv[i]);
+            continue;
+        }
+
+        auto surf = std::make_unique<nj::Surface>(image->width, image->height, nj::PixelFormat::RGBA);
+        if (auto rc = surf->allocate(); rc) {
+            std::fprintf(stderr, "%s: failed to allocate surface: %#x\n", argv[i], rc);
+            continue;
+        }
+
+        corpus.push_back({ std::move(image), std::move(surf) });
+    }
+
+    if (corpus.empty())
+        return 1;
+
+    std::vector<std::size_t> order;
+    for (int i = 0; i < passes; ++i)
+        for (std::size_t j = 0; j < corpus.size(); ++j)
+            order.push_back(j);
+    std::shuffle(order.begin(), order.end(), std::mt19937(0));
+
+    std::printf("%zu images, %zu renders, %d CPU workers, windows of %d\n", corpus.size(), order.size(), num_workers, window);
+
+    for (auto policy: { nj::Scheduler::Policy::Hardware, nj::Scheduler::Policy::Software, nj::Scheduler::Policy::CostModel })
+        run(policy, corpus, order, num_workers, window, verbose && (policy == nj::Scheduler::Policy::CostModel));
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Renders an image from 1 to N producer threads, either through a SharedDecoder or with a decoder per thread,
+// each thread keeping a few renders in flight, and reports the total throughput and the mean latency of a render
+// Passing -e runs against the in-process driver emulator instead of the kernel, -t sets its engine speed
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t depth = 2;    // Renders in flight per producer
+
+struct Run {
+    double images_per_s, latency_us;
+    int rc;
+};
+
+struct Producer {
+    std::array<std::unique_ptr<nj::Surface>, depth> surfs;
+    std::array<Clock::time_point, depth> starts;
+    double latency_us = 0;
+    int rc = 0;
+};
+
+template <typename Submit, typename Wait>
+Run run_producers(const nj::Image &image, int num_producers, int iterations, auto &&make_state,
+        Submit &&submit, Wait &&wait) {
+    std::vector<Producer> producers(num_producers);
+    for (auto &producer: producers) {
+        for (auto &surf: producer.surfs) {
+            surf = std::make_unique<nj::Surface>(image.width, image.height);
+            if (auto rc = surf->allocate(); rc)
+                return { 0, 0, rc };
+        }
+    }
+
+    std::atomic_int ready = 0;
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (auto &producer: producers) {
+        threads.emplace_back([&] {
+            auto state = make_state();
+            ++ready;
+
+            for (int i = 0; i < iterations + int(depth); ++i) {
+                auto slot = i % depth;
+                if (i >= int(depth)) {
+                    if (auto rc = wait(state, slot, *producer.surfs[slot]); rc) {
+                        producer.rc = rc;
+                        return;
+                    }
+                    producer.latency_us += std::chrono::duration<double, std::micro>(Clock::now() - producer.starts[slot]).count();
+                }
+
+                if (i < iterations) {
+                    producer.starts[slot] = Clock::now();
+                    if (auto rc = submit(state, slot, *producer.surfs[slot]); rc) {
+                        producer.rc = rc;
+                        return;
+                    }
+                }
+            }
+        });
+    }
+
+    for (auto &thread: threads)
+        thread.join();
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Run result = { double(num_producers) * iterations / elapsed, 0, 0 };
+    for (auto &producer: producers) {
+        result.latency_us += producer.latency_us / (double(num_producers) * iterations);
+        result.rc         |= producer.rc;
+    }
+    return result;
+}
+
+Run run_shared(const nj::Image &image, int num_producers, int iterations, double &mean_batch_size) {
+    nj::SharedDecoder decoder;
+    if (auto rc = decoder.initialize(8, 0x500000, 256, nj::Decoder::Backend::Hardware); rc)
+        return { 0, 0, rc };
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    using Tickets = std::array<nj::SharedDecoder::Ticket, depth>;
+    auto result = run_producers(image, num_producers, iterations,
+        [] { return std::make_unique<Tickets>(); },
+        [&](auto &tickets, std::size_t slot, nj::Surface &surf) {
+            return decoder.submit(image, surf, (*tickets)[slot], 255);
+        },
+        [&](auto &tickets, std::size_t slot, nj::Surface &) {
+            (*tickets)[slot].wait();
+            return (*tickets)[slot].get_completion().rc;
+        });
+
+    auto stats = decoder.get_stats();
+    mean_batch_size = stats.num_batches ? double(stats.num_requests) / stats.num_batches : 0;
+    return result;
+}
+
+Run run_separate(const nj::Image &image, int num_producers, int iterations) {
+    return run_producers(image, num_producers, iterations,
+        [] {
+            auto decoder = std::make_unique<nj::Decoder>();
+            if (decoder->initialize(depth, 0x500000, nj::Decoder::Backend::Hardware))
+                decoder.reset();
+            return decoder;
+        },
+        [&](auto &decoder, std::size_t, nj::Surface &surf) {
+            return decoder ? decoder->render(image, surf, 255) : ENODEV;
+        },
+        [&](auto &decoder, std::size_t, nj::Surface &surf) {
+            return decoder->wait(surf);
+        });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int max_producers = 8, first = 1;
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+        if (!std::strcmp(argv[first], "-p") && first + 1 < argc)
+            max_producers = std::max(std::atoi(argv[++first]), 1);
+#ifndef __SWITCH__
+        else if (!std::strcmp(argv[first], "-e"))
+            nj::NvDevice::set_ops(nj::NvEmulator::get_ops());
+        else if (!std::strcmp(argv[first], "-t") && first + 1 < argc)
+            nj::NvEmulator::set_engine_throughput(std::atof(argv[++first]));
+#endif
+    }
+
+    if (argc < first + 1) {
+        std::fprintf(stderr, "Usage: %s [-e] [-t mpix/s] [-p max producers] jpg [images per producer]\n", argv[0]);
+        return 1;
+    }
+
+    auto iterations = (argc >= first + 2) ? std::max(std::atoi(argv[first + 1]), 1) : 100;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Image image(argv[first]);
+    if (!image.is_valid() || image.parse()) {
+        std::perror("Invalid file");
+        return 1;
+    }
+
+    std::printf("Image: %ux%u, %d images per producer, %zu in flight per producer\n",
+        image.width, image.height, iterations, depth);
+    std::printf("Producers |  Shared decoder: images/s  latency  batch | Decoder per thread: images/s  latency\n");
+
+    for (int num_producers = 1; num_producers <= max_producers; num_producers *= 2) {
+        double mean_batch_size;
+        auto shared   = run_shared  (image, num_producers, iterations, mean_batch_size);
+        auto separate = run_separate(image, num_producers, iterations);
+        if (shared.rc || separate.rc) {
+            std::fprintf(stderr, "Failed to run %d producers: %#x, %#x\n", num_producers, shared.rc, separate.rc);
+            return 1;
+        }
+
+        std::printf("%9d | %25.1f %6.0fus %6.2f | %28.1f %6.0fus\n", num_producers,
+            shared.images_per_s, shared.latency_us, mean_batch_size, separate.images_per_s, separate.latency_us);
+    }
+
+    return 0;
+}
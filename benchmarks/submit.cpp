@@ -0,0 +1,151 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Measures the host-side cost of submitting a render, with the command buffer rebuilt every time,
+// and with the previous one reused and only its relocations patched
+// The render is waited on outside of the timed region, so only encoding and the submission ioctl are measured
+// Heap allocations on the submitting thread are counted as well: once warmed up, rendering a baseline image
+// should not perform any
+// Passing -e runs against the in-process driver emulator instead of the kernel
+
+namespace {
+
+thread_local std::size_t num_allocations = 0;
+
+} // namespace
+
+void *operator new(std::size_t size) {
+    ++num_allocations;
+    if (auto *ptr = std::malloc(size ? size : 1); ptr)
+        return ptr;
+    std::abort();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+struct Measurement {
+    double us;
+    double allocations;
+};
+
+Measurement measure(nj::Decoder &decoder, const nj::Image &image, nj::Surface &surf, int iterations) {
+    // Warm up, the first render of an entry encodes its command buffer from scratch
+    for (int i = 0; i < 2; ++i) {
+        if (decoder.render(image, surf, 255) || decoder.wait(surf))
+            return { -1, 0 };
+    }
+
+    double total = 0;
+    std::size_t allocations = 0;
+    for (int i = 0; i < iterations; ++i) {
+        auto start_allocs = num_allocations;
+        auto start = std::chrono::steady_clock::now();
+        if (auto rc = decoder.render(image, surf, 255); rc) {
+            std::fprintf(stderr, "Failed to render: %#x\n", rc);
+            return { -1, 0 };
+        }
+        total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        allocations += num_allocations - start_allocs;
+
+        if (auto rc = decoder.wait(surf); rc) {
+            std::fprintf(stderr, "Failed to wait: %#x\n", rc);
+            return { -1, 0 };
+        }
+    }
+    return { total / iterations, double(allocations) / iterations };
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+#ifndef __SWITCH__
+    if (argc >= 2 && !std::strcmp(argv[1], "-e"))
+        nj::NvDevice::set_ops(nj::NvEmulator::get_ops()), first = 2;
+#endif
+
+    if (argc < first + 1) {
+        std::fprintf(stderr, "Usage: %s [-e] jpg [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    auto iterations = (argc >= first + 2) ? std::max(std::atoi(argv[first + 1]), 1) : 1000;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Image image(argv[first]);
+    if (!image.is_valid() || image.parse()) {
+        std::perror("Invalid file");
+        return 1;
+    }
+
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(1, 0x500000, nj::Decoder::Backend::Hardware); rc) {
+        std::fprintf(stderr, "Failed to initialize decoder: %#x\n", rc);
+        return 1;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    nj::Surface surf(image.width, image.height, nj::PixelFormat::RGBA);
+    if (auto rc = surf.allocate(); rc) {
+        std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+        return 1;
+    }
+
+    std::printf("Image: %ux%u, %d iterations\n", image.width, image.height, iterations);
+
+    decoder.use_cmdbuf_templates = false;
+    auto rebuilt = measure(decoder, image, surf, iterations);
+
+    decoder.use_cmdbuf_templates = true;
+    auto patched = measure(decoder, image, surf, iterations);
+
+    if (rebuilt.us < 0 || patched.us < 0)
+        return 1;
+
+    std::printf("Rebuilt: %8.2fus/submit, %.2f allocations/submit\n", rebuilt.us, rebuilt.allocations);
+    std::printf("Patched: %8.2fus/submit, %.2f allocations/submit, x%.2f\n", patched.us, patched.allocations,
+        rebuilt.us / patched.us);
+
+    // Allocations in the steady state are a regression
+    return (rebuilt.allocations || patched.allocations) ? 1 : 0;
+}
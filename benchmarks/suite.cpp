@@ -0,0 +1,326 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+#include "corpus.hpp"
+
+// Runs every stage benchmark over a generated corpus varying the size, sampling format, quality and restart interval:
+// parsing, picture info, scan copy and command buffer construction (reused and rebuilt), submission,
+// the full render and wait cycle, then the throughput at increasing ring depths
+// Decoder stages are timed from the spans it records when tracing is enabled
+// Results can be written as JSON with -j to track regressions, and the corpus saved as files with -o
+// Passing -e runs against the in-process driver emulator instead of the kernel, -s uses the software backend
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Measurement {
+    std::string benchmark;
+    const nj::CorpusGenerator::Spec *spec;
+    std::size_t scan_bytes;
+    int depth;                      // Ring entries, for the depth benchmark
+    double images_per_s;
+    nj::Histogram::Snapshot ns;
+};
+
+struct CorpusImage {
+    nj::CorpusGenerator::Spec spec;
+    std::shared_ptr<std::vector<std::uint8_t>> data;
+    nj::Image image;
+};
+
+std::vector<Measurement> measurements;
+
+std::uint64_t elapsed_ns(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+void add_measurement(std::string benchmark, const CorpusImage &img, const nj::Histogram &histogram,
+        int depth = 0, double images_per_s = 0) {
+    measurements.push_back({ std::move(benchmark), &img.spec, img.image.get_scan_data().size(),
+        depth, images_per_s, histogram.snapshot() });
+}
+
+// Collects the durations of the decoder spans recorded since the tracer was last cleared
+void add_span_measurements(const CorpusImage &img, std::initializer_list<const char *> names, const char *suffix = "") {
+    for (auto *name: names) {
+        nj::Histogram histogram;
+        for (auto &event: nj::Tracer::get_events()) {
+            if (auto *n = event.name.load(std::memory_order_acquire); n && !std::strcmp(n, name))
+                histogram.record(event.end_ns - event.begin_ns);
+        }
+
+        if (histogram.snapshot().count)
+            add_measurement(std::string(name) + suffix, img, histogram);
+    }
+}
+
+int bench_parse(const CorpusImage &img, int iterations) {
+    nj::Histogram histogram;
+    for (int i = 0; i < iterations; ++i) {
+        nj::Image image(img.data);
+
+        auto start = Clock::now();
+        NJ_TRY_RET(image.parse());
+        histogram.record(elapsed_ns(start));
+    }
+
+    add_measurement("parse", img, histogram);
+    return 0;
+}
+
+int bench_render(nj::Decoder &decoder, const CorpusImage &img, nj::Surface &surf, int iterations) {
+    auto stages = {
+        "picture_info", "scan_copy", "transcode", "cmdbuf", "submit", "fence_wait", "sw_render",
+    };
+
+    for (auto use_templates: { true, false }) {
+        decoder.use_cmdbuf_templates = use_templates;
+
+        // Warm up, which also encodes the command buffer template
+        NJ_TRY_RET(decoder.render(img.image, surf, 255));
+        NJ_TRY_RET(decoder.wait(surf));
+
+        nj::Tracer::clear();
+        nj::Histogram histogram;
+        for (int i = 0; i < iterations; ++i) {
+            auto start = Clock::now();
+            NJ_TRY_RET(decoder.render(img.image, surf, 255));
+            NJ_TRY_RET(decoder.wait(surf));
+            histogram.record(elapsed_ns(start));
+        }
+
+        // The second pass only differs in the command buffer construction
+        if (use_templates) {
+            add_measurement("render_wait", img, histogram);
+            add_span_measurements(img, stages);
+        } else {
+            add_span_measurements(img, { "cmdbuf" }, "_rebuild");
+        }
+    }
+
+    decoder.use_cmdbuf_templates = true;
+    return 0;
+}
+
+int bench_depth(const CorpusImage &img, nj::Decoder::Backend backend, int depth, int num_renders) {
+    nj::Decoder decoder;
+    NJ_TRY_RET(decoder.initialize(depth, 0x500000, backend));
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    std::vector<std::unique_ptr<nj::Surface>> surfs;
+    for (int i = 0; i < depth; ++i) {
+        auto &surf = surfs.emplace_back(std::make_unique<nj::Surface>(img.image.width, img.image.height));
+        NJ_TRY_RET(surf->allocate());
+    }
+
+    // Latency goes from submission to the wait returning, and includes the time queued behind earlier renders
+    std::vector<Clock::time_point> submitted(depth);
+    nj::Histogram histogram;
+
+    auto start = Clock::now();
+    for (int i = 0; i < num_renders + depth; ++i) {
+        auto slot = i % depth;
+        if (i >= depth) {
+            NJ_TRY_RET(decoder.wait(*surfs[slot]));
+            histogram.record(elapsed_ns(submitted[slot]));
+        }
+
+        if (i < num_renders) {
+            submitted[slot] = Clock::now();
+            NJ_TRY_RET(decoder.render(img.image, *surfs[slot], 255));
+        }
+    }
+
+    add_measurement("depth", img, histogram, depth, num_renders / (elapsed_ns(start) / 1e9));
+    return 0;
+}
+
+void print_measurement(const Measurement &m) {
+    auto image = m.spec->name();
+    if (m.depth)
+        image += " x" + std::to_string(m.depth);
+
+    std::printf("%-20s %-28s %6llu %10.1f %10.1f %10.1f", m.benchmark.c_str(), image.c_str(),
+        static_cast<unsigned long long>(m.ns.count), m.ns.mean() / 1e3, m.ns.percentile(50) / 1e3,
+        m.ns.percentile(99) / 1e3);
+    if (m.images_per_s)
+        std::printf(" %10.1f images/s", m.images_per_s);
+    std::printf("\n");
+}
+
+int save_json(const char *path, const char *backend, int iterations) {
+    auto *fp = std::fopen(path, "w");
+    if (!fp)
+        return errno;
+    NJ_SCOPEGUARD([fp] { std::fclose(fp); });
+
+    std::fprintf(fp, "{\"backend\":\"%s\",\"iterations\":%d,\"results\":[\n", backend, iterations);
+    for (std::size_t i = 0; i < measurements.size(); ++i) {
+        auto &m = measurements[i];
+        std::fprintf(fp, "{\"benchmark\":\"%s\",\"image\":\"%s\",\"width\":%u,\"height\":%u,\"sampling\":\"%s\","
+            "\"quality\":%d,\"restart_interval\":%u,\"scan_bytes\":%zu,\"depth\":%d,\"images_per_s\":%.3f,"
+            "\"count\":%llu,\"mean_ns\":%.1f,\"min_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,"
+            "\"max_ns\":%llu}%s\n",
+            m.benchmark.c_str(), m.spec->name().c_str(), m.spec->width, m.spec->height,
+            nj::CorpusGenerator::get_sampling_name(m.spec->sampling), m.spec->quality, m.spec->restart_interval,
+            m.scan_bytes, m.depth, m.images_per_s, static_cast<unsigned long long>(m.ns.count), m.ns.mean(),
+            static_cast<unsigned long long>(m.ns.min), static_cast<unsigned long long>(m.ns.percentile(50)),
+            static_cast<unsigned long long>(m.ns.percentile(90)), static_cast<unsigned long long>(m.ns.percentile(99)),
+            static_cast<unsigned long long>(m.ns.max), (i + 1 < measurements.size()) ? "," : "");
+    }
+    std::fprintf(fp, "]}\n");
+
+    return std::ferror(fp) ? EIO : 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    auto backend    = nj::Decoder::Backend::Hardware;
+    auto iterations = 50, max_depth = 8;
+    const char *json_path = nullptr, *corpus_dir = nullptr;
+
+    for (int opt; (opt = getopt(argc, argv, "esn:d:j:o:")) != -1;) {
+        switch (opt) {
+#ifndef __SWITCH__
+            case 'e':
+                nj::NvDevice::set_ops(nj::NvEmulator::get_ops());
+                break;
+#endif
+            case 's':
+                backend = nj::Decoder::Backend::Software;
+                break;
+            case 'n':
+                iterations = std::max(std::atoi(optarg), 1);
+                break;
+            case 'd':
+                max_depth = std::max(std::atoi(optarg), 1);
+                break;
+            case 'j':
+                json_path = optarg;
+                break;
+            case 'o':
+                corpus_dir = optarg;
+                break;
+            default:
+                std::fprintf(stderr, "Usage: %s [-e] [-s] [-n iterations] [-d max depth] [-j results.json] "
+                    "[-o corpus dir]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    std::vector<CorpusImage> corpus;
+    for (auto &spec: nj::CorpusGenerator::get_default_specs()) {
+        auto &img = corpus.emplace_back(spec, std::make_shared<std::vector<std::uint8_t>>(
+            nj::CorpusGenerator::generate(spec)), nj::Image());
+        img.image = nj::Image(img.data);
+        if (auto rc = img.image.parse(); rc) {
+            std::fprintf(stderr, "Failed to parse generated image %s: %#x\n", spec.name().c_str(), rc);
+            return 1;
+        }
+
+        if (corpus_dir) {
+            auto path = std::string(corpus_dir) + "/" + spec.name() + ".jpg";
+            auto *fp = std::fopen(path.c_str(), "wb");
+            if (!fp || std::fwrite(img.data->data(), 1, img.data->size(), fp) != img.data->size()) {
+                std::perror(path.c_str());
+                return 1;
+            }
+            std::fclose(fp);
+        }
+    }
+
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(1, 0x500000, backend); rc) {
+        std::fprintf(stderr, "Failed to initialize decoder: %#x\n", rc);
+        return 1;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    auto *backend_name = (backend == nj::Decoder::Backend::Software) ? "software" : "hardware";
+    std::printf("%zu images, %s backend, %d iterations\n", corpus.size(), backend_name, iterations);
+    std::printf("%-20s %-28s %6s %10s %10s %10s\n", "benchmark", "image", "count", "mean (us)", "p50 (us)", "p99 (us)");
+
+    if (auto rc = nj::Tracer::enable(); rc) {
+        std::fprintf(stderr, "Failed to enable tracing: %#x\n", rc);
+        return 1;
+    }
+
+    for (auto &img: corpus) {
+        auto first = measurements.size();
+
+        nj::Surface surf(img.image.width, img.image.height);
+        if (auto rc = surf.allocate(); rc) {
+            std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+            return 1;
+        }
+
+        if (auto rc = bench_parse(img, 10 * iterations) || bench_render(decoder, img, surf, iterations); rc) {
+            std::fprintf(stderr, "Failed to benchmark %s\n", img.spec.name().c_str());
+            return 1;
+        }
+
+        std::for_each(measurements.begin() + first, measurements.end(), print_measurement);
+    }
+
+    nj::Tracer::disable();
+
+    // Scaling is measured on the reference image of the corpus, the first one at its default settings
+    auto &reference = *std::find_if(corpus.begin(), corpus.end(), [](auto &img) {
+        return img.spec.width == 1280 && img.spec.height == 720;
+    });
+
+    for (int depth = 1; depth <= max_depth; depth *= 2) {
+        if (auto rc = bench_depth(reference, backend, depth, 4 * iterations); rc) {
+            std::fprintf(stderr, "Failed to benchmark depth %d: %#x\n", depth, rc);
+            return 1;
+        }
+        print_measurement(measurements.back());
+    }
+
+    if (json_path) {
+        if (auto rc = save_json(json_path, backend_name, iterations); rc) {
+            std::fprintf(stderr, "Failed to write results to %s: %s\n", json_path, std::strerror(rc));
+            return 1;
+        }
+    }
+
+    return 0;
+}
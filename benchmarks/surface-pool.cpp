@@ -0,0 +1,158 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Measures the latency of getting a surface under churn: a window of live surfaces of random dimensions,
+// the oldest released and a new one acquired each iteration, as when decoding a stream of thumbnails and previews
+// Compares a SurfacePool (with a memory cap) to allocating and freeing each surface
+// Passing -e runs against the in-process driver emulator instead of the kernel
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Size {
+    std::size_t width, height;
+};
+
+struct Run {
+    std::vector<double> latencies;          // Acquire/allocate, in us
+    double total_us;                        // Whole loop, including the releases
+};
+
+double percentile(std::vector<double> &values, double p) {
+    std::sort(values.begin(), values.end());
+    return values[std::min(std::size_t(p * values.size()), values.size() - 1)];
+}
+
+template <typename F>
+bool churn(const std::vector<Size> &sizes, std::size_t window, F &&acquire, Run &run) {
+    using Handle = decltype(acquire(Size{}));
+
+    std::deque<Handle> live;
+    run.latencies.reserve(sizes.size());
+
+    auto loop_start = Clock::now();
+    for (auto &size: sizes) {
+        if (live.size() >= window)
+            live.pop_front();
+
+        auto start = Clock::now();
+        auto handle = acquire(size);
+        run.latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+
+        if (!handle)
+            return false;
+        live.push_back(std::move(handle));
+    }
+    live.clear();
+    run.total_us = std::chrono::duration<double, std::micro>(Clock::now() - loop_start).count();
+    return true;
+}
+
+void report(const char *name, Run &run) {
+    auto n = run.latencies.size();
+    std::printf("%-7s %8.2fus/iteration, acquire p50 %8.2fus, p99 %8.2fus, max %8.2fus\n", name,
+        run.total_us / n, percentile(run.latencies, 0.5), percentile(run.latencies, 0.99),
+        percentile(run.latencies, 1.0));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+#ifndef __SWITCH__
+    if (argc >= 2 && !std::strcmp(argv[1], "-e"))
+        nj::NvDevice::set_ops(nj::NvEmulator::get_ops()), first = 2;
+#endif
+
+    auto iterations = (argc >= first + 1) ? std::max(std::atoi(argv[first]),     1) : 2000;
+    auto window     = (argc >= first + 2) ? std::max(std::atoi(argv[first + 1]), 1) : 8;
+    auto max_size   = std::size_t(64) << 20;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    // Common thumbnail to 720p dimensions, each varied by up to 5% as after an aspect-preserving resize,
+    // with a fixed seed so both runs see the same sequence
+    constexpr Size common_sizes[] = {
+        { 96, 96 }, { 128, 128 }, { 160, 120 }, { 256, 256 }, { 320, 240 }, { 480, 270 },
+        { 640, 360 }, { 640, 480 }, { 800, 600 }, { 1024, 576 }, { 1280, 720 },
+    };
+
+    std::vector<Size> sizes(iterations);
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<std::size_t> size_dist(0, std::size(common_sizes) - 1);
+    std::uniform_real_distribution<double> jitter_dist(0.95, 1.0);
+    std::generate(sizes.begin(), sizes.end(), [&] {
+        auto &size = common_sizes[size_dist(rng)];
+        return Size{ std::size_t(size.width * jitter_dist(rng)), std::size_t(size.height * jitter_dist(rng)) };
+    });
+
+    std::printf("%d iterations, %d live surfaces, %zuMiB cap\n", iterations, window, max_size >> 20);
+
+    Run fresh;
+    auto fresh_ok = churn(sizes, window, [](Size size) {
+        auto surf = std::make_unique<nj::Surface>(size.width, size.height, nj::PixelFormat::RGBA);
+        errno = 0;
+        if (auto rc = surf->allocate(); rc) {
+            std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+            surf.reset();
+        }
+        return surf;
+    }, fresh);
+
+    nj::SurfacePool pool(max_size);
+    Run pooled;
+    auto pooled_ok = churn(sizes, window, [&pool](Size size) {
+        nj::SurfacePool::Ptr<nj::Surface> surf;
+        if (auto rc = pool.acquire(size.width, size.height, nj::PixelFormat::RGBA, surf); rc)
+            std::fprintf(stderr, "Failed to acquire surface: %#x\n", rc);
+        return surf;
+    }, pooled);
+
+    if (!fresh_ok || !pooled_ok)
+        return 1;
+
+    report("Fresh:",  fresh);
+    report("Pooled:", pooled);
+
+    auto stats = pool.get_stats();
+    std::printf("Pool: %lu acquires, %lu allocations (%.1f%% reused), %lu trimmed, %.1fMiB free\n",
+        stats.num_acquires, stats.num_allocations,
+        100.0 * (stats.num_acquires - stats.num_allocations) / stats.num_acquires, stats.num_trims,
+        stats.free_size / double(1 << 20));
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <tuple>
+#include <vector>
+#include <nvjpg.hpp>
+#include <nvjpg/sw/kernels.hpp>
+
+// Times every kernel of each implementation supported by the CPU, and checks its output against the scalar reference
+
+namespace {
+
+constexpr std::size_t num_blocks = 1024, row_width = 4096, num_rows = 64;
+
+constexpr std::uint32_t float_to_fixed(float f) {
+    return static_cast<int>(f * 65536.0f + (f < 0 ? -0.5f : 0.5f));
+}
+
+// BT.601 limited range, whose offset and gain exercise the saturation paths
+constexpr nj::SoftwareKernels::Yuv2RgbKernel kernel = {
+    float_to_fixed( 1.164f),
+    float_to_fixed( 1.596f), float_to_fixed(-0.391f),
+    float_to_fixed(-0.813f), float_to_fixed( 2.018f),
+    16u,
+};
+
+struct Inputs {
+    std::vector<std::int16_t>  coefs;
+    std::vector<std::uint16_t> quant;
+    std::vector<std::uint8_t>  y, cb, cr;
+};
+
+struct Outputs {
+    std::vector<std::uint8_t> idct, upsample, rgb, rgba;
+};
+
+Inputs make_inputs() {
+    std::mt19937 rng(0);
+    Inputs in;
+
+    // Mostly low-frequency coefficients, as found in natural images
+    in.coefs.resize(num_blocks * 64);
+    for (std::size_t i = 0; i < in.coefs.size(); ++i) {
+        auto k = i % 64, range = (k == 0) ? 1024 : 256 / (1 + k / 4);
+        in.coefs[i] = static_cast<std::int16_t>(std::uniform_int_distribution<>(-range, range)(rng));
+    }
+
+    in.quant.resize(64);
+    for (std::size_t i = 0; i < 64; ++i)
+        in.quant[i] = static_cast<std::uint16_t>(1 + i / 2);
+
+    for (auto *plane: { &in.y, &in.cb, &in.cr }) {
+        plane->resize(row_width * num_rows);
+        for (auto &s: *plane)
+            s = static_cast<std::uint8_t>(rng());
+    }
+
+    return in;
+}
+
+double time_us(int iterations, auto &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        fn();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+Outputs run(const nj::SoftwareKernels &k, const Inputs &in, int iterations) {
+    Outputs out;
+    out.idct.resize(num_blocks * 64);
+    out.upsample.resize(row_width * num_rows);
+    out.rgb.resize(row_width * num_rows * 3);
+    out.rgba.resize(row_width * num_rows * 4);
+
+    auto idct = time_us(iterations, [&] {
+        for (std::size_t i = 0; i < num_blocks; ++i)
+            k.idct_8x8(in.coefs.data() + i * 64, in.quant.data(), out.idct.data() + i * 64, 8);
+    });
+
+    auto upsample = time_us(iterations, [&] {
+        for (std::size_t i = 0; i < num_rows; ++i)
+            k.upsample_h2(in.cb.data() + i * row_width, out.upsample.data() + i * row_width, row_width);
+    });
+
+    auto convert = [&](std::vector<std::uint8_t> &dst, nj::PixelFormat fmt) {
+        auto layout = nj::get_pixel_layout(fmt);
+        return time_us(iterations, [&] {
+            for (std::size_t i = 0; i < num_rows; ++i)
+                k.yuv_to_rgb(in.y.data() + i * row_width, in.cb.data() + i * row_width, in.cr.data() + i * row_width,
+                    dst.data() + i * row_width * layout.bpp, row_width, kernel, layout, 0xff);
+        });
+    };
+
+    auto rgb = convert(out.rgb, nj::PixelFormat::RGB), rgba = convert(out.rgba, nj::PixelFormat::BGRA);
+
+    std::printf("%-8s: idct %7.2fns/block, upsample %6.3fns/px, yuv->rgb %6.3fns/px, yuv->bgra %6.3fns/px\n", k.name,
+        idct * 1e3 / num_blocks, upsample * 1e3 / (num_rows * row_width),
+        rgb * 1e3 / (num_rows * row_width), rgba * 1e3 / (num_rows * row_width));
+
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    auto iterations = (argc >= 2) ? std::max(std::atoi(argv[1]), 1) : 200;
+
+    auto inputs = make_inputs();
+
+    int rc = 0;
+    Outputs reference;
+    for (auto *kernels: nj::SoftwareKernels::get_all()) {
+        auto out = run(*kernels, inputs, iterations);
+
+        if (kernels == nj::SoftwareKernels::get_all().front()) {
+            reference = std::move(out);
+            continue;
+        }
+
+        for (auto &&[name, a, b]: { std::tuple("idct",      &out.idct,     &reference.idct),
+                                    std::tuple("upsample",  &out.upsample, &reference.upsample),
+                                    std::tuple("yuv->rgb",  &out.rgb,      &reference.rgb),
+                                    std::tuple("yuv->bgra", &out.rgba,     &reference.rgba) }) {
+            if (*a != *b) {
+                std::fprintf(stderr, "%s: %s output differs from the scalar reference\n", kernels->name, name);
+                rc = 1;
+            }
+        }
+    }
+
+    std::printf("Selected: %s\n", nj::SoftwareKernels::get().name);
+    return rc;
+}
@@ -0,0 +1,107 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <nvjpg.hpp>
+
+#ifndef __SWITCH__
+#   include <nvjpg/nv/emulator.hpp>
+#endif
+
+// Decodes the same image with the software backend on an increasing number of threads
+// Baseline images need restart markers (eg. cjpeg -restart 1) for rows to be decoded concurrently,
+// progressive ones only parallelize the IDCT and color conversion steps
+// Passing -e runs against the in-process driver emulator instead of the kernel
+
+static double run(const nj::Image &image, std::size_t num_threads, int iterations) {
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(1, 0x500000, nj::Decoder::Backend::Software); rc) {
+        std::fprintf(stderr, "Failed to initialize decoder: %#x\n", rc);
+        return -1;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    decoder.set_num_threads(num_threads);
+
+    nj::Surface surf(image.width, image.height, nj::PixelFormat::RGBA);
+    if (auto rc = surf.allocate(); rc) {
+        std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+        return -1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        if (auto rc = decoder.render(image, surf, 255); rc) {
+            std::fprintf(stderr, "Failed to render image: %#x\n", rc);
+            return -1;
+        }
+        decoder.wait(surf);
+    }
+    auto time = std::chrono::steady_clock::now() - start;
+
+    return std::chrono::duration<double, std::milli>(time).count() / iterations;
+}
+
+int main(int argc, char **argv) {
+    int first = 1;
+#ifndef __SWITCH__
+    if (argc >= 2 && !std::strcmp(argv[1], "-e"))
+        nj::NvDevice::set_ops(nj::NvEmulator::get_ops()), first = 2;
+#endif
+
+    if (argc < first + 1) {
+        std::fprintf(stderr, "Usage: %s [-e] jpg [iterations] [max threads]\n", argv[0]);
+        return 1;
+    }
+
+    auto iterations  = (argc >= first + 2) ? std::max(std::atoi(argv[first + 1]), 1) : 50;
+    auto max_threads = (argc >= first + 3) ? std::max(std::atoi(argv[first + 2]), 1) :
+        static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Image image(argv[first]);
+    if (!image.is_valid() || image.parse()) {
+        std::perror("Invalid file");
+        return 1;
+    }
+
+    std::printf("Image: %ux%u, %s, restart interval %u MCUs, %d iterations\n",
+        image.width, image.height, image.progressive ? "progressive" : "baseline", image.restart_interval, iterations);
+
+    double reference = 0;
+    for (int n = 1; n <= max_threads; ++n) {
+        auto ms = run(image, n, iterations);
+        if (ms < 0)
+            return 1;
+
+        reference = (n == 1) ? ms : reference;
+        std::printf("%2d thread(s): %8.3fms/image, %7.2f Mpix/s, x%.2f\n",
+            n, ms, image.width * image.height / ms / 1e3, reference / ms);
+    }
+
+    return 0;
+}
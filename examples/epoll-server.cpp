@@ -0,0 +1,208 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <nvjpg.hpp>
+#include <nvjpg/nv/emulator.hpp>
+
+// Single-threaded epoll server decoding images on request, with decoder completions delivered through
+// Decoder::get_completion_fd alongside the client socket
+// A client thread sends requests over a socket pair and waits for each reply. The request-to-reply latency is
+// compared to a loop blocking in Decoder::wait, which gives the cost of going through the event descriptor,
+// the completion thread and the socket round trip
+// Passing -e runs against the in-process driver emulator, -t sets its engine speed
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double mean_us(const std::vector<double> &latencies) {
+    double sum = 0;
+    for (auto l: latencies)
+        sum += l;
+    return latencies.empty() ? 0 : sum / latencies.size();
+}
+
+double percentile_us(std::vector<double> latencies, double p) {
+    if (latencies.empty())
+        return 0;
+    std::sort(latencies.begin(), latencies.end());
+    return latencies[std::min(static_cast<std::size_t>(p / 100.0 * latencies.size()), latencies.size() - 1)];
+}
+
+int run_blocking(nj::Decoder &decoder, const nj::Image &image, nj::Surface &surf, int num_requests,
+        std::vector<double> &latencies) {
+    for (int i = 0; i < num_requests; ++i) {
+        auto start = Clock::now();
+        NJ_TRY_RET(decoder.render(image, surf, 255));
+        NJ_TRY_RET(decoder.wait(surf));
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    return 0;
+}
+
+int run_reactor(nj::Decoder &decoder, const nj::Image &image, nj::Surface &surf, int num_requests,
+        std::vector<double> &latencies) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+        return errno;
+    NJ_SCOPEGUARD([&fds] { close(fds[0]); close(fds[1]); });
+
+    // Client: one request in flight at a time, timed from sending it to receiving the reply
+    auto client = std::thread([&, fd = fds[1]] {
+        for (int i = 0; i < num_requests; ++i) {
+            auto start = Clock::now();
+            std::uint32_t id = i, reply;
+            if (write(fd, &id, sizeof(id)) != sizeof(id) || read(fd, &reply, sizeof(reply)) != sizeof(reply))
+                return;
+            latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+        }
+        shutdown(fd, SHUT_WR);
+    });
+    // Shutting the socket down unblocks the client if the server bails out
+    NJ_SCOPEGUARD([&] { shutdown(fds[0], SHUT_RDWR); client.join(); });
+
+    NJ_TRY_RET(decoder.start_completion_thread());
+    NJ_SCOPEGUARD([&decoder] { decoder.stop_completion_thread(); });
+
+    auto epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        return errno;
+    NJ_SCOPEGUARD([epfd] { close(epfd); });
+
+    auto sock_fd = fds[0], completion_fd = decoder.get_completion_fd();
+    for (auto fd: { sock_fd, completion_fd }) {
+        epoll_event ev = { .events = EPOLLIN, .data = { .fd = fd } };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+            return errno;
+    }
+
+    // Request waiting on the render in flight
+    std::uint32_t pending_id = 0;
+    nj::Decoder::Handle pending_handle = 0;
+
+    while (true) {
+        epoll_event events[4];
+        auto num_events = epoll_wait(epfd, events, 4, -1);
+        if (num_events < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+
+        for (int i = 0; i < num_events; ++i) {
+            if (events[i].data.fd == completion_fd) {
+                std::uint64_t count;
+                [[maybe_unused]] auto rc = read(completion_fd, &count, sizeof(count));
+
+                nj::Decoder::Completion completion;
+                while (decoder.poll_completion(completion)) {
+                    if (completion.rc || completion.handle != pending_handle)
+                        return completion.rc ? completion.rc : EIO;
+
+                    if (write(sock_fd, &pending_id, sizeof(pending_id)) != sizeof(pending_id))
+                        return errno;
+                }
+                continue;
+            }
+
+            std::uint32_t id;
+            auto size = read(sock_fd, &id, sizeof(id));
+            if (size == 0)  // Client done
+                return 0;
+            if (size != sizeof(id))
+                return EIO;
+
+            pending_id = id;
+            NJ_TRY_RET(decoder.render(image, surf, 255, 0, &pending_handle));
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+        if (!std::strcmp(argv[first], "-e"))
+            nj::NvDevice::set_ops(nj::NvEmulator::get_ops());
+        else if (!std::strcmp(argv[first], "-t") && first + 1 < argc)
+            nj::NvEmulator::set_engine_throughput(std::atof(argv[++first]));
+    }
+
+    if (argc < first + 1) {
+        std::fprintf(stderr, "Usage: %s [-e] [-t mpix/s] jpg [requests]\n", argv[0]);
+        return 1;
+    }
+
+    auto num_requests = (argc >= first + 2) ? std::max(std::atoi(argv[first + 1]), 1) : 200;
+
+    if (auto rc = nj::initialize(); rc) {
+        std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
+        return 1;
+    }
+    NJ_SCOPEGUARD([] { nj::finalize(); });
+
+    nj::Image image(argv[first]);
+    if (!image.is_valid() || image.parse()) {
+        std::perror("Invalid file");
+        return 1;
+    }
+
+    nj::Decoder decoder;
+    if (auto rc = decoder.initialize(1, 0x500000, nj::Decoder::Backend::Hardware); rc) {
+        std::fprintf(stderr, "Failed to initialize decoder: %#x\n", rc);
+        return 1;
+    }
+    NJ_SCOPEGUARD([&decoder] { decoder.finalize(); });
+
+    nj::Surface surf(image.width, image.height, nj::PixelFormat::RGBA);
+    if (auto rc = surf.allocate(); rc) {
+        std::fprintf(stderr, "Failed to allocate surface: %#x\n", rc);
+        return 1;
+    }
+
+    std::vector<double> blocking, reactor;
+    if (auto rc = run_blocking(decoder, image, surf, num_requests, blocking); rc) {
+        std::fprintf(stderr, "Blocking loop failed: %s\n", std::strerror(rc));
+        return 1;
+    }
+
+    if (auto rc = run_reactor(decoder, image, surf, num_requests, reactor); rc || reactor.size() != blocking.size()) {
+        std::fprintf(stderr, "Server loop failed: %s\n", std::strerror(rc ? rc : EIO));
+        return 1;
+    }
+
+    std::printf("Image: %ux%u, %d requests\n", image.width, image.height, num_requests);
+    std::printf("Blocking wait:  mean %9.1fus, p50 %9.1fus, p99 %9.1fus\n",
+        mean_us(blocking), percentile_us(blocking, 50), percentile_us(blocking, 99));
+    std::printf("Epoll reactor:  mean %9.1fus, p50 %9.1fus, p99 %9.1fus\n",
+        mean_us(reactor), percentile_us(reactor, 50), percentile_us(reactor, 99));
+    std::printf("Added latency:  mean %9.1fus, p50 %9.1fus\n", mean_us(reactor) - mean_us(blocking),
+        percentile_us(reactor, 50) - percentile_us(blocking, 50));
+    return 0;
+}
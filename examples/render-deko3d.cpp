@@ -19,6 +19,7 @@
 // For more conventional use of textures within deko3d, see:
 //   https://github.com/switchbrew/switch-examples/tree/master/graphics/deko3d/deko_examples
 
+#include <cerrno>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
@@ -105,8 +106,10 @@ void deko_init() {
     }
 }
 
-void deko_gencmdlist(const nj::Surface &surf) {
+int deko_gencmdlist(const nj::Surface &surf) {
     std::tie(image_memblock, image) = surf.to_deko3d(device, DkImageFlags_HwCompression | DkImageFlags_Usage2DEngine);
+    if (!image_memblock)
+        return ENOMEM;
 
     DkImageRect rect = {
         0, 0, 0,
@@ -123,6 +126,8 @@ void deko_gencmdlist(const nj::Surface &surf) {
         cmdbuf.blitImage(dk::ImageView(image), rect, dk::ImageView(framebuffer_images[i]), rect, 0, 0);
         render_cmdlists[i] = cmdbuf.finishList();
     }
+
+    return 0;
 }
 
 void deko_render() {
@@ -187,7 +192,11 @@ int main(int argc, char **argv) {
         std::chrono::duration_cast<std::chrono::microseconds>(time).count(), read);
 
     deko_init();
-    deko_gencmdlist(surf);
+    if (auto rc = deko_gencmdlist(surf); rc) {
+        std::fprintf(stderr, "Surface too small for the texture layout\n");
+        deko_exit();
+        return 1;
+    }
 
     PadState pad;
     padConfigureInput(1, HidNpadStyleSet_NpadStandard);
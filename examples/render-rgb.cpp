@@ -76,10 +76,14 @@ static void display_image(const nj::Surface &surface) {
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        std::fprintf(stderr, "Usage: %s jpg\n", argv[0]);
+        std::fprintf(stderr, "Usage: %s jpg [trace.json]\n", argv[0]);
         return 1;
     }
 
+    // Record the stages of the decode, for chrome://tracing or ui.perfetto.dev
+    if (argc >= 3)
+        nj::Tracer::enable();
+
     if (auto rc = nj::initialize(); rc) {
         std::fprintf(stderr, "Failed to initialize library: %d: %s\n", rc, std::strerror(rc));
         return 1;
@@ -107,18 +111,23 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    std::printf("Surface pitch: %#lx, size %#lx\n", surf.pitch, surf.size());
+    std::printf("Surface pitch: %#lx, size %#lx (payload %#lx)\n", surf.pitch, surf.size(), surf.payload_size());
 
-    auto start = std::chrono::system_clock::now();
+    auto start = std::chrono::steady_clock::now();
     if (auto rc = decoder.render(image, surf, 255); rc)
         std::fprintf(stderr, "Failed to render image: %#x (%s)\n", rc, std::strerror(errno));
 
     std::size_t read = 0;
     decoder.wait(surf, &read);
-    auto time = std::chrono::system_clock::now() - start;
+    auto time = std::chrono::steady_clock::now() - start;
     std::printf("Rendered in %ldµs, read bytes: %lu\n",
         std::chrono::duration_cast<std::chrono::microseconds>(time).count(), read);
 
+    if (argc >= 3) {
+        if (auto rc = nj::Tracer::save(argv[2]); rc)
+            std::fprintf(stderr, "Failed to save trace: %s\n", std::strerror(rc));
+    }
+
     display_image(surf);
 
     return 0;
@@ -119,7 +119,8 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    std::printf("Surface luma pitch: %#lx, chroma pitch: %#lx, size %#lx\n", surf.luma_pitch, surf.chroma_pitch, surf.size());
+    std::printf("Surface luma pitch: %#lx, chroma pitch: %#lx, size %#lx (payload %#lx)\n", surf.luma_pitch, surf.chroma_pitch,
+        surf.size(), surf.payload_size());
 
     auto start = std::chrono::system_clock::now();
     if (auto rc = decoder.render(image, surf); rc)
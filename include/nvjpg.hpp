@@ -19,9 +19,21 @@
 
 #include <nvjpg/nv/ctrl.hpp>
 #include <nvjpg/nv/map.hpp>
+#include <nvjpg/nv/map_arena.hpp>
+#include <nvjpg/sw/decoder.hpp>
+#include <nvjpg/sw/transcoder.hpp>
+#include <nvjpg/atlas.hpp>
 #include <nvjpg/decoder.hpp>
 #include <nvjpg/image.hpp>
+#include <nvjpg/metrics.hpp>
+#include <nvjpg/queue.hpp>
+#include <nvjpg/scan_arena.hpp>
+#include <nvjpg/scheduler.hpp>
+#include <nvjpg/shared.hpp>
 #include <nvjpg/surface.hpp>
+#include <nvjpg/surface_pool.hpp>
+#include <nvjpg/surface_view.hpp>
+#include <nvjpg/trace.hpp>
 #include <nvjpg/utils.hpp>
 
 namespace nj {
@@ -0,0 +1,102 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <nvjpg/image.hpp>
+#include <nvjpg/surface.hpp>
+#include <nvjpg/utils.hpp>
+
+namespace nj {
+
+// Packs many renders into sub-rectangles of one surface, eg. the thumbnails of a grid, so that they share a single
+// allocation and GPU texture, and don't need to be copied to their final place
+// Each image gets a Surface bound to its rectangle, which is passed to Decoder::render like any other, and tracks
+// its own render. Rectangles are placed left to right on shelves, each as tall as the first image placed on it
+// The output offset is relocated with a 256-byte granularity, so rectangles start on a multiple of that in bytes
+// (64 pixels for 32-bit formats), and their height is padded to the tallest MCU
+// Not thread-safe, and the atlas must outlive its cells and can't be moved
+class SurfaceAtlas {
+    public:
+        struct Rect {
+            std::size_t x, y, width, height;    // In pixels
+            float u0, v0, u1, v1;               // Normalized texture coordinates of the image
+        };
+
+    public:
+        SurfaceAtlas(std::size_t width, std::size_t height, PixelFormat pixel_fmt = PixelFormat::RGBA):
+                surface(width, height, pixel_fmt) {
+            this->surface.pitch = Surface::compute_layout(width, height, pixel_fmt).pitches[0];
+        }
+
+        SurfaceAtlas(const SurfaceAtlas &) = delete;
+        SurfaceAtlas &operator =(const SurfaceAtlas &) = delete;
+
+        Result allocate() {
+            return this->surface.allocate();
+        }
+
+        // Reserves a rectangle for an output of the given dimensions, and binds cell to it
+        // This doesn't need the atlas to be allocated, so that it can be sized to its contents
+        // Fails with ENOSPC if none is left
+        Result add(std::size_t width, std::size_t height, Surface &cell, Rect &rect);
+
+        // Same, with the output dimensions of the image after downscaling
+        Result add(const Image &image, Surface &cell, Rect &rect, std::uint32_t downscale = 0) {
+            auto scale = std::size_t(1) << downscale;
+            return this->add((image.width + scale - 1) / scale, (image.height + scale - 1) / scale, cell, rect);
+        }
+
+        // Frees every rectangle, the renders to the cells must have completed
+        void clear() {
+            this->shelves.clear();
+            this->used_area = 0;
+        }
+
+        // The whole atlas, eg. to create a texture with Surface::to_deko3d
+        const Surface &get_surface() const {
+            return this->surface;
+        }
+
+        // Rows taken by the shelves
+        std::size_t get_used_height() const {
+            return this->shelves.empty() ? 0 : this->shelves.back().y + this->shelves.back().height;
+        }
+
+        // Pixels reserved by the rectangles, including their padding
+        std::size_t get_used_area() const {
+            return this->used_area;
+        }
+
+        // Horizontal granularity of the rectangles, in pixels
+        std::size_t get_column_align() const;
+
+    private:
+        struct Shelf {
+            std::size_t y, height, used_width;
+        };
+
+    private:
+        Surface surface;
+        std::vector<Shelf> shelves;
+        std::size_t used_area = 0;
+};
+
+} // namespace nj
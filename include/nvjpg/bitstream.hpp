@@ -20,19 +20,18 @@
 #include <cstdint>
 #include <concepts>
 #include <span>
-#include <vector>
 
 namespace nj {
 
 class Bitstream {
     public:
-        Bitstream(const std::vector<std::uint8_t> &data): data(data), cur(data.begin()) { }
+        Bitstream(std::span<const std::uint8_t> data): data(data), cur(data.data()) { }
 
         template <typename T>
         T get() {
-            if (this->cur + sizeof(T) >= this->data.end())
+            if (this->cur + sizeof(T) >= this->end())
                 return {};
-            auto tmp = *reinterpret_cast<const T *>(this->cur.base());
+            auto tmp = *reinterpret_cast<const T *>(this->cur);
             this->cur += sizeof(T);
             return tmp;
         }
@@ -59,11 +58,11 @@ class Bitstream {
         }
 
         bool empty() const {
-            return this->cur >= this->data.end();
+            return this->cur >= this->end();
         }
 
         std::size_t size() const {
-            return this->data.end() - this->cur;
+            return this->end() - this->cur;
         }
 
         auto current() const {
@@ -71,8 +70,13 @@ class Bitstream {
         }
 
     private:
-        const std::vector<std::uint8_t> &data;
-        std::vector<std::uint8_t>::const_iterator cur;
+        const std::uint8_t *end() const {
+            return this->data.data() + this->data.size();
+        }
+
+    private:
+        std::span<const std::uint8_t> data;
+        const std::uint8_t *cur;
 };
 
 } // namespace nj
@@ -18,13 +18,28 @@
 #pragma once
 
 #include <cstdint>
+#include <array>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include <nvjpg/nv/cmdbuf.hpp>
 #include <nvjpg/nv/channel.hpp>
 #include <nvjpg/nv/map.hpp>
+#include <nvjpg/nv/map_arena.hpp>
+#include <nvjpg/sw/decoder.hpp>
+#include <nvjpg/sw/transcoder.hpp>
 #include <nvjpg/image.hpp>
+#include <nvjpg/metrics.hpp>
+#include <nvjpg/scan_arena.hpp>
 #include <nvjpg/surface.hpp>
+#include <nvjpg/trace.hpp>
 
 #ifdef __SWITCH__
 #   include <switch.h>
@@ -34,10 +49,114 @@ namespace nj {
 
 class Decoder {
     public:
+        // Identifies a render, increasing in submission order
+        using Handle = std::uint64_t;
+
+        enum class CmdBufTemplate {
+            None,
+            Surface,
+            VideoSurface,
+        };
+
         struct RingEntry {
-            NvMap cmdbuf_map, pic_info_map, read_data_map, scan_data_map;
-            CmdBuf cmdbuf{cmdbuf_map};
+            NvMapRegion cmdbuf_region, pic_info_region, read_data_region;  // Carved out of the decoder map arena
+            ScanArena::Allocation scan_allocation = {};     // Scan data copied for the engine, unless read in place
+            CmdBuf cmdbuf{cmdbuf_region};
             nvhost_ctrl_fence fence{ 0, -1u };
+            NvjpgStatus sw_status = {};     // Takes the place of read_data_region with the software backend
+            Handle handle = 0;              // Last render submitted with this entry
+            std::uint64_t image_id = 0;     // Image of that render, and its submission time, for traces
+            std::uint64_t submit_ns = 0;
+            std::uint32_t scan_size = 0;    // Size of the scan given to the engine
+            bool unrecorded_status = false; // Status not yet accounted for in the metrics
+
+            // Kind of single render encoded in cmdbuf, which the next one to the same kind of surface reuses
+            // by retargeting the relocations of the scan data and output planes
+            CmdBufTemplate cmdbuf_template = CmdBufTemplate::None;
+            std::array<CmdBuf::RelocSlot, 4> template_slots = {};   // Scan data, output planes
+        };
+
+        struct Completion {
+            Handle             handle;
+            const SurfaceBase *surf;
+            Result             rc;          // Result of the wait on the render fence
+            NvjpgStatus        status;
+        };
+
+        using CompletionCallback = std::function<void(const Completion &)>;
+
+        // Schedules the resumption of a coroutine which awaited a render, called on the completion thread
+        using Executor = std::function<void(std::coroutine_handle<>)>;
+
+        // Operational statistics, accumulated since initialization or the last reset_metrics
+        // Durations are in nanoseconds, and only hardware renders are accounted for in submissions and statuses
+        struct Metrics {
+            std::uint64_t renders;                  // Renders submitted, including software ones
+            std::uint64_t submits;                  // Submission ioctls, a batch can hold several renders
+            std::uint64_t ring_stalls;              // Renders which had to wait for a ring entry to free up
+            std::uint64_t scan_arena_waits;         // Renders which had to wait for space in the scan arena
+            std::uint64_t scan_arena_grows;         // Times the scan arena moved to a larger buffer
+            std::uint64_t scan_bytes_copied;        // Scan data copied into the arena
+            std::uint64_t scan_bytes;               // Scan data given to the engine, and how much of it it consumed
+            std::uint64_t used_bytes;
+            std::uint32_t clock_rate;               // In Hz, sampled when the snapshot is taken
+
+            Histogram::Snapshot ring_stall_ns;
+            Histogram::Snapshot submit_ns;
+            Histogram::Snapshot fence_wait_ns;
+            Histogram::Snapshot unused_scan_bytes;  // Scan size minus the bytes the engine reports having read
+        };
+
+        struct RenderJob {
+            const Image   &image;
+            Surface       &surf;
+            std::uint8_t   alpha     = 0;
+            std::uint32_t  downscale = 0;
+            Handle        *handle    = nullptr;
+        };
+
+        struct VideoRenderJob {
+            const Image   &image;
+            VideoSurface  &surf;
+            std::uint32_t  downscale = 0;
+            Handle        *handle    = nullptr;
+        };
+
+        // Coroutine suspended until a render completes
+        struct Waiter {
+            std::coroutine_handle<> coro;
+            Completion              completion;
+        };
+
+        // Result of decode, co_await-ing it yields the Completion of the render
+        template <typename Job>
+        class RenderAwaitable {
+            public:
+                RenderAwaitable(Decoder &decoder, const Job &job): decoder(decoder), job(job) { }
+
+                bool await_ready() const {
+                    return false;
+                }
+
+                // The coroutine may be resumed on another thread before this returns
+                bool await_suspend(std::coroutine_handle<> coro) {
+                    return this->decoder.suspend_render(this->waiter, coro, this->job);
+                }
+
+                Completion await_resume() const {
+                    return this->waiter.completion;
+                }
+
+            private:
+                Decoder &decoder;
+                Job      job;
+                Waiter   waiter;
+        };
+
+        enum class Backend {
+            Auto,       // Hardware, falling back to software if the engine can't be opened
+            Hardware,
+            Software,
         };
 
         enum class ColorSpace {
@@ -48,33 +167,127 @@ class Decoder {
 
         constexpr static std::uint32_t class_id = 0xc0;
 
+        // Size of the command buffer of a ring entry
+        constexpr static std::uint32_t cmdbuf_size = 0x8000;
+
+        // Syncpoint id used in the fences of software renders, which complete synchronously
+        constexpr static std::uint32_t sw_syncpt_id = -1u;
+
     public:
         ColorSpace colorspace = ColorSpace::BT601Ex;
+        bool use_cmdbuf_templates = true;
+
+        // Resumes the coroutines awaiting decode, typically by posting them to an event loop
+        // Without one they run inline on the completion thread, which must then not wait for a ring entry,
+        // ie. a resumed coroutine should not submit more renders than were retired before suspending again
+        Executor resume_executor;
 
     public:
-        Result initialize(std::size_t num_ring_entries = 1, std::size_t capacity = 0x500000); // 5 Mib
+        // Fixed-point YUV to RGB conversion coefficients programmed for a colorspace
+        static const SoftwareDecoder::Kernel &get_yuv2rgb_kernel(ColorSpace colorspace);
+
+        ~Decoder();
+
+        // Scan data is copied into an arena shared by the ring entries, starting at capacity bytes and grown on demand
+        // If the engine can't be initialized, the channel is released before falling back to the software backend,
+        // or returning the error
+        Result initialize(std::size_t num_ring_entries = 1, std::size_t capacity = 0x100000, // 1 Mib
+            Backend backend = Backend::Auto);
         Result finalize();
 
+        // Starts a thread retiring renders in submission order, as soon as their fence is reached
+        // Completions are passed to the callback on that thread or, without one, queued for poll/wait_completion
+        // Ring entries are only reused once their previous render has been retired, so that its status is preserved
+        Result start_completion_thread(CompletionCallback callback = {});
+
+        // Waits for the renders in flight to be retired
+        Result stop_completion_thread();
+
+        // Pops the oldest queued completion, returns false if there is none
+        bool poll_completion(Completion &completion);
+
+        Result wait_completion(Completion &completion, std::int32_t timeout_us = -1);
+
+#ifndef __SWITCH__
+        // Event descriptor becoming readable once completions are queued, so that an epoll or poll loop can
+        // service them alongside its other I/O. Valid while the completion thread runs without a callback, -1 otherwise
+        // Reading it resets the count, the queued completions are then drained with poll_completion
+        int get_completion_fd() const {
+            return this->completion_fd;
+        }
+#endif
+
+        Backend get_backend() const {
+            return this->backend;
+        }
+
+        // Moves the scan arena to a buffer of the given size, the current one is released once its renders complete
         Result resize(std::size_t capacity);
 
+        // Threads used by the software backend, see SoftwareDecoder::set_num_threads
+        void set_num_threads(std::size_t num_threads) {
+            this->sw_decoder.set_num_threads(num_threads);
+        }
+
+        std::size_t get_num_threads() const {
+            return this->sw_decoder.get_num_threads();
+        }
+
+        // Current size of the scan arena
         std::size_t capacity() const {
-            if (this->entries.empty())
-                return 0;
-            return this->entries[0].scan_data_map.size();
+            return this->scan_arena.capacity();
         }
 
-        Result render(const Image &image, Surface      &surf, std::uint8_t alpha = 0, std::uint32_t downscale = 0);
-        Result render(const Image &image, VideoSurface &surf, std::uint32_t downscale = 0);
+        Result render(const Image &image, Surface      &surf, std::uint8_t alpha = 0, std::uint32_t downscale = 0,
+            Handle *handle = nullptr);
+        Result render(const Image &image, VideoSurface &surf, std::uint32_t downscale = 0, Handle *handle = nullptr);
+
+        // Renders several images with a single submission, each one getting its own fence
+        // Batches larger than the number of ring entries are split in several submissions
+        Result render(std::span<const RenderJob>      jobs);
+        Result render(std::span<const VideoRenderJob> jobs);
 
         Result wait(const SurfaceBase &surf, std::size_t *num_read_bytes = nullptr, std::int32_t timeout_us = -1);
 
+        // Awaitable render, which suspends the coroutine until the render fence is reached, and resumes it through
+        // resume_executor. Requires the completion thread, otherwise the render is waited on before co_await returns
+        // As with render, submitting blocks while all the ring entries are in flight
+        RenderAwaitable<RenderJob> decode(const Image &image, Surface &surf, std::uint8_t alpha = 0,
+                std::uint32_t downscale = 0) {
+            return { *this, RenderJob{ image, surf, alpha, downscale } };
+        }
+
+        RenderAwaitable<VideoRenderJob> decode(const Image &image, VideoSurface &surf, std::uint32_t downscale = 0) {
+            return { *this, VideoRenderJob{ image, surf, downscale } };
+        }
+
         Result wait(auto &&...surfs) requires requires (decltype(surfs) ...args) { (args.width, ...); } {
-            return (this->wait(surfs, nullptr, -1) | ...);
+            std::array<const SurfaceBase *, sizeof...(surfs)> list = { &surfs... };
+            return this->wait_all(list);
         }
 
+        // Checks the completion of the last render to a surface from the current syncpoint value, without blocking
+        bool is_done(const SurfaceBase &surf) const;
+
+        // Same as wait, but returns EAGAIN instead of blocking while the render is in flight
+        Result try_wait(const SurfaceBase &surf, std::size_t *num_read_bytes = nullptr);
+
+        // Renders complete in submission order, so these issue a single wait, on the highest threshold of the set
+        // for wait_all, and on the lowest one for wait_any, which returns the position of a completed render in index
+        Result wait_all(std::span<const SurfaceBase * const> surfs, std::int32_t timeout_us = -1);
+        Result wait_any(std::span<const SurfaceBase * const> surfs, std::size_t *index = nullptr,
+            std::int32_t timeout_us = -1);
+
+        // Can be called from any thread, concurrently with renders
+        Metrics get_metrics() const;
+        void reset_metrics();
+
         // In Hz
         std::uint32_t get_clock_rate() const {
             std::uint32_t rate = 0;
+            if (this->backend == Backend::Software)
+                return rate;
+
 #ifdef __SWITCH__
             std::uint32_t tmp = 0;
             if (auto rc = mmuRequestGet(&this->request, &tmp); R_SUCCEEDED(rc))
@@ -87,6 +300,9 @@ class Decoder {
 
         // In Hz
         Result set_clock_rate(std::uint32_t rate) const {
+            if (this->backend == Backend::Software)
+                return 0;
+
 #ifdef __SWITCH__
             return mmuRequestSetAndWait(&this->request, rate, -1u);
 #else
@@ -95,16 +311,104 @@ class Decoder {
         }
 
     private:
-        RingEntry &get_ring_entry() const;
+        struct PendingRender {
+            Handle             handle;
+            RingEntry         *entry;
+            const SurfaceBase *surf;
+            nvhost_ctrl_fence  fence;
+            Waiter            *waiter;
+        };
+
+        struct MetricCounters {
+            Counter renders, submits, ring_stalls, scan_bytes_copied, scan_bytes, used_bytes;
+            Histogram ring_stall_ns, submit_ns, fence_wait_ns, unused_scan_bytes;
+        };
+
+    private:
+        Result initialize_hardware(std::size_t capacity);
+        Result initialize_buffers(std::size_t capacity);
+
+        std::int32_t get_entry_index(const RingEntry &entry) const {
+            return static_cast<std::int32_t>(&entry - this->entries.data());
+        }
+
+        // Entry holding the last render to a surface, -1 if it has since been reused or the render was not ours
+        std::int32_t find_entry(const SurfaceBase &surf) const;
+
+        // Fills the number of bytes read by a completed render
+        void finish_wait(RingEntry &entry, std::size_t *num_read_bytes);
+
+        RingEntry &get_ring_entry();
+
+        // Buffer the engine reads the scan from, and offset of the scan in it
+        // The reloc only addresses 256-byte aligned locations, the remainder goes in the picture info
+        static std::tuple<const NvMap &, std::uint32_t> get_scan_buffer(const RingEntry &entry, const Image &image);
 
         NvjpgPictureInfo *build_picture_info_common(RingEntry &entry, const Image &image, std::uint32_t downscale);
 
-        Result render_common(RingEntry &entry, const Image &image, SurfaceBase &surf);
+        // Checks the render parameters, fills the picture info and copies the scan data to the arena
+        Result prepare_common(RingEntry &entry, const Image &image, SurfaceBase &surf);
+        Result prepare_render(RingEntry &entry, const Image &image, const RenderJob      &job);
+        Result prepare_render(RingEntry &entry, const Image &image, const VideoRenderJob &job);
+
+        // Appends the commands of a prepared render, followed by a syncpoint increment signaling its completion
+        // Returns the relocations depending on the job, for patch_render
+        using RenderSlots = std::array<CmdBuf::RelocSlot, 4>;
+        RenderSlots push_render(CmdBuf &cmdbuf, RingEntry &entry, const Image &image, const RenderJob      &job);
+        RenderSlots push_render(CmdBuf &cmdbuf, RingEntry &entry, const Image &image, const VideoRenderJob &job);
+
+        // Retargets the commands of a previous render of the same kind to a new job
+        void patch_render(CmdBuf &cmdbuf, const RenderSlots &slots, RingEntry &entry, const Image &image, const RenderJob      &job);
+        void patch_render(CmdBuf &cmdbuf, const RenderSlots &slots, RingEntry &entry, const Image &image, const VideoRenderJob &job);
+        void push_syncpt_incr(CmdBuf &cmdbuf) const;
+
+        // Submits a command buffer holding num_incrs syncpoint increments, fence receiving the last one
+        Result submit(CmdBuf &cmdbuf, std::uint32_t num_incrs, nvhost_ctrl_fence &fence);
+
+        template <typename Job>
+        Result render_batch(std::span<const Job> jobs);
+
+        Result complete_software(RingEntry &entry, SurfaceBase &surf, Handle *handle);
+
+        // Assigns a handle to a submitted render, and hands it to the completion thread if running
+        void track_render(RingEntry &entry, const SurfaceBase &surf, Handle *handle);
+
+        void completion_thread_main();
+
+        // Submits an awaited render, returns false if the coroutine should not be suspended,
+        // because the render failed or was completed synchronously
+        template <typename Job>
+        bool suspend_render(Waiter &waiter, std::coroutine_handle<> coro, const Job &job);
+
+        // Accounts for the status of a completed hardware render
+        void record_status(RingEntry &entry);
 
     private:
+        Backend backend = Backend::Hardware;
+        SoftwareDecoder sw_decoder;
+        ProgressiveTranscoder transcoder;
+        std::uint32_t sw_fence_value = 0;
+
         NvChannel channel;
         std::vector<RingEntry> entries;
         std::vector<RingEntry>::iterator next_entry;
+        NvMapArena map_arena;
+        ScanArena scan_arena;
+
+        std::thread completion_thread;
+        CompletionCallback completion_callback;
+        std::mutex completion_mutex;
+        std::condition_variable pending_cv, retired_cv, completed_cv;
+        std::deque<PendingRender> pending;
+        std::deque<Completion> completions;
+        Handle last_handle = 0, retired_handle = 0;
+        bool completion_stop = false;
+
+#ifndef __SWITCH__
+        int completion_fd = -1;
+#endif
+
+        MetricCounters metrics;
 
 #ifdef __SWITCH__
         MmuRequest request;
@@ -19,14 +19,17 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <algorithm>
 #include <memory>
 #include <span>
 #include <string_view>
 #include <vector>
 #include <fcntl.h>
 
+#include <nvjpg/nv/map.hpp>
 #include <nvjpg/bitstream.hpp>
 #include <nvjpg/surface.hpp>
+#include <nvjpg/utils.hpp>
 
 namespace nj {
 
@@ -80,10 +83,17 @@ class Image {
         bool           progressive           = false;
         std::uint8_t   num_components        = 0;     // 1 (grayscale) and 3 (YUV) supported
         std::uint8_t   sampling_precision    = 0;     // 8 and 12-bit precision supported
-        SamplingFormat sampling;
+        SamplingFormat sampling              = SamplingFormat::Monochrome;
         std::uint16_t  restart_interval      = 0;
         std::uint8_t   spectral_selection_lo = 0;
         std::uint8_t   spectral_selection_hi = 0;
+        std::uint8_t   successive_approx_hi  = 0;
+        std::uint8_t   successive_approx_lo  = 0;
+
+        // Components coded in the current scan, as indices in the components array
+        // Progressive scans can hold a subset of them
+        std::uint8_t   num_scan_components   = 0;
+        std::array<std::uint8_t, 3> scan_components = {};
 
         std::array<Component,         3> components   = {};
         std::array<QuantizationTable, 4> quant_tables = {};
@@ -94,10 +104,17 @@ class Image {
 
     public:
         Image() = default;
-        Image(std::shared_ptr<std::vector<std::uint8_t>> data): data(data) { }
+        Image(std::shared_ptr<std::vector<std::uint8_t>> data): storage(data),
+            data(data ? std::span(*data) : std::span<std::uint8_t>()) { }
+
+        // Image data held in a device-visible buffer, from which the engine reads scans in place
+        Image(std::shared_ptr<NvMap> map, std::size_t size): storage(map), map(map),
+            data(static_cast<std::uint8_t *>(map->address()), std::min(size, map->size())) { }
+
+        // Regular files are memory-mapped where supported, other descriptors are read into a buffer
         Image(int fd);
         Image(FILE *fp): Image(fileno(fp)) { }
-        Image(std::string_view path): Image(::open(path.data(), O_RDONLY)) { }
+        Image(std::string_view path);
 
         bool is_valid() const {
             return this->valid;
@@ -105,13 +122,36 @@ class Image {
 
         int parse();
 
+        // Skips the entropy-coded data of the current scan, and parses the segments up to the next one
+        // Tables defined in-between replace the current ones. Returns ENODATA once the end of the image is reached
+        int parse_next_scan();
+
         std::span<std::uint8_t> get_scan_data() const {
-            return std::span(this->data->begin() + this->scan_offset, this->data->size() - this->scan_offset);
+            return this->data.subspan(this->scan_offset);
+        }
+
+        // Offset of the current scan in the image data
+        std::uint32_t get_scan_offset() const {
+            return this->scan_offset;
+        }
+
+        // Device buffer backing the image data, if any
+        NvMap *get_map() const {
+            return this->map.get();
+        }
+
+        // Identifies the image in traces, assigned when parsed. Copies share it
+        std::uint64_t get_id() const {
+            return this->id;
         }
 
     private:
+        int load(int fd);
+
         JpegSegmentHeader find_next_segment(Bitstream &bs);
 
+        int parse_segments(Bitstream &bs);
+
         int parse_app(JpegSegmentHeader seg, Bitstream &bs);
         int parse_sof(JpegSegmentHeader seg, Bitstream &bs);
         int parse_dqt(JpegSegmentHeader seg, Bitstream &bs);
@@ -121,8 +161,26 @@ class Image {
 
     private:
         bool valid = true;
+        std::uint64_t id = 0;
         std::uint32_t scan_offset = 0;
-        std::shared_ptr<std::vector<std::uint8_t>> data;
+        std::shared_ptr<const void> storage;    // Owns the buffer or file mapping data points into
+        std::shared_ptr<NvMap> map;
+        std::span<std::uint8_t> data;
+};
+
+// Streams a file, pipe or socket into a device-visible buffer, so that renders don't copy the scan data
+// Regular files are read into a buffer of their exact size, other sources grow it as data comes in
+// Since the engine reads the buffer in place, the image must be kept alive until its renders complete
+class ImageReader {
+    public:
+        std::size_t initial_capacity = 0x100000;   // 1 Mib, for sources of unknown size
+
+    public:
+        Result read(int fd, Image &image) const;
+        Result read(std::string_view path, Image &image) const;
+
+    private:
+        static Result allocate(NvMap &map, std::size_t size);
 };
 
 } // namespace nj
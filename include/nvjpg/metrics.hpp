@@ -0,0 +1,110 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+namespace nj {
+
+// Monotonic event or byte count, updated without locking
+class Counter {
+    public:
+        void add(std::uint64_t n = 1) {
+            this->value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        std::uint64_t get() const {
+            return this->value.load(std::memory_order_relaxed);
+        }
+
+        void reset() {
+            this->value.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic_uint64_t value = 0;
+};
+
+// Log-linear histogram in the manner of HdrHistogram: every power of two is split in 2^sub_bucket_bits buckets,
+// so that values are kept within ~3% over the whole 64-bit range, in constant memory
+// Recording is lock-free, snapshots taken concurrently with it may be off by the values being recorded
+class Histogram {
+    public:
+        constexpr static unsigned    sub_bucket_bits = 5;
+        constexpr static std::size_t num_sub_buckets = std::size_t(1) << sub_bucket_bits;
+        constexpr static std::size_t num_buckets     = (64 - sub_bucket_bits + 1) * num_sub_buckets;
+
+        struct Snapshot {
+            std::array<std::uint64_t, num_buckets> counts = {};
+            std::uint64_t count = 0, sum = 0;
+            std::uint64_t min = 0, max = 0;
+
+            double mean() const {
+                return this->count ? double(this->sum) / this->count : 0;
+            }
+
+            // Highest value equivalent to the one at the given percentile (0-100), 0 if nothing was recorded
+            std::uint64_t percentile(double p) const;
+        };
+
+    public:
+        static std::size_t get_bucket(std::uint64_t value) {
+            if (value < num_sub_buckets)
+                return value;
+
+            auto exp = 63u - __builtin_clzll(value);
+            auto sub = (value >> (exp - sub_bucket_bits)) - num_sub_buckets;
+            return (exp - sub_bucket_bits + 1) * num_sub_buckets + sub;
+        }
+
+        // Smallest and largest values falling in a bucket
+        static std::uint64_t get_bucket_lower(std::size_t bucket);
+        static std::uint64_t get_bucket_upper(std::size_t bucket);
+
+        void record(std::uint64_t value);
+
+        Snapshot snapshot() const;
+        void reset();
+
+    private:
+        std::array<std::atomic_uint64_t, num_buckets> counts = {};
+        std::atomic_uint64_t count = 0, sum = 0;
+        std::atomic_uint64_t min = std::numeric_limits<std::uint64_t>::max(), max = 0;
+};
+
+// Records the time spent in a scope, in nanoseconds
+class ScopedTimer {
+    public:
+        ScopedTimer(Histogram &histogram): histogram(histogram), start(std::chrono::steady_clock::now()) { }
+
+        ~ScopedTimer() {
+            this->histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - this->start).count());
+        }
+
+    private:
+        Histogram &histogram;
+        std::chrono::steady_clock::time_point start;
+};
+
+} // namespace nj
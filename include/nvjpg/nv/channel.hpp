@@ -28,6 +28,7 @@
 #   include <unistd.h>
 #endif
 
+#include <nvjpg/nv/device.hpp>
 #include <nvjpg/nv/ioctl_types.h>
 #include <nvjpg/utils.hpp>
 
@@ -52,7 +53,7 @@ class NvChannel {
             NJ_TRY_RET(nvioctlChannel_GetSyncpt(this->channel.fd, 0, &this->syncpt));
             return 0;
 #else
-            this->fd = ::open(path, O_RDWR | O_CLOEXEC);
+            this->fd = NvDevice::open(path, O_RDWR | O_CLOEXEC);
             if (this->fd < 0)
                 return this->fd;
 
@@ -61,7 +62,7 @@ class NvChannel {
                 .value = -1u,
             };
 
-            auto rc = ::ioctl(this->fd, NVHOST_IOCTL_CHANNEL_GET_SYNCPOINT, &args);
+            auto rc = NvDevice::ioctl(this->fd, NVHOST_IOCTL_CHANNEL_GET_SYNCPOINT, &args);
             if (!rc)
                 this->syncpt = args.value;
 
@@ -74,7 +75,7 @@ class NvChannel {
             nvChannelClose(&this->channel);
             return 0;
 #else
-            auto rc = ::close(this->fd);
+            auto rc = NvDevice::close(this->fd);
             if (rc != -1)
                 this->fd = -1;
             return rc;
@@ -90,7 +91,7 @@ class NvChannel {
                 .moduleid = id,
             };
 
-            auto rc = ::ioctl(this->fd, NVHOST_IOCTL_CHANNEL_GET_CLK_RATE, &args);
+            auto rc = NvDevice::ioctl(this->fd, NVHOST_IOCTL_CHANNEL_GET_CLK_RATE, &args);
             if (!rc)
                 rate = args.rate;
 
@@ -107,7 +108,7 @@ class NvChannel {
                 .moduleid = id,
             };
 
-            return ::ioctl(this->fd, NVHOST_IOCTL_CHANNEL_SET_CLK_RATE, &args);
+            return NvDevice::ioctl(this->fd, NVHOST_IOCTL_CHANNEL_SET_CLK_RATE, &args);
 #endif
         }
 
@@ -147,7 +148,7 @@ class NvChannel {
                 .fences                  = reinterpret_cast<uintptr_t>(fences.data()),
             };
 
-            auto rc = ::ioctl(this->fd, NVHOST_IOCTL_CHANNEL_SUBMIT, &args);
+            auto rc = NvDevice::ioctl(this->fd, NVHOST_IOCTL_CHANNEL_SUBMIT, &args);
             if (!rc)
                 fence.value = args.fence;
 
@@ -173,7 +174,7 @@ class NvChannel {
 #ifdef __SWITCH__
         ::NvChannel   channel = {};
 #else
-        int           fd      = 0;
+        int           fd      = -1;
 #endif
 };
 
@@ -18,10 +18,12 @@
 #pragma once
 
 #include <cstdint>
+#include <array>
+#include <span>
 #include <tuple>
-#include <vector>
 
 #include <nvjpg/nv/map.hpp>
+#include <nvjpg/nv/map_arena.hpp>
 #include <nvjpg/nv/ioctl_types.h>
 #include <nvjpg/nv/registers.hpp>
 
@@ -65,19 +67,73 @@ struct OpcodeImm: public Host1xOpcode {
     }
 };
 
+// Vector-like container with inline storage, so filling it never touches the heap
+template <typename T, std::size_t N>
+class InlineVector {
+    public:
+        static constexpr std::size_t capacity() {
+            return N;
+        }
+
+        std::size_t size() const {
+            return this->count;
+        }
+
+        void push_back(const T &val) {
+            this->storage[this->count++] = val;
+        }
+
+        void clear() {
+            this->count = 0;
+        }
+
+        T &operator [](std::size_t i) {
+            return this->storage[i];
+        }
+
+        T &back() {
+            return this->storage[this->count - 1];
+        }
+
+        std::span<T> span() {
+            return std::span(this->storage.data(), this->count);
+        }
+
+        std::span<const T> span() const {
+            return std::span(this->storage.data(), this->count);
+        }
+
+    private:
+        std::array<T, N> storage = {};
+        std::size_t count = 0;
+};
+
 class CmdBuf {
     public:
         using Word = std::uint32_t;
 
+        // Capacity of the submission metadata. Callers are responsible for not exceeding it,
+        // a render uses one buffer and at most six relocations
+        constexpr static std::size_t max_bufs   = 0x40;
+        constexpr static std::size_t max_relocs = 6 * max_bufs;
+
+        // Location of a relocated value, which can later be retargeted without encoding the stream again
+        struct RelocSlot {
+            std::size_t word  = 0;
+            std::size_t reloc = 0;
+        };
+
     public:
-        CmdBuf(const NvMap &map): map(map), cur_word(static_cast<Word *>(map.address())) { }
+        // The words are written to the region, which may be assigned after construction, before the first clear
+        CmdBuf(const NvMapRegion &region): region(region), cur_word(static_cast<Word *>(region.address())) { }
 
         std::size_t size() const {
-            return static_cast<std::size_t>(this->cur_word - static_cast<Word *>(this->map.address()));
+            return static_cast<std::size_t>(this->cur_word - static_cast<Word *>(this->region.address()));
         }
 
         void begin(std::uint32_t class_id, std::int32_t pre_fence = -1) {
-            this->bufs.push_back({ this->map.handle(), static_cast<std::uint32_t>(this->size() * sizeof(Word)), 0 });
+            this->bufs.push_back({ this->region.handle(),
+                static_cast<std::uint32_t>(this->region.offset + this->size() * sizeof(Word)), 0 });
 
             this->cur_buf_begin = this->size();
 
@@ -92,7 +148,7 @@ class CmdBuf {
         }
 
         void clear() {
-            this->cur_word = static_cast<Word *>(this->map.address());
+            this->cur_word = static_cast<Word *>(this->region.address());
             this->bufs  .clear();
 #ifndef __SWITCH__
             this->exts  .clear(), this->class_ids.clear();
@@ -112,54 +168,66 @@ class CmdBuf {
             this->push_raw(value);
         }
 
-        void push_reloc(std::uint32_t offset, const NvMap &target, std::uint32_t target_offset = 0,
+        RelocSlot push_reloc(std::uint32_t offset, const NvMap &target, std::uint32_t target_offset = 0,
                 std::uint32_t shift = 8, std::uint32_t type = NVHOST_RELOC_TYPE_DEFAULT) {
 #ifdef __SWITCH__
             // On the Switch, resolve relocations on the client side
             this->push_value(offset, (target.iova() + target_offset) >> shift);
+            return { this->size() - 1, 0 };
 #else
             this->push_value(offset, 0xdeadbeef); // Officially used placeholder value
 
             this->relocs.push_back({
-                .cmdbuf_mem    = this->map.handle(),
-                .cmdbuf_offset = static_cast<std::uint32_t>((this->size() - 1) * sizeof(Word)),
+                .cmdbuf_mem    = this->region.handle(),
+                .cmdbuf_offset = static_cast<std::uint32_t>(this->region.offset + (this->size() - 1) * sizeof(Word)),
                 .target_mem    = target.handle(),
                 .target_offset = target_offset,
             });
             this->shifts.push_back({ shift });
             this->types.push_back({ type, 0 });
+            return { this->size() - 1, this->relocs.size() - 1 };
+#endif
+        }
+
+        void patch_reloc(RelocSlot slot, const NvMap &target, std::uint32_t target_offset = 0, std::uint32_t shift = 8) {
+#ifdef __SWITCH__
+            static_cast<Word *>(this->region.address())[slot.word] = (target.iova() + target_offset) >> shift;
+#else
+            this->relocs[slot.reloc].target_mem    = target.handle();
+            this->relocs[slot.reloc].target_offset = target_offset;
+            this->shifts[slot.reloc].shift         = shift;
 #endif
         }
 
 #ifdef __SWITCH__
-        auto &get_bufs() {
-            return this->bufs;
+        auto get_bufs() {
+            return this->bufs.span();
         }
 #else
-        auto get_bufs() const {
-            return std::make_tuple(this->bufs, this->exts, this->class_ids);
+        auto get_bufs() {
+            return std::make_tuple(this->bufs.span(), this->exts.span(), this->class_ids.span());
         }
 
-        auto get_relocs() const {
-            return std::make_tuple(this->relocs, this->shifts, this->types);
+        auto get_relocs() {
+            return std::make_tuple(this->relocs.span(), this->shifts.span(), this->types.span());
         }
 #endif
 
     private:
-        const NvMap &map;
+        const NvMapRegion &region;
         Word *cur_word;
 
         std::size_t cur_buf_begin = 0;
 
-        std::vector<nvhost_cmdbuf>      bufs;
+        InlineVector<nvhost_cmdbuf,      max_bufs>   bufs;
 
 #ifndef __SWITCH__
-        std::vector<nvhost_cmdbuf_ext>  exts;
-        std::vector<std::uint32_t>      class_ids;
+        InlineVector<nvhost_cmdbuf_ext,  max_bufs>   exts;
+        InlineVector<std::uint32_t,      max_bufs>   class_ids;
 
-        std::vector<nvhost_reloc>       relocs;
-        std::vector<nvhost_reloc_shift> shifts;
-        std::vector<nvhost_reloc_type>  types;
+        InlineVector<nvhost_reloc,       max_relocs> relocs;
+        InlineVector<nvhost_reloc_shift, max_relocs> shifts;
+        InlineVector<nvhost_reloc_type,  max_relocs> types;
 #endif
 };
 
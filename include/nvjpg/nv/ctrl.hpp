@@ -29,6 +29,7 @@
 #   include <unistd.h>
 #endif
 
+#include <nvjpg/nv/device.hpp>
 #include <nvjpg/nv/ioctl_types.h>
 #include <nvjpg/utils.hpp>
 
@@ -40,7 +41,7 @@ class NvHostCtrl {
 #ifdef __SWITCH__
             return nvFenceInit();
 #else
-            return NvHostCtrl::nvhostctrl_fd = ::open("/dev/nvhost-ctrl", O_RDWR | O_SYNC | O_CLOEXEC);
+            return NvHostCtrl::nvhostctrl_fd = NvDevice::open("/dev/nvhost-ctrl", O_RDWR | O_SYNC | O_CLOEXEC);
 #endif
         }
 
@@ -49,14 +50,24 @@ class NvHostCtrl {
             nvFenceExit();
             return 0;
 #else
-            return ::close(NvHostCtrl::nvhostctrl_fd);
+            return NvDevice::close(NvHostCtrl::nvhostctrl_fd);
 #endif
         }
 
+        // Syncpoint values wrap around, a threshold is reached if it lies less than half the range behind
+        static bool is_reached(std::uint32_t value, std::uint32_t thresh) {
+            return static_cast<std::int32_t>(value - thresh) >= 0;
+        }
+
 #ifdef __SWITCH__
         static Result wait(NvFence fence, std::int32_t timeout) {
             return nvFenceWait(&fence, timeout);
         }
+
+        // Checks whether the fence was reached without blocking
+        static bool poll(NvFence fence) {
+            return R_SUCCEEDED(nvFenceWait(&fence, 0));
+        }
 #else
         static Result wait(nvhost_ctrl_fence fence, std::int32_t timeout) {
             nvhost_ctrl_syncpt_waitex_args args = {
@@ -66,7 +77,26 @@ class NvHostCtrl {
                 .value   = 0,
             };
 
-            return ::ioctl(NvHostCtrl::nvhostctrl_fd, NVHOST_IOCTL_CTRL_SYNCPT_WAITEX, &args);
+            return NvDevice::ioctl(NvHostCtrl::nvhostctrl_fd, NVHOST_IOCTL_CTRL_SYNCPT_WAITEX, &args);
+        }
+
+        static Result read(std::uint32_t id, std::uint32_t &value) {
+            nvhost_ctrl_syncpt_read_args args = {
+                .id    = id,
+                .value = 0,
+            };
+
+            auto rc = NvDevice::ioctl(NvHostCtrl::nvhostctrl_fd, NVHOST_IOCTL_CTRL_SYNCPT_READ, &args);
+            value = args.value;
+            return rc;
+        }
+
+        // Checks whether the fence was reached without blocking, from the current syncpoint value
+        static bool poll(nvhost_ctrl_fence fence) {
+            std::uint32_t value;
+            if (NvHostCtrl::read(fence.id, value))
+                return false;
+            return NvHostCtrl::is_reached(value, fence.value);
         }
 #endif
 
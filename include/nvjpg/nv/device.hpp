@@ -0,0 +1,94 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#ifndef __SWITCH__
+
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace nj {
+
+// Entry points of the nvmap/nvhost drivers
+struct NvDeviceOps {
+    int   (*open)  (const char *path, int flags);
+    int   (*close) (int fd);
+    int   (*ioctl) (int fd, unsigned long request, void *arg);
+    void *(*mmap)  (void *addr, std::size_t len, int prot, int flags, int fd, off_t offset);
+    int   (*munmap)(void *addr, std::size_t len);
+};
+
+// Routes the driver calls of NvMap, NvHostCtrl and NvChannel, by default to the kernel
+// Another backend, like the in-process emulator, can be selected before the library is initialized
+class NvDevice {
+    public:
+        static const NvDeviceOps &get_kernel_ops() {
+            return NvDevice::kernel_ops;
+        }
+
+        static void set_ops(const NvDeviceOps &ops) {
+            NvDevice::ops = &ops;
+        }
+
+        static const NvDeviceOps &get_ops() {
+            return *NvDevice::ops;
+        }
+
+        static int open(const char *path, int flags) {
+            return NvDevice::ops->open(path, flags);
+        }
+
+        static int close(int fd) {
+            return NvDevice::ops->close(fd);
+        }
+
+        static int ioctl(int fd, unsigned long request, void *arg) {
+            return NvDevice::ops->ioctl(fd, request, arg);
+        }
+
+        static void *mmap(void *addr, std::size_t len, int prot, int flags, int fd, off_t offset) {
+            return NvDevice::ops->mmap(addr, len, prot, flags, fd, offset);
+        }
+
+        static int munmap(void *addr, std::size_t len) {
+            return NvDevice::ops->munmap(addr, len);
+        }
+
+    private:
+        constexpr static NvDeviceOps kernel_ops = {
+            .open   = [](const char *path, int flags) { return ::open(path, flags); },
+            .close  = [](int fd) { return ::close(fd); },
+            .ioctl  = [](int fd, unsigned long request, void *arg) { return ::ioctl(fd, request, arg); },
+            .mmap   = [](void *addr, std::size_t len, int prot, int flags, int fd, off_t offset) {
+                return ::mmap(addr, len, prot, flags, fd, offset);
+            },
+            .munmap = [](void *addr, std::size_t len) { return ::munmap(addr, len); },
+        };
+
+        static inline const NvDeviceOps *ops = &NvDevice::kernel_ops;
+};
+
+} // namespace nj
+
+#endif // __SWITCH__
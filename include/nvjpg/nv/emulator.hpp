@@ -0,0 +1,55 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#ifndef __SWITCH__
+
+#include <nvjpg/nv/device.hpp>
+
+namespace nj {
+
+// In-process stand-in for the nvmap, nvhost-ctrl and nvhost-nvjpg drivers, for profiling the host side
+// of the library on machines without the engine. Select it before initializing the library:
+//     nj::NvDevice::set_ops(nj::NvEmulator::get_ops());
+// Buffers live in host memory. Submissions get their relocations patched and are executed in order by a thread
+// playing the engine, which decodes pictures with the software decoder and increments syncpoints as the
+// command stream asks. Fences, waits and clock rates behave like on the kernel drivers
+class NvEmulator {
+    public:
+        // Use of the nvmap driver, to account for the handles and calls made by the library
+        struct Stats {
+            std::size_t   num_handles;          // Handles currently allocated, and the most at once
+            std::size_t   max_handles;
+            std::uint64_t num_nvmap_ioctls;     // Create, import, alloc, free and cache calls
+            std::uint64_t num_mmaps;
+        };
+
+    public:
+        static const NvDeviceOps &get_ops();
+
+        // Models the speed of the engine by holding back the completion of renders, in megapixels per second
+        // 0 completes them as soon as they are decoded
+        static void set_engine_throughput(double mpix_per_s);
+
+        static Stats get_stats();
+};
+
+} // namespace nj
+
+#endif // __SWITCH__
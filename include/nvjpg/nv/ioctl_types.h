@@ -56,11 +56,20 @@ typedef struct {
     int32_t  op;
 } nvmap_cache_args;
 
+typedef struct {
+    uint64_t va;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t handle;
+    uint32_t pad;
+} nvmap_create_from_va_args;
+
 #define NVMAP_IOCTL_MAGIC 'N'
 #define NVMAP_IOCTL_CREATE   _IOWR(NVMAP_IOCTL_MAGIC, 0,  nvmap_create_args)
 #define NVMAP_IOCTL_ALLOC    _IOW (NVMAP_IOCTL_MAGIC, 3,  nvmap_alloc_args)
 #define NVMAP_IOCTL_FREE     _IO  (NVMAP_IOCTL_MAGIC, 4)
 #define NVMAP_IOCTL_CACHE    _IOW (NVMAP_IOCTL_MAGIC, 12, nvmap_cache_args)
+#define NVMAP_IOCTL_FROM_VA  _IOWR(NVMAP_IOCTL_MAGIC, 22, nvmap_create_from_va_args)
 
 typedef struct {
     uint32_t id;
@@ -74,7 +83,13 @@ typedef struct {
     uint32_t value;
 } nvhost_ctrl_syncpt_waitex_args;
 
+typedef struct {
+    uint32_t id;
+    uint32_t value;
+} nvhost_ctrl_syncpt_read_args;
+
 #define NVHOST_IOCTL_MAGIC 'H'
+#define NVHOST_IOCTL_CTRL_SYNCPT_READ   _IOWR(NVHOST_IOCTL_MAGIC, 1, nvhost_ctrl_syncpt_read_args)
 #define NVHOST_IOCTL_CTRL_SYNCPT_WAITEX _IOWR(NVHOST_IOCTL_MAGIC, 6, nvhost_ctrl_syncpt_waitex_args)
 
 typedef struct {
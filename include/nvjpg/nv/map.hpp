@@ -30,6 +30,7 @@
 #   include <unistd.h>
 #endif
 
+#include <nvjpg/nv/device.hpp>
 #include <nvjpg/nv/ioctl_types.h>
 #include <nvjpg/utils.hpp>
 
@@ -41,7 +42,7 @@ class NvMap {
 #ifdef __SWITCH__
             return nvMapInit();
 #else
-            return NvMap::nvmap_fd = ::open("/dev/nvmap", O_RDWR | O_SYNC | O_CLOEXEC);
+            return NvMap::nvmap_fd = NvDevice::open("/dev/nvmap", O_RDWR | O_SYNC | O_CLOEXEC);
 #endif
         }
 
@@ -50,7 +51,7 @@ class NvMap {
             nvMapExit();
             return 0;
 #else
-            return ::close(NvMap::nvmap_fd);
+            return NvDevice::close(NvMap::nvmap_fd);
 #endif
         }
 
@@ -88,7 +89,7 @@ class NvMap {
                 .handle = 0,
             };
 
-            auto rc = ::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_CREATE, &create);
+            auto rc = NvDevice::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_CREATE, &create);
             if (rc)
                 return rc;
 
@@ -102,22 +103,52 @@ class NvMap {
                 .align     = align,
             };
 
-            return ::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_ALLOC, &alloc);
+            return NvDevice::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_ALLOC, &alloc);
 #endif
         }
 
+        // Creates a handle over memory owned by the caller, which must outlive it
+        // The address and size must be page-aligned
+        Result import(void *address, std::uint32_t size) {
+            if (!is_aligned(reinterpret_cast<std::uintptr_t>(address), std::uintptr_t(0x1000)) ||
+                    !is_aligned(size, 0x1000u))
+                return EINVAL;
+
+#ifdef __SWITCH__
+            NJ_TRY_RET(nvMapCreate(&this->nvmap, address, size, 0x1000, NvKind_Pitch, false));
+#else
+            nvmap_create_from_va_args args = {
+                .va     = reinterpret_cast<std::uintptr_t>(address),
+                .size   = size,
+                .flags  = 0,
+                .handle = 0,
+                .pad    = 0,
+            };
+
+            NJ_TRY_RET(NvDevice::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_FROM_VA, &args));
+
+            this->sz   = size;
+            this->hdl  = args.handle;
+            this->addr = address;
+#endif
+            this->imported = true;
+            return 0;
+        }
+
         Result free() {
             if (this->addr)
                 NJ_TRY_RET(this->unmap());
 
 #ifdef __SWITCH__
-            delete[] static_cast<std::uint8_t *>(this->nvmap.cpu_addr);
+            if (!this->imported)
+                delete[] static_cast<std::uint8_t *>(this->nvmap.cpu_addr);
             nvMapClose(&this->nvmap);
+            this->nvmap = {}, this->imported = false;
             return 0;
 #else
-            auto rc = ::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_FREE, this->hdl);
+            auto rc = NvDevice::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_FREE, reinterpret_cast<void *>(std::uintptr_t(this->hdl)));
             if (!rc)
-                this->hdl = 0;
+                this->hdl = 0, this->imported = false;
 
             return rc;
 #endif
@@ -132,7 +163,7 @@ class NvMap {
         }
 #else
         void *map(int prot = PROT_READ | PROT_WRITE, int flags = MAP_SHARED) {
-            return this->addr = ::mmap(nullptr, this->sz, prot, flags, this->hdl, 0);
+            return this->addr = NvDevice::mmap(nullptr, this->sz, prot, flags, this->hdl, 0);
         }
 #endif
 
@@ -143,7 +174,13 @@ class NvMap {
             this->addr = 0;
             return 0;
 #else
-            auto rc = ::munmap(this->addr, sz);
+            // Imported memory stays mapped by its owner
+            if (this->imported) {
+                this->addr = nullptr;
+                return 0;
+            }
+
+            auto rc = NvDevice::munmap(this->addr, sz);
             if (!rc)
                 this->addr = nullptr;
 
@@ -162,7 +199,7 @@ class NvMap {
                 .op     = op,
             };
 
-            return ::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_CACHE, &args);
+            return NvDevice::ioctl(NvMap::nvmap_fd, NVMAP_IOCTL_CACHE, &args);
 #endif
         }
 
@@ -210,10 +247,12 @@ class NvMap {
         std::uint32_t addr       = 0;
         std::uint32_t owner      = 0;
         bool          compressed = false;
+        bool          imported   = false;
 #else
         std::uint32_t sz         = 0;
         std::uint32_t hdl        = 0;
         void         *addr       = nullptr;
+        bool          imported   = false;
 
         static inline int nvmap_fd;
 #endif
@@ -0,0 +1,79 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <nvjpg/nv/map.hpp>
+#include <nvjpg/utils.hpp>
+
+namespace nj {
+
+// Range of an NvMap, addressed by the engine through the handle of the map and the offset
+struct NvMapRegion {
+    const NvMap  *map    = nullptr;
+    std::uint32_t offset = 0;
+    std::uint32_t size   = 0;
+
+    void *address() const {
+        return this->map ? static_cast<std::uint8_t *>(this->map->address()) + this->offset : nullptr;
+    }
+
+    std::uint32_t handle() const {
+        return this->map ? this->map->handle() : 0;
+    }
+};
+
+// Carves small device objects (command buffers, picture infos, statuses) out of a few large NvMap blocks,
+// so that each doesn't cost its own handle, create/alloc ioctl pair, mapping and page
+// Regions are only released along with the arena
+class NvMapArena {
+    public:
+        // Blocks are mapped to the channel on the Switch. Objects larger than block_size get a block of their own
+        Result initialize(int channel_fd, std::uint32_t block_size = 0x10000);
+        Result finalize();
+
+        // Alignment is capped to the page size, which blocks are aligned to
+        Result allocate(std::uint32_t size, std::uint32_t align, NvMapRegion &region);
+
+        std::size_t get_num_blocks() const {
+            return this->blocks.size();
+        }
+
+        // Bytes handed out, including the alignment padding, and bytes allocated in blocks
+        std::size_t get_used_size() const;
+        std::size_t get_allocated_size() const;
+
+    private:
+        struct Block {
+            std::unique_ptr<NvMap> map;
+            std::uint32_t used;
+        };
+
+    private:
+        Result add_block(std::uint32_t size);
+
+    private:
+        int channel_fd = 0;
+        std::uint32_t block_size = 0;
+        std::vector<Block> blocks;
+};
+
+} // namespace nj
@@ -0,0 +1,106 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <utility>
+
+namespace nj {
+
+// Bounded multi-producer multi-consumer queue, after Dmitry Vyukov's design: each cell carries a sequence number
+// telling whether it is ready for the producer or the consumer of a given position, so that both sides only contend
+// on a compare-and-swap of their position counter. Neither push nor pop block, and both fail when the queue is full or empty
+template <typename T>
+class MpmcQueue {
+    public:
+        // Rounded up to a power of two
+        MpmcQueue(std::size_t capacity): capacity(std::bit_ceil(std::max(capacity, std::size_t(2)))),
+                cells(std::make_unique<Cell[]>(this->capacity)) {
+            for (std::size_t i = 0; i < this->capacity; ++i)
+                this->cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        std::size_t get_capacity() const {
+            return this->capacity;
+        }
+
+        bool push(T value) {
+            Cell *cell;
+            auto pos = this->push_pos.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &this->cells[pos & (this->capacity - 1)];
+                auto diff = static_cast<std::intptr_t>(cell->sequence.load(std::memory_order_acquire) - pos);
+                if (diff == 0) {
+                    if (this->push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    // The cell still holds the value from the previous lap
+                    return false;
+                } else {
+                    pos = this->push_pos.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->value = std::move(value);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T &value) {
+            Cell *cell;
+            auto pos = this->pop_pos.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &this->cells[pos & (this->capacity - 1)];
+                auto diff = static_cast<std::intptr_t>(cell->sequence.load(std::memory_order_acquire) - (pos + 1));
+                if (diff == 0) {
+                    if (this->pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = this->pop_pos.load(std::memory_order_relaxed);
+                }
+            }
+
+            value = std::move(cell->value);
+            cell->sequence.store(pos + this->capacity, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        constexpr static std::size_t cache_line_size = 64;
+
+        struct alignas(cache_line_size) Cell {
+            std::atomic_size_t sequence;
+            T value;
+        };
+
+    private:
+        std::size_t capacity;
+        std::unique_ptr<Cell[]> cells;
+
+        // Kept on separate lines so that producers and consumers don't invalidate each other's
+        alignas(cache_line_size) std::atomic_size_t push_pos = 0;
+        alignas(cache_line_size) std::atomic_size_t pop_pos  = 0;
+};
+
+} // namespace nj
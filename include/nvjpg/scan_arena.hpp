@@ -0,0 +1,136 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <nvjpg/nv/ctrl.hpp>
+#include <nvjpg/nv/map.hpp>
+#include <nvjpg/metrics.hpp>
+#include <nvjpg/utils.hpp>
+
+namespace nj {
+
+// Circular buffer of device memory holding the scan data of the renders in flight
+// Each render carves out the bytes it needs, reclaimed in submission order once its fence is reached
+// Scans that don't fit wait for renders in flight to complete, or when too large for that to help, move the arena
+// to a larger buffer, the previous one being released after the last render reading from it retires
+// Not thread-safe, it is only used by the thread submitting renders
+class ScanArena {
+    public:
+        // The engine addresses scan data in 256-byte units
+        constexpr static std::uint32_t alignment = 0x100;
+
+        struct Allocation {
+            const NvMap  *map;
+            std::uint32_t offset;
+        };
+
+        struct Stats {
+            std::uint64_t num_waits;    // Allocations which waited for a render in flight to free up space
+            std::uint64_t num_grows;
+        };
+
+    public:
+        // At most max_allocations can be in flight at once, ie. one per ring entry
+        Result initialize(std::size_t capacity, std::size_t max_allocations, int channel_fd);
+
+        // The renders using the arena must have completed
+        Result finalize();
+
+        // Replaces the buffer, allocations already made remain valid until their render retires
+        Result resize(std::size_t capacity);
+
+        // Reserves space for a scan, waiting for renders in flight or growing the buffer as needed
+        Result allocate(std::size_t size, Allocation &allocation);
+
+        // Assigns the fence of the render reading from the oldest allocation that has none
+        void commit(const nvhost_ctrl_fence &fence);
+
+        // Releases the allocations made since the last commit, whose render was not submitted
+        void cancel();
+
+        std::size_t capacity() const {
+            return this->buffers.empty() ? 0 : this->buffers.back().map->size();
+        }
+
+        // Safe to call from any thread
+        Stats get_stats() const {
+            return { this->num_waits.get(), this->num_grows.get() };
+        }
+
+        void reset_stats() {
+            this->num_waits.reset();
+            this->num_grows.reset();
+        }
+
+    private:
+        struct Buffer {
+            std::unique_ptr<NvMap> map;
+            std::uint64_t generation;
+        };
+
+        struct Record {
+            std::uint64_t     generation;       // Of the buffer holding it
+            std::uint32_t     begin, end;
+            nvhost_ctrl_fence fence;            // Valid for the first num_committed records
+        };
+
+    private:
+        Result add_buffer(std::size_t capacity);
+
+        // Finds room in the current buffer, without reclaiming anything
+        bool fit(std::uint32_t size, std::uint32_t &offset) const;
+
+        // Pops the allocations whose render completed, waiting for the oldest one if wait is set
+        // Returns false if nothing could be reclaimed
+        bool reclaim(bool wait);
+
+        // Frees the previous buffers no allocation refers to anymore
+
+        void release_buffers();
+
+        Record &get_record(std::size_t idx) {
+            return this->records[(this->first_record + idx) % this->records.size()];
+        }
+
+        const Record &get_record(std::size_t idx) const {
+            return this->records[(this->first_record + idx) % this->records.size()];
+        }
+
+    private:
+        int channel_fd = 0;
+
+        std::deque<Buffer> buffers;         // The current one at the back
+        std::uint64_t generation = 0;
+
+        // Fixed ring of allocations in flight, in submission order
+        std::vector<Record> records;
+        std::size_t first_record = 0, num_records = 0, num_committed = 0;
+
+        // Allocations in the current buffer span [tail, head), wrapping around its end
+        std::uint32_t head = 0, tail = 0;
+        std::size_t num_current = 0;        // Records in the current buffer
+
+        Counter num_waits, num_grows;
+};
+
+} // namespace nj
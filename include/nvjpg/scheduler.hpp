@@ -0,0 +1,218 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <nvjpg/decoder.hpp>
+#include <nvjpg/image.hpp>
+#include <nvjpg/surface.hpp>
+
+namespace nj {
+
+// Online linear model of the latency of a backend, fitted by recursive least squares
+class CostModel {
+    public:
+        // Bias, MCUs (thousands), 8x8 blocks (thousands), scan data (KiB), output pixels (millions),
+        // progressive blocks (thousands, these need an extra entropy pass, or a transcode before reaching the engine)
+        constexpr static std::size_t num_features = 6;
+        using Features = std::array<double, num_features>;
+
+    public:
+        constexpr CostModel(const Features &prior, double forgetting = 0.98): weights(prior), forgetting(forgetting) {
+            for (std::size_t i = 0; i < num_features; ++i)
+                this->covariance[i][i] = 10.0;
+        }
+
+        // In microseconds
+        double predict(const Features &x) const;
+
+        void update(const Features &x, double latency_us);
+
+        const Features &get_weights() const {
+            return this->weights;
+        }
+
+        std::size_t get_num_samples() const {
+            return this->num_samples;
+        }
+
+        // Moving average of |predicted - measured| / measured, over the last samples
+        double get_error() const {
+            return this->error;
+        }
+
+    private:
+        Features weights;
+        std::array<Features, num_features> covariance = {};
+        double forgetting;
+        std::size_t num_samples = 0;
+        double error = 0;
+};
+
+// Front end dispatching each render either to the engine or to a pool of CPU workers,
+// picking the one expected to complete first given the image and the work already queued on both
+class Scheduler {
+    public:
+        enum class Target {
+            Hardware,
+            Software,
+        };
+
+        enum class Policy {
+            CostModel,      // Route by predicted completion time
+            Hardware,       // Always use the engine, if available
+            Software,       // Always use the CPU workers
+        };
+
+        struct Job {
+            std::uint32_t  num_mcus;
+            std::uint32_t  num_blocks;
+            std::size_t    scan_size;
+            std::uint32_t  out_pixels;
+            SamplingFormat sampling;
+            std::uint32_t  downscale_log_2;
+            bool           progressive;
+            bool           in_device_memory;    // Scan read in place by the engine, see ImageReader
+        };
+
+        struct Decision {
+            Job         job;
+            Target      target;
+            double      hw_service_us,  sw_service_us;      // Predicted decoding time
+            double      hw_wait_us,     sw_wait_us;         // Predicted time before the job starts, from the work in flight
+            std::size_t hw_queue_depth, sw_queue_depth;     // Jobs in flight when the decision was taken
+        };
+
+        struct Stats {
+            std::size_t num_hardware, num_software;
+            std::size_t hw_queue_depth, sw_queue_depth;
+            double      hw_backlog_us, sw_backlog_us;
+        };
+
+    public:
+        Policy policy = Policy::CostModel;
+        Decoder::ColorSpace colorspace = Decoder::ColorSpace::BT601Ex;
+
+    public:
+        Scheduler();
+        ~Scheduler();
+
+        // The engine is used when it can be opened, with num_ring_entries jobs in flight
+        Result initialize(std::size_t num_sw_workers = 2, std::size_t num_ring_entries = 2,
+            std::size_t capacity = 0x100000); // 1 Mib
+        Result finalize();
+
+        bool has_hardware() const {
+            return this->hw_available;
+        }
+
+        // Images must stay valid until the surface has been waited on, since CPU workers read them asynchronously
+        Result render(const Image &image, Surface      &surf, std::uint8_t alpha = 0, std::uint32_t downscale = 0);
+        Result render(const Image &image, VideoSurface &surf, std::uint32_t downscale = 0);
+
+        Result wait(const SurfaceBase &surf, std::size_t *num_read_bytes = nullptr, std::int32_t timeout_us = -1);
+
+        Result wait(auto &&...surfs) requires requires (decltype(surfs) ...args) { (args.width, ...); } {
+            return (this->wait(surfs, nullptr, -1) | ...);
+        }
+
+        const Decision &get_last_decision() const {
+            return this->last_decision;
+        }
+
+        // Unlike render and wait, which must be called from a single thread, these can be used to monitor
+        // the scheduler from another one
+        CostModel get_model(Target target) const;
+
+        Stats get_stats() const;
+
+        static Job describe(const Image &image, std::uint32_t downscale);
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct HardwareJob {
+            decltype(SurfaceBase::render_fence) fence;
+            Clock::time_point start, last_pending;  // Completion happened between last_pending and the next poll
+            CostModel::Features features;
+            double estimate_us;
+        };
+
+        struct SoftwareJob {
+            std::uint32_t id;
+            const Image *image;
+            SurfaceBase *surf;
+            bool is_video;
+            std::uint8_t alpha;
+            std::uint32_t downscale;
+            SoftwareDecoder::Kernel kernel;
+            CostModel::Features features;
+            double estimate_us;
+        };
+
+        struct Completion {
+            bool done;
+            Result rc;
+            std::size_t used_bytes;
+        };
+
+    private:
+        Result render_common(const Image &image, SurfaceBase &surf, bool is_video, std::uint8_t alpha, std::uint32_t downscale);
+
+        Decision decide(const Job &job, const CostModel::Features &features);
+
+        // Retires completed engine jobs, feeding their latency to the hardware model
+        void poll_hardware();
+
+        void worker_main();
+
+        void stop_workers();
+
+    private:
+        Decoder hw_decoder;
+        bool hw_available = false;
+
+        CostModel hw_model, sw_model;
+        Decision last_decision = {};
+        std::size_t num_hardware = 0, num_software = 0;
+
+        std::deque<HardwareJob> hw_jobs;
+        double hw_backlog_us = 0;
+        Clock::time_point last_hw_completion;
+
+        std::vector<std::thread> workers;
+        mutable std::mutex mutex;
+        std::condition_variable work_cv, done_cv;
+        std::deque<SoftwareJob> sw_queue;
+        std::map<std::uint32_t, Completion> sw_completions;
+        std::size_t sw_in_flight = 0;
+        double sw_backlog_us = 0;
+        std::uint32_t sw_next_id = 0;
+        bool stop = false;
+};
+
+} // namespace nj
@@ -0,0 +1,136 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <nvjpg/decoder.hpp>
+#include <nvjpg/image.hpp>
+#include <nvjpg/metrics.hpp>
+#include <nvjpg/queue.hpp>
+#include <nvjpg/surface.hpp>
+
+namespace nj {
+
+// Front end letting any number of threads render through a single decoder, instead of each opening its own channel
+// and ring. Producers push requests into a lock-free queue, which a submitter thread owning the decoder drains,
+// submitting the requests it finds queued together as a batch. Completions are routed back through tickets
+class SharedDecoder {
+    public:
+        // Completion of a request, owned by the producer
+        class Ticket {
+            public:
+                bool is_done() const {
+                    return this->done.load(std::memory_order_acquire);
+                }
+
+                void wait() const {
+                    this->done.wait(false, std::memory_order_acquire);
+                }
+
+                // Valid once done
+                const Decoder::Completion &get_completion() const {
+                    return this->completion;
+                }
+
+            private:
+                friend class SharedDecoder;
+
+                std::atomic_bool done = false;
+                Decoder::Completion completion = {};
+        };
+
+        struct Stats {
+            std::uint64_t num_requests;
+            std::uint64_t num_batches;      // Calls to Decoder::render, each submitting consecutive requests together
+            std::uint64_t num_queue_full;   // Pushes retried because the queue was full
+        };
+
+    public:
+        ~SharedDecoder();
+
+        // Options of the underlying decoder (colorspace, ...) must be set before initializing
+        Result initialize(std::size_t num_ring_entries = 4, std::size_t capacity = 0x100000, // 1 Mib
+            std::size_t queue_size = 256, Decoder::Backend backend = Decoder::Backend::Auto);
+
+        // Requests submitted until now are completed first. No request may be submitted concurrently
+        Result finalize();
+
+        Decoder &get_decoder() {
+            return this->decoder;
+        }
+
+        // Thread-safe. The image, surface and ticket must stay alive until the ticket is done
+        // Yields while the queue is full
+        Result submit(const Image &image, Surface      &surf, Ticket &ticket, std::uint8_t alpha = 0, std::uint32_t downscale = 0);
+        Result submit(const Image &image, VideoSurface &surf, Ticket &ticket, std::uint32_t downscale = 0);
+
+        Stats get_stats() const;
+
+    private:
+        struct Request {
+            const Image   *image;
+            SurfaceBase   *surf;
+            Ticket        *ticket;
+            bool           is_video;
+            std::uint8_t   alpha;
+            std::uint32_t  downscale;
+        };
+
+    private:
+        Result submit_common(const Request &request);
+
+        void submitter_main();
+
+        // Submits consecutive requests of the same surface kind together
+        void submit_batch(std::span<const Request> requests);
+
+        template <typename Job>
+        void submit_run(std::span<const Request> requests, std::vector<Job> &jobs);
+
+        void complete(const Decoder::Completion &completion);
+
+    private:
+        Decoder decoder;
+        std::unique_ptr<MpmcQueue<Request>> queue;
+        std::size_t max_batch_size = 0;
+
+        // Bumped after each push, the submitter waits on it when the queue runs empty
+        std::atomic_uint32_t num_pushed = 0;
+        std::atomic_bool stop = false;
+        std::thread submitter;
+
+        // Tickets of the renders in flight, in submission order, which is also their completion order
+        std::mutex in_flight_mutex;
+        std::deque<Ticket *> in_flight;
+
+        // Only used by the submitter
+        std::vector<Decoder::RenderJob>      jobs;
+        std::vector<Decoder::VideoRenderJob> video_jobs;
+
+        Counter num_requests, num_batches, num_queue_full;
+};
+
+} // namespace nj
@@ -55,6 +55,17 @@ enum class MemoryMode {
     Planar         = 3,
 };
 
+// Pitch-linear placement of the planes of a surface, as written by the engine
+// Planes are packed contiguously, with the minimum padding the engine requires
+struct SurfaceLayout {
+    constexpr static std::size_t pitch_align = 0x100;   // Pitch granularity of the output
+    constexpr static std::size_t plane_align = 0x100;   // Plane offsets are relocated with a 256-byte granularity
+    constexpr static std::size_t row_align   = 16;      // Luma rows of the tallest MCU, which may be written in full
+
+    std::size_t pitches[3] = {}, offsets[3] = {};       // Only the first plane is used for RGB surfaces
+    std::size_t size = 0;                               // Payload size, covering every plane
+};
+
 class SurfaceBase {
     public:
         std::size_t width, height;
@@ -65,27 +76,59 @@ class SurfaceBase {
             width(width), height(height), type(type) { }
 
         const std::uint8_t *data() const {
-            return static_cast<std::uint8_t *>(this->map.address());
+            return static_cast<const std::uint8_t *>(this->get_map().address()) + this->offset;
         }
 
+        // Size of the memory from data() onwards, which may be larger than the planes
         std::size_t size() const {
-            return this->map.size();
+            return this->get_map().size() - this->offset;
         }
 
+        std::size_t payload_size() const {
+            return this->payload;
+        }
+
+        // Memory the surface renders into, which is owned by another object (eg. an atlas) if it is bound
         const NvMap &get_map() const {
-            return this->map;
+            return this->bound_map ? *this->bound_map : this->map;
+        }
+
+        // Offset of the surface within its map
+        std::size_t get_offset() const {
+            return this->offset;
         }
 
     protected:
         NvMap map;
+        NvMap *bound_map = nullptr;
+        std::size_t offset = 0, payload = 0;
 
 #ifdef __SWITCH__
         NvFence           render_fence = {};
 #else
         nvhost_ctrl_fence render_fence = {};
 #endif
+        std::int32_t      render_entry = -1;   // Decoder ring entry of the last render
+
+    protected:
+        // Makes the surface render into memory it doesn't own, at the given offset
+        void bind(NvMap &map, std::size_t offset) {
+            this->bound_map = &map, this->offset = offset;
+        }
+
+        NvMap &get_target_map() {
+            return this->bound_map ? *this->bound_map : this->map;
+        }
+
+        std::uint8_t *get_target_data() {
+            return static_cast<std::uint8_t *>(this->get_target_map().address()) + this->offset;
+        }
 
         friend class Decoder;
+        friend class Scheduler;
+        friend class SoftwareDecoder;
+        friend class SurfacePool;
+        friend class SurfaceAtlas;
 };
 
 class Surface: public SurfaceBase {
@@ -98,6 +141,8 @@ class Surface: public SurfaceBase {
 
         int allocate();
 
+        static SurfaceLayout compute_layout(std::size_t width, std::size_t height, PixelFormat pixel_fmt);
+
         constexpr int get_bpp() const {
             switch (this->type) {
                 case PixelFormat::RGB  ... PixelFormat::BGR:
@@ -109,6 +154,9 @@ class Surface: public SurfaceBase {
         }
 
 #if defined(__SWITCH__) && __has_include(<deko3d.hpp>)
+        // Returns null objects if the surface memory is too small for the image with the given flags,
+        // eg. compressed layouts may need more padding than the engine does, or if a bound surface
+        // (view, atlas cell) starts at an offset the layout can't be placed at
         std::tuple<dk::MemBlock, dk::Image> to_deko3d(dk::Device device, std::uint32_t flags = 0) const {
             auto map_dk_fmt = [](PixelFormat fmt) {
                 switch (fmt) {
@@ -133,13 +181,21 @@ class Surface: public SurfaceBase {
                 .initialize(layout);
 
             auto image_size = align_up(static_cast<std::uint32_t>(layout.getSize()), layout.getAlignment());
-            auto image_memblock = dk::MemBlockMaker(device, image_size)
+            if (this->size() < image_size || !is_aligned(this->get_offset(), std::size_t(layout.getAlignment())))
+                return {};
+
+            // Memblocks need page-aligned storage, which the map is but views and atlas cells may not be
+            auto memblock_size = align_up(this->get_offset() + image_size, std::size_t(DK_MEMBLOCK_ALIGNMENT));
+            if (this->get_map().size() < memblock_size)
+                return {};
+
+            auto image_memblock = dk::MemBlockMaker(device, static_cast<std::uint32_t>(memblock_size))
                 .setFlags(DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached | DkMemBlockFlags_Image)
-                .setStorage(this->map.address())
+                .setStorage(this->get_map().address())
                 .create();
 
             dk::Image image;
-            image.initialize(layout, image_memblock, 0);
+            image.initialize(layout, image_memblock, static_cast<std::uint32_t>(this->get_offset()));
 
             return { image_memblock, image };
         }
@@ -162,6 +218,9 @@ class VideoSurface: public SurfaceBase {
 
         int allocate();
 
+        // Returns an empty layout for sampling formats the engine can't output
+        static SurfaceLayout compute_layout(std::size_t width, std::size_t height, SamplingFormat sampling);
+
         constexpr int get_depth() const  {
             switch (this->sampling) {
                 case SamplingFormat::S420:
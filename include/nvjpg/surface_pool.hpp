@@ -0,0 +1,117 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <compare>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include <nvjpg/surface.hpp>
+#include <nvjpg/utils.hpp>
+
+namespace nj {
+
+// Recycles surfaces instead of allocating a new nvmap handle for every image
+// Requests are rounded up to size classes (4 steps per power of two in each dimension, at least 16 pixels),
+// and released surfaces are handed out again for the same class, once the engine is done rendering to them
+// The free surfaces are trimmed, least recently released first, to keep the total memory under a cap
+// Thread-safe. The pool must outlive the surfaces it hands out
+class SurfacePool {
+    public:
+        // Returns the surface to its pool
+        struct Releaser {
+            SurfacePool *pool;
+
+            void operator ()(SurfaceBase *surf) const {
+                this->pool->release(surf);
+            }
+        };
+
+        template <typename T>
+        using Ptr = std::unique_ptr<T, Releaser>;
+
+        struct Stats {
+            std::uint64_t num_acquires;
+            std::uint64_t num_allocations;      // Acquires which had to allocate a new surface
+            std::uint64_t num_trims;            // Free surfaces released to keep under the cap
+            std::size_t   used_size;            // Bytes held by the surfaces handed out
+            std::size_t   free_size;            // Bytes held by the free surfaces
+        };
+
+    public:
+        // 0 for no cap
+        SurfacePool(std::size_t max_size = 0): max_size(max_size) { }
+        ~SurfacePool();
+
+        // Surfaces have the requested dimensions, but the layout of their class (pitch, plane offsets)
+        // Fails with ENOMEM if a new surface would exceed the cap even with every free surface trimmed
+        Result acquire(std::size_t width, std::size_t height, PixelFormat    format,   Ptr<Surface>      &surf);
+        Result acquire(std::size_t width, std::size_t height, SamplingFormat sampling, Ptr<VideoSurface> &surf);
+
+        void set_max_size(std::size_t max_size);
+
+        // Frees every free surface the engine is done with
+        void trim();
+
+        Stats get_stats() const;
+
+        static std::size_t get_size_class(std::size_t dim);
+
+    private:
+        struct Key {
+            std::size_t    width, height;
+            PixelFormat    format;
+            SamplingFormat sampling;
+
+            auto operator <=>(const Key &) const = default;
+        };
+
+        struct Entry {
+            Key key;
+            std::unique_ptr<Surface>      surf;
+            std::unique_ptr<VideoSurface> video_surf;
+
+            SurfaceBase &get() const {
+                return this->surf ? static_cast<SurfaceBase &>(*this->surf) : *this->video_surf;
+            }
+        };
+
+    private:
+        // Takes a free surface of the class whose last render completed, or allocates a new one
+        Result acquire_common(const Key &key, Entry &entry);
+
+        void release(SurfaceBase *surf);
+
+        // Frees the least recently released surfaces until size bytes fit under the cap
+        // Returns false if they still don't
+        bool trim_to_fit(std::size_t size);
+
+        static bool is_idle(const SurfaceBase &surf);
+
+    private:
+        mutable std::mutex mutex;
+        std::size_t max_size;
+
+        std::list<Entry> free_list;         // Most recently released first
+        std::size_t used_size = 0, free_size = 0;
+        std::uint64_t num_acquires = 0, num_allocations = 0, num_trims = 0;
+};
+
+} // namespace nj
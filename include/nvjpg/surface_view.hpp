@@ -0,0 +1,53 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+
+#include <nvjpg/nv/map.hpp>
+#include <nvjpg/surface.hpp>
+#include <nvjpg/utils.hpp>
+
+namespace nj {
+
+// A surface rendering into memory owned by the caller, eg. a framebuffer, shared memory or a GPU image,
+// instead of a private allocation which would then need to be copied
+// The view covers a rectangle of the memory: its first pixel is at offset, and its rows pitch bytes apart
+// The engine relocates the output with a 256-byte granularity, so offset and pitch must be multiples of that
+// Images whose height isn't a multiple of 16 may get their last MCU row written in full, past the view
+class SurfaceView: public Surface {
+    public:
+        constexpr SurfaceView(std::size_t width, std::size_t height, PixelFormat pixel_fmt = PixelFormat::RGBA):
+            Surface(width, height, pixel_fmt) { }
+
+        // Views don't allocate
+        int allocate() = delete;
+
+        // Renders into an existing nvmap handle, which must outlive the view
+        // size is the number of bytes the view can write to from offset
+        Result wrap(NvMap &map, std::size_t offset, std::size_t pitch, std::size_t size);
+
+        // Imports caller memory into nvmap, and renders into it. It must outlive the view,
+        // and its address and size must be page-aligned
+        Result import(void *address, std::size_t size, std::size_t pitch, std::size_t offset = 0);
+
+    private:
+        Result set_layout(std::size_t offset, std::size_t pitch, std::size_t size, std::size_t map_size);
+};
+
+} // namespace nj
@@ -0,0 +1,69 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include <nvjpg/image.hpp>
+#include <nvjpg/utils.hpp>
+
+namespace nj {
+
+// Quantized DCT coefficients of every block of an image, in natural order
+// Filled by entropy-decoding all the scans of a progressive image
+class CoefficientBuffer {
+    public:
+        struct Component {
+            int blocks_h, blocks_v;         // Sampling factors
+            int width, height;              // In blocks, padded to a whole number of MCUs
+            int coded_width, coded_height;  // In blocks, covering the component samples (non-interleaved scans)
+            std::vector<std::int16_t> coefs;
+
+            std::int16_t *block(int x, int y) {
+                return this->coefs.data() + (static_cast<std::size_t>(y) * this->width + x) * 64;
+            }
+
+            const std::int16_t *block(int x, int y) const {
+                return this->coefs.data() + (static_cast<std::size_t>(y) * this->width + x) * 64;
+            }
+        };
+
+    public:
+        // Decodes all the scans of a progressive image, the storage is reused between calls
+        Result decode(const Image &image);
+
+        // Bytes spanned by the scans, counted from the start of the first one
+        std::size_t get_used_bytes() const {
+            return this->used_bytes;
+        }
+
+    public:
+        int num_mcu_h = 0, num_mcu_v = 0;
+        std::size_t num_components = 0;
+        std::array<Component, 3> components = {};
+
+    private:
+        Result decode_scan(const Image &scan, std::size_t &consumed);
+
+    private:
+        std::size_t used_bytes = 0;
+};
+
+} // namespace nj
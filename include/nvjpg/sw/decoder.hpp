@@ -0,0 +1,57 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <memory>
+
+#include <nvjpg/nv/registers.hpp>
+#include <nvjpg/sw/thread_pool.hpp>
+#include <nvjpg/image.hpp>
+#include <nvjpg/surface.hpp>
+#include <nvjpg/utils.hpp>
+
+namespace nj {
+
+// CPU implementation of the decoding process, used when the engine is unavailable
+// Output follows the conventions of the hardware: same pitches, pixel formats, alpha value and downscaling
+class SoftwareDecoder {
+    public:
+        using Kernel = std::array<std::uint32_t, 6>; // Same layout as NvjpgPictureInfo::yuv2rgb_kernel
+
+    public:
+        Result render(const Image &image, Surface      &surf, const Kernel &kernel, std::uint8_t alpha = 0,
+            std::uint32_t downscale = 0, NvjpgStatus *status = nullptr) const;
+        Result render(const Image &image, VideoSurface &surf, std::uint32_t downscale = 0, NvjpgStatus *status = nullptr) const;
+
+        // Images with restart markers, and progressive ones once entropy-decoded, are split in ranges of MCU rows
+        // decoded concurrently on this number of threads. 1 (the default) decodes everything on the calling thread
+        void set_num_threads(std::size_t num_threads) {
+            this->pool = (num_threads > 1) ? std::make_unique<ThreadPool>(num_threads) : nullptr;
+        }
+
+        std::size_t get_num_threads() const {
+            return this->pool ? this->pool->size() : 1;
+        }
+
+    private:
+        std::unique_ptr<ThreadPool> pool;
+};
+
+} // namespace nj
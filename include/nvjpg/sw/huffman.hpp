@@ -0,0 +1,182 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <span>
+
+#include <nvjpg/image.hpp>
+
+namespace nj {
+
+// Zigzag index -> natural (row-major) coefficient index
+constexpr std::array<std::uint8_t, 64> zigzag_to_natural = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Reads entropy-coded data, removing byte stuffing
+// Markers are not consumed: once one is reached, zeros are fed to the decoder until restart() is called
+class BitReader {
+    public:
+        BitReader(std::span<const std::uint8_t> data): begin(data.data()), cur(data.data()), end(data.data() + data.size()) { }
+
+        std::uint32_t peek(int count) {
+            if (this->num_bits < count)
+                this->refill();
+            return static_cast<std::uint32_t>(this->acc >> (64 - count));
+        }
+
+        void skip(int count) {
+            this->acc <<= count, this->num_bits -= count;
+        }
+
+        std::uint32_t get(int count) {
+            if (!count)
+                return 0;
+            auto val = this->peek(count);
+            this->skip(count);
+            return val;
+        }
+
+        // Reads a value of the given magnitude category and sign-extends it (F.2.2.1)
+        std::int32_t get_extend(int count) {
+            if (!count)
+                return 0;
+            auto val = static_cast<std::int32_t>(this->get(count));
+            return (val < (1 << (count - 1))) ? val - (1 << count) + 1 : val;
+        }
+
+        // Discards buffered bits and skips the next RSTn marker
+        void restart() {
+            this->acc = 0, this->num_bits = 0, this->num_fake_bits = 0, this->hit_marker = false;
+
+            while (this->cur + 1 < this->end) {
+                if (this->cur[0] == 0xff && (this->cur[1] & 0xf8) == 0xd0) {
+                    this->cur += 2;
+                    return;
+                }
+                ++this->cur;
+            }
+        }
+
+        // Number of bytes consumed from the input, not counting buffered bits
+        std::size_t consumed() const {
+            auto buffered = std::max(this->num_bits - this->num_fake_bits, 0) / 8;
+            return static_cast<std::size_t>(this->cur - this->begin) - buffered;
+        }
+
+        bool reached_marker() const {
+            return this->hit_marker;
+        }
+
+    private:
+        void refill() {
+            while (this->num_bits <= 56) {
+                std::uint64_t byte = 0;
+                if (this->hit_marker || this->cur >= this->end)
+                    this->num_fake_bits += 8;
+                else if (byte = *this->cur; byte != 0xff)
+                    ++this->cur;
+                else if ((this->cur + 1 < this->end) && (this->cur[1] == 0x00))
+                    this->cur += 2;
+                else
+                    this->hit_marker = true, byte = 0, this->num_fake_bits += 8;
+
+                this->acc |= byte << (56 - this->num_bits);
+                this->num_bits += 8;
+            }
+        }
+
+    private:
+        const std::uint8_t *begin, *cur, *end;
+        std::uint64_t acc           = 0;
+        int           num_bits      = 0;
+        int           num_fake_bits = 0;
+        bool          hit_marker    = false;
+};
+
+class HuffmanDecoder {
+    public:
+        constexpr static int lookup_bits = 9;
+
+    public:
+        // Fails with EINVAL if the code lengths oversubscribe the code space, as in a corrupt table
+        Result build(const Image::HuffmanTable &table) {
+            this->lookup = {};
+            this->symbols = table.symbols;
+
+            std::int32_t code = 0, idx = 0;
+            for (int len = 1; len <= 16; ++len) {
+                auto count = static_cast<std::int32_t>(table.codes[len - 1]);
+                if (code + count > (1 << len))
+                    return EINVAL;
+
+                this->valptr [len] = idx - code;
+                this->maxcode[len] = count ? code + count - 1 : -1;
+
+                for (std::int32_t i = 0; i < count; ++i, ++code, ++idx) {
+                    if (len > lookup_bits || idx >= static_cast<std::int32_t>(this->symbols.size()))
+                        continue;
+
+                    // Fill every entry which has this code as prefix
+                    auto shift = lookup_bits - len;
+                    for (std::int32_t j = 0; j < (1 << shift); ++j)
+                        this->lookup[(code << shift) | j] = static_cast<std::uint16_t>(len << 8 | this->symbols[idx]);
+                }
+
+                code <<= 1;
+            }
+
+            this->maxcode[17] = INT32_MAX; // Sentinel, stops the slow path on corrupt data
+            return 0;
+        }
+
+        std::uint8_t decode(BitReader &br) const {
+            auto entry = this->lookup[br.peek(lookup_bits)];
+            if (entry) [[likely]] {
+                br.skip(entry >> 8);
+                return static_cast<std::uint8_t>(entry);
+            }
+
+            int len = lookup_bits + 1;
+            auto code = static_cast<std::int32_t>(br.peek(len));
+            while (code > this->maxcode[len])
+                code = static_cast<std::int32_t>(br.peek(++len));
+
+            br.skip(std::min(len, 16));
+            return (len <= 16) ? this->symbols[static_cast<std::size_t>(this->valptr[len] + code) % this->symbols.size()] : 0;
+        }
+
+    private:
+        std::array<std::uint16_t, 1 << lookup_bits> lookup;  // (length << 8) | symbol, 0 if the code is longer
+        std::array<std::int32_t,  18>               maxcode;
+        std::array<std::int32_t,  17>               valptr;
+        std::array<std::uint8_t,  162>              symbols;
+};
+
+} // namespace nj
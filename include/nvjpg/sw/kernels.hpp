@@ -0,0 +1,76 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <span>
+
+#include <nvjpg/surface.hpp>
+
+namespace nj {
+
+struct PixelLayout {
+    int bpp;
+    int r, g, b, a; // Byte offsets, -1 if absent
+};
+
+constexpr PixelLayout get_pixel_layout(PixelFormat fmt) {
+    switch (fmt) {
+        case PixelFormat::RGB:
+            return { 3, 0, 1, 2, -1 };
+        case PixelFormat::BGR:
+            return { 3, 2, 1, 0, -1 };
+        case PixelFormat::RGBA:
+        default:
+            return { 4, 0, 1, 2,  3 };
+        case PixelFormat::BGRA:
+            return { 4, 2, 1, 0,  3 };
+        case PixelFormat::ABGR:
+            return { 4, 3, 2, 1,  0 };
+        case PixelFormat::ARGB:
+            return { 4, 1, 2, 3,  0 };
+    }
+}
+
+// Per-ISA implementations of the hot loops of the software decoder
+// All variants produce bit-identical results to the scalar reference
+struct SoftwareKernels {
+    using Yuv2RgbKernel = std::array<std::uint32_t, 6>;
+
+    // Dequantizes and transforms a block in natural order (islow algorithm), adding the level shift
+    void (*idct_8x8)(const std::int16_t *coefs, const std::uint16_t *quant, std::uint8_t *out, std::size_t stride);
+
+    // Doubles the horizontal resolution of a row of samples by replication, writing width samples
+    // Vertical upsampling (S420/S440) reuses the same source row twice and needs no kernel
+    void (*upsample_h2)(const std::uint8_t *in, std::uint8_t *out, std::size_t width);
+
+    // Converts full-resolution rows of samples to packed pixels, using the fixed-point kernel of the engine
+    void (*yuv_to_rgb)(const std::uint8_t *y, const std::uint8_t *cb, const std::uint8_t *cr, std::uint8_t *out,
+        std::size_t width, const Yuv2RgbKernel &kernel, PixelLayout layout, std::uint8_t alpha);
+
+    const char *name;
+
+    // Best implementation supported by the running CPU, detected on first use
+    static const SoftwareKernels &get();
+
+    // Every implementation supported by the running CPU, the scalar reference first
+    static std::span<const SoftwareKernels *const> get_all();
+};
+
+} // namespace nj
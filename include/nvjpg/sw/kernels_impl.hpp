@@ -0,0 +1,66 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+#include <nvjpg/sw/kernels.hpp>
+
+// Definitions shared by the per-ISA implementations of SoftwareKernels
+
+namespace nj {
+
+namespace idct {
+
+// Fixed-point constants of the islow IDCT (same algorithm as libjpeg), scaled by 2^13
+constexpr int const_bits = 13, pass1_bits = 2;
+constexpr int pass1_shift = const_bits - pass1_bits, pass2_shift = const_bits + pass1_bits + 3;
+
+constexpr std::int32_t fix_0_298631336 = 2446,  fix_0_390180644 = 3196,  fix_0_541196100 = 4433;
+constexpr std::int32_t fix_0_765366865 = 6270,  fix_0_899976223 = 7373,  fix_1_175875602 = 9633;
+constexpr std::int32_t fix_1_501321110 = 12299, fix_1_847759065 = 15137, fix_1_961570560 = 16069;
+constexpr std::int32_t fix_2_053119869 = 16819, fix_2_562915447 = 20995, fix_3_072711026 = 25172;
+
+constexpr std::int32_t descale(std::int32_t x, int n) {
+    return (x + (1 << (n - 1))) >> n;
+}
+
+} // namespace idct
+
+// Reference color conversion of pixels [start, width), also used for the tails of vectorized loops
+inline void yuv_to_rgb_range(const std::uint8_t *y, const std::uint8_t *cb, const std::uint8_t *cr, std::uint8_t *out,
+        std::size_t start, std::size_t width, const SoftwareKernels::Yuv2RgbKernel &kernel, PixelLayout layout, std::uint8_t alpha) {
+    auto y_gain = static_cast<std::int32_t>(kernel[0]), y_off = static_cast<std::int32_t>(kernel[5]);
+    auto vr     = static_cast<std::int32_t>(kernel[1]), ug    = static_cast<std::int32_t>(kernel[2]);
+    auto vg     = static_cast<std::int32_t>(kernel[3]), ub    = static_cast<std::int32_t>(kernel[4]);
+
+    out += start * layout.bpp;
+    for (auto i = start; i < width; ++i, out += layout.bpp) {
+        auto yy = (y[i] - y_off) * y_gain + 0x8000;
+        auto u  = cb[i] - 128, v = cr[i] - 128;
+
+        out[layout.r] = static_cast<std::uint8_t>(std::clamp((yy + vr * v)          >> 16, 0, 255));
+        out[layout.g] = static_cast<std::uint8_t>(std::clamp((yy + ug * u + vg * v) >> 16, 0, 255));
+        out[layout.b] = static_cast<std::uint8_t>(std::clamp((yy + ub * u)          >> 16, 0, 255));
+        if (layout.a >= 0)
+            out[layout.a] = alpha;
+    }
+}
+
+} // namespace nj
@@ -0,0 +1,69 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nj {
+
+// Fixed set of worker threads running data-parallel loops
+class ThreadPool {
+    public:
+        // The calling thread takes part in the loops, so num_threads - 1 workers are spawned
+        ThreadPool(std::size_t num_threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator =(const ThreadPool &) = delete;
+
+        std::size_t size() const {
+            return this->workers.size() + 1;
+        }
+
+        // Calls fn(i) for every i in [0, count) and returns once all calls have completed
+        // Concurrent callers are serialized
+        void parallel_for(std::size_t count, const std::function<void(std::size_t)> &fn);
+
+    private:
+        void worker_main();
+
+        void run_tasks();
+
+    private:
+        std::vector<std::thread> workers;
+
+        std::mutex submit_mutex;    // Held by the thread running a loop
+
+        std::mutex mutex;
+        std::condition_variable start_cv, done_cv;
+        std::uint64_t generation = 0;
+        std::size_t num_busy = 0;
+        bool stop = false;
+
+        const std::function<void(std::size_t)> *task = nullptr;
+        std::size_t task_count = 0;
+        std::atomic<std::size_t> next_index = 0;
+};
+
+} // namespace nj
@@ -0,0 +1,42 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <nvjpg/sw/coefficients.hpp>
+#include <nvjpg/image.hpp>
+#include <nvjpg/utils.hpp>
+
+namespace nj {
+
+// Converts progressive images into a form the engine can decode
+// All the scans are entropy-decoded to coefficients, which are then losslessly re-encoded
+// as a single interleaved baseline scan, with Huffman tables optimized for the image
+class ProgressiveTranscoder {
+    public:
+        // On success, out holds a parsed baseline image with the same dimensions, sampling and quantization tables
+        Result transcode(const Image &image, Image &out);
+
+    private:
+        CoefficientBuffer coefs;
+};
+
+} // namespace nj
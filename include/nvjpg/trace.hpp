@@ -0,0 +1,122 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <span>
+#include <string_view>
+
+#include <nvjpg/utils.hpp>
+
+// Scoped span, compiled out entirely when NJ_DISABLE_TRACING is defined
+#ifndef NJ_DISABLE_TRACING
+#   define NJ_TRACE_SPAN(...) ::nj::TraceSpan NJ_ANONYMOUS_VAR(__VA_ARGS__)
+#else
+#   define NJ_TRACE_SPAN(...)
+#endif
+
+namespace nj {
+
+// Records timed spans of the decoding stages, exported in the Chrome trace event format
+// (chrome://tracing, ui.perfetto.dev). While disabled, a span costs a relaxed load and a branch
+// Events go to a buffer allocated when tracing is enabled, further ones are dropped once it is full
+class Tracer {
+    public:
+        struct Event {
+            std::atomic<const char *> name = nullptr;  // Published last, null while the event is being written
+            std::uint64_t begin_ns = 0, end_ns = 0;
+            std::uint32_t thread   = 0;
+            std::int32_t  entry    = -1;               // Ring entry index, -1 if not applicable
+            std::uint64_t image    = 0;                // Image id, 0 if not applicable
+        };
+
+    public:
+        // Changing the capacity reallocates the buffer, which fails with EBUSY while tracing is enabled.
+        // Like clear, it must not race with spans started before disabling
+        static Result enable(std::size_t capacity = 0x10000);
+        static void disable();
+
+        static bool is_enabled() {
+            return Tracer::enabled.load(std::memory_order_relaxed);
+        }
+
+        // Drops the recorded events. Must not race with spans being recorded
+        static void clear();
+
+        static std::size_t get_num_events();
+        static std::size_t get_num_dropped();
+
+        // Recorded events, in the order their recording started. Events still being written have a null name
+        static std::span<const Event> get_events();
+
+        // Writes the recorded events as a JSON trace. Spans still open are not included
+        static Result save(std::FILE *fp);
+        static Result save(std::string_view path);
+
+        static std::uint64_t now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // Names must be string literals, or outlive the tracer
+        static void record(const char *name, std::uint64_t begin_ns, std::uint64_t end_ns,
+            std::int32_t entry = -1, std::uint64_t image = 0);
+
+    private:
+        static inline std::atomic_bool enabled = false;
+};
+
+// Records the lifetime of the object as a span, when tracing is enabled at construction
+class TraceSpan {
+    public:
+        TraceSpan(const char *name, std::int32_t entry = -1, std::uint64_t image = 0):
+                name(name), entry(entry), image(image) {
+            if (Tracer::is_enabled()) [[unlikely]]
+                this->begin_ns = Tracer::now();
+        }
+
+        ~TraceSpan() {
+            if (this->begin_ns) [[unlikely]]
+                Tracer::record(this->name, this->begin_ns, Tracer::now(), this->entry, this->image);
+        }
+
+        TraceSpan(const TraceSpan &) = delete;
+        TraceSpan &operator =(const TraceSpan &) = delete;
+
+        // Tags known after the span started
+        void set_entry(std::int32_t entry) {
+            this->entry = entry;
+        }
+
+        void set_image(std::uint64_t image) {
+            this->image = image;
+        }
+
+    private:
+        const char   *name;
+        std::int32_t  entry;
+        std::uint64_t image;
+        std::uint64_t begin_ns = 0;
+};
+
+} // namespace nj
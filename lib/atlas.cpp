@@ -0,0 +1,84 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cerrno>
+#include <algorithm>
+#include <numeric>
+
+#include <nvjpg/atlas.hpp>
+
+namespace nj {
+
+std::size_t SurfaceAtlas::get_column_align() const {
+    auto bpp = static_cast<std::size_t>(this->surface.get_bpp());
+    return SurfaceLayout::plane_align / std::gcd(SurfaceLayout::plane_align, bpp);
+}
+
+Result SurfaceAtlas::add(std::size_t width, std::size_t height, Surface &cell, Rect &rect) {
+    if (!width || !height)
+        return EINVAL;
+
+    // The engine may write whole MCUs past the image, so the padding stays within the rectangle,
+    // and may extend into the padding at the end of the rows and after the last one
+    auto bpp = static_cast<std::size_t>(this->surface.get_bpp());
+    auto slot_width  = align_up(width,  this->get_column_align());
+    auto slot_height = align_up(height, SurfaceLayout::row_align);
+    auto max_width   = this->surface.pitch / bpp;
+    auto max_height  = align_up(this->surface.height, SurfaceLayout::row_align);
+
+    auto fits = [&](std::size_t x, std::size_t y) {
+        return (x + width <= this->surface.width) && (x + slot_width <= max_width) &&
+            (y + height <= this->surface.height) && (y + slot_height <= max_height);
+    };
+
+    // The shelf with room that wastes the fewest rows, the lowest one on ties
+    Shelf *shelf = nullptr;
+    for (auto &s: this->shelves) {
+        if (s.height < slot_height || !fits(s.used_width, s.y))
+            continue;
+        if (!shelf || s.height < shelf->height)
+            shelf = &s;
+    }
+
+    if (!shelf) {
+        auto y = this->get_used_height();
+        if (!fits(0, y))
+            return ENOSPC;
+        shelf = &this->shelves.emplace_back(Shelf{ y, slot_height, 0 });
+    }
+
+    auto x = shelf->used_width;
+    shelf->used_width += slot_width;
+    this->used_area   += slot_width * shelf->height;
+
+    auto pitch = this->surface.pitch;
+    cell.width  = width, cell.height = height;
+    cell.type   = this->surface.type;
+    cell.pitch  = pitch;
+    cell.bind(this->surface.get_target_map(), shelf->y * pitch + x * bpp);
+    cell.payload = (height - 1) * pitch + width * bpp;
+
+    auto atlas_width = static_cast<float>(this->surface.width), atlas_height = static_cast<float>(this->surface.height);
+    rect = {
+        .x = x, .y = shelf->y, .width = width, .height = height,
+        .u0 = x / atlas_width,             .v0 = shelf->y / atlas_height,
+        .u1 = (x + width) / atlas_width,   .v1 = (shelf->y + height) / atlas_height,
+    };
+    return 0;
+}
+
+} // namespace nj
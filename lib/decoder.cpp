@@ -21,8 +21,14 @@
 #include <algorithm>
 #include <span>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
+#ifndef __SWITCH__
+#   include <sys/eventfd.h>
+#   include <unistd.h>
+#endif
+
 #include <nvjpg/nv/cmdbuf.hpp>
 #include <nvjpg/nv/ctrl.hpp>
 #include <nvjpg/nv/registers.hpp>
@@ -34,6 +40,9 @@ namespace nj {
 
 namespace {
 
+// Coroutine attached to the next render tracked from this thread, see suspend_render
+thread_local Decoder::Waiter *next_waiter = nullptr;
+
 constexpr std::uint32_t float_to_fixed(float f) {
     return static_cast<int>(f * 65536.0f + 0.5f);
 }
@@ -61,51 +70,95 @@ constinit std::array kernel_bt601ex = {
 
 } // namespace
 
-Result Decoder::initialize(std::size_t num_ring_entries, std::size_t capacity) {
+const SoftwareDecoder::Kernel &Decoder::get_yuv2rgb_kernel(ColorSpace colorspace) {
+    switch (colorspace) {
+        case Decoder::ColorSpace::BT601:
+            return kernel_bt601;
+        case Decoder::ColorSpace::BT709:
+            return kernel_bt709;
+        case Decoder::ColorSpace::BT601Ex:
+        default:
+            return kernel_bt601ex;
+    }
+}
+
+Result Decoder::initialize(std::size_t num_ring_entries, std::size_t capacity, Backend backend) {
     this->entries.resize(num_ring_entries);
+    this->next_entry = this->entries.begin();
 
-    for (auto &entry: this->entries) {
-        NJ_TRY_RET(entry.cmdbuf_map   .allocate(0x8000,                   32,     0x1));
-        NJ_TRY_RET(entry.pic_info_map .allocate(sizeof(NvjpgPictureInfo), 16,     0x1));
-        NJ_TRY_RET(entry.read_data_map.allocate(sizeof(NvjpgStatus),      16,     0x1));
-        NJ_TRY_RET(entry.scan_data_map.allocate(capacity,                 0x1000, 0x1));
+    this->backend = backend;
+    if (backend == Backend::Software)
+        return 0;
+
+    // On failure, the channel and everything allocated through it have been released,
+    // so a busy engine isn't held while decoding on the CPU
+    auto rc = this->initialize_hardware(capacity);
+    if (rc && (backend == Backend::Auto)) {
+        this->entries.clear();
+        this->entries.resize(num_ring_entries);
+        this->next_entry = this->entries.begin();
+        this->backend = Backend::Software;
+        return 0;
     }
 
+    this->backend = Backend::Hardware;
+    return rc;
+}
+
+Result Decoder::initialize_hardware(std::size_t capacity) {
 #ifdef __SWITCH__
     NJ_TRY_RET(this->channel.open("/dev/nvhost-nvjpg"));
 
-    for (auto &entry: this->entries) {
-        NJ_TRY_RET(entry.cmdbuf_map   .map(this->channel.get_fd()));
-        NJ_TRY_RET(entry.pic_info_map .map(this->channel.get_fd()));
-        NJ_TRY_RET(entry.read_data_map.map(this->channel.get_fd()));
-        NJ_TRY_RET(entry.scan_data_map.map(this->channel.get_fd()));
+    if (auto rc = mmuRequestInitialize(&this->request, MmuModuleId_Nvjpg, 8, false); rc) {
+        this->channel.close();
+        return rc;
     }
-
-    NJ_TRY_RET(mmuRequestInitialize(&this->request, MmuModuleId_Nvjpg, 8, false));
 #else
     NJ_TRY_ERRNO(this->channel.open("/dev/nvhost-nvjpg"));
+#endif
 
-    for (auto &entry: this->entries) {
-        NJ_TRY_ERRNO(entry.cmdbuf_map   .map());
-        NJ_TRY_ERRNO(entry.pic_info_map .map());
-        NJ_TRY_ERRNO(entry.read_data_map.map());
-        NJ_TRY_ERRNO(entry.scan_data_map.map());
-    }
+    auto rc = this->initialize_buffers(capacity);
+    if (rc) {
+        this->map_arena .finalize();
+        this->scan_arena.finalize();
+
+        this->channel.close();
+#ifdef __SWITCH__
+        mmuRequestFinalize(&this->request);
 #endif
+    }
 
-    this->next_entry = this->entries.begin();
+    return rc;
+}
 
-    return 0;
+Result Decoder::initialize_buffers(std::size_t capacity) {
+    // The small buffers of all entries share a single block. They are relocated with a shift of 8,
+    // so each starts on a 256-byte boundary
+    constexpr std::uint32_t align = 0x100;
+    constexpr std::uint32_t entry_size = align_up(Decoder::cmdbuf_size, align) +
+        align_up(std::uint32_t(sizeof(NvjpgPictureInfo)), align) + align_up(std::uint32_t(sizeof(NvjpgStatus)), align);
+
+    NJ_TRY_RET(this->map_arena.initialize(this->channel.get_fd(), entry_size * this->entries.size()));
+    for (auto &entry: this->entries) {
+        NJ_TRY_RET(this->map_arena.allocate(Decoder::cmdbuf_size,     align, entry.cmdbuf_region));
+        NJ_TRY_RET(this->map_arena.allocate(sizeof(NvjpgPictureInfo), align, entry.pic_info_region));
+        NJ_TRY_RET(this->map_arena.allocate(sizeof(NvjpgStatus),      align, entry.read_data_region));
+    }
+
+    return this->scan_arena.initialize(capacity, this->entries.size(), this->channel.get_fd());
 }
 
 Result Decoder::finalize() {
-    for (auto &entry: this->entries) {
-        NJ_TRY_RET(entry.cmdbuf_map   .free());
-        NJ_TRY_RET(entry.pic_info_map .free());
-        NJ_TRY_RET(entry.read_data_map.free());
-        NJ_TRY_RET(entry.scan_data_map.free());
+    NJ_TRY_RET(this->stop_completion_thread());
+
+    if (this->backend == Backend::Software) {
+        this->entries.clear();
+        return 0;
     }
 
+    NJ_TRY_RET(this->map_arena .finalize());
+    NJ_TRY_RET(this->scan_arena.finalize());
+
 #ifdef __SWITCH__
     NJ_TRY_RET(this->channel.close());
 
@@ -118,31 +171,50 @@ Result Decoder::finalize() {
 }
 
 Result Decoder::resize(std::size_t capacity) {
-    for (auto &entry: this->entries) {
-        NJ_TRY_RET(entry.scan_data_map.free());
-        NJ_TRY_RET(entry.scan_data_map.allocate(capacity, 0x1000, 0x1));
+    if (this->backend == Backend::Software)
+        return 0;
 
-#ifdef __SWITCH__
-        NJ_TRY_RET(entry.scan_data_map.map(this->channel.get_fd()));
-#else
-        NJ_TRY_ERRNO(entry.scan_data_map.map());
-#endif
-    }
+    return this->scan_arena.resize(capacity);
+}
 
-    return 0;
+std::tuple<const NvMap &, std::uint32_t> Decoder::get_scan_buffer(const RingEntry &entry, const Image &image) {
+    if (auto *map = image.get_map(); map)
+        return { *map, image.get_scan_offset() };
+    return { *entry.scan_allocation.map, entry.scan_allocation.offset };
 }
 
-Decoder::RingEntry &Decoder::get_ring_entry() const {
+Decoder::RingEntry &Decoder::get_ring_entry() {
     auto &entry = *this->next_entry;
 
-    if (entry.fence.value != -1u)
-        NvHostCtrl::wait(entry.fence, -1);
+    NJ_TRACE_SPAN("entry_wait", this->get_entry_index(entry), entry.image_id);
+
+    if (this->completion_thread.joinable()) {
+        std::unique_lock lk(this->completion_mutex);
+        if (this->retired_handle < entry.handle) {
+            this->metrics.ring_stalls.add();
+            ScopedTimer timer(this->metrics.ring_stall_ns);
+            this->retired_cv.wait(lk, [this, &entry] { return this->retired_handle >= entry.handle; });
+        }
+        return entry;
+    }
+
+    if (entry.fence.value != -1u && entry.fence.id != Decoder::sw_syncpt_id) {
+        // Polling first tells stalls apart from entries whose render already completed
+        if (!NvHostCtrl::poll(entry.fence)) {
+            this->metrics.ring_stalls.add();
+            ScopedTimer timer(this->metrics.ring_stall_ns);
+            NvHostCtrl::wait(entry.fence, -1);
+        }
+        this->record_status(entry);
+    }
 
     return entry;
 }
 
 NvjpgPictureInfo *Decoder::build_picture_info_common(RingEntry &entry, const Image &image, std::uint32_t downscale) {
-    auto *info = static_cast<NvjpgPictureInfo *>(entry.pic_info_map.address());
+    NJ_TRACE_SPAN("picture_info", this->get_entry_index(entry), image.get_id());
+
+    auto *info = static_cast<NvjpgPictureInfo *>(entry.pic_info_region.address());
     std::memset(info, 0, sizeof(NvjpgPictureInfo));
 
     if (downscale)
@@ -185,7 +257,7 @@ NvjpgPictureInfo *Decoder::build_picture_info_common(RingEntry &entry, const Ima
     info->num_mcu_h             = (image.width + image.mcu_size_horiz - 1) / image.mcu_size_horiz;
     info->num_mcu_v             = (image.height + image.mcu_size_vert - 1) / image.mcu_size_vert;
     info->num_components        = image.num_components;
-    info->scan_data_offset      = 0;
+    info->scan_data_offset      = std::get<1>(Decoder::get_scan_buffer(entry, image)) & 0xff;
     info->scan_data_size        = image.get_scan_data().size();
     info->scan_data_samp_layout = static_cast<std::uint32_t>(image.sampling);
     info->alpha                 = 0;
@@ -194,157 +266,690 @@ NvjpgPictureInfo *Decoder::build_picture_info_common(RingEntry &entry, const Ima
     return info;
 }
 
-Result Decoder::render_common(RingEntry &entry, const Image &image, SurfaceBase &surf) {
-    if (image.progressive)
-        return EINVAL;
+Result Decoder::complete_software(RingEntry &entry, SurfaceBase &surf, Handle *handle) {
+    entry.fence = surf.render_fence = {
+        .id    = Decoder::sw_syncpt_id,
+        .value = ++this->sw_fence_value,
+    };
+    surf.render_entry = this->get_entry_index(entry);
+    this->track_render(entry, surf, handle);
+
+    if (++this->next_entry == this->entries.end())
+        this->next_entry = this->entries.begin();
+
+    return 0;
+}
+
+void Decoder::track_render(RingEntry &entry, const SurfaceBase &surf, Handle *handle) {
+    this->metrics.renders.add();
+
+    std::unique_lock lk(this->completion_mutex);
+
+    entry.handle    = ++this->last_handle;
+    entry.submit_ns = Tracer::is_enabled() ? Tracer::now() : 0;
+    if (handle)
+        *handle = entry.handle;
+
+    if (this->completion_thread.joinable()) {
+        this->pending.push_back({ entry.handle, &entry, &surf, entry.fence, next_waiter });
+        this->pending_cv.notify_one();
+    } else {
+        this->retired_handle = entry.handle;
+    }
+}
+
+Decoder::~Decoder() {
+    this->stop_completion_thread();
+}
+
+Result Decoder::start_completion_thread(CompletionCallback callback) {
+    if (this->completion_thread.joinable())
+        return EBUSY;
+
+    // Renders submitted until now were never handed to the thread, make sure their entries are free
+    for (auto &entry: this->entries) {
+        if (entry.fence.value != -1u && entry.fence.id != Decoder::sw_syncpt_id) {
+            NvHostCtrl::wait(entry.fence, -1);
+            this->record_status(entry);
+        }
+    }
+
+#ifndef __SWITCH__
+    if (!callback) {
+        this->completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (this->completion_fd < 0)
+            return errno;
+    }
+#endif
 
+    this->completion_callback = std::move(callback);
+    this->completion_stop     = false;
+    this->completion_thread   = std::thread(&Decoder::completion_thread_main, this);
+    return 0;
+}
+
+Result Decoder::stop_completion_thread() {
+    if (!this->completion_thread.joinable())
+        return 0;
+
+    {
+        std::scoped_lock lk(this->completion_mutex);
+        this->completion_stop = true;
+    }
+    this->pending_cv.notify_one();
+
+    this->completion_thread.join();
+
+#ifndef __SWITCH__
+    if (this->completion_fd >= 0)
+        ::close(this->completion_fd), this->completion_fd = -1;
+#endif
+
+    return 0;
+}
+
+void Decoder::completion_thread_main() {
+    std::unique_lock lk(this->completion_mutex);
+    while (true) {
+        this->pending_cv.wait(lk, [this] { return this->completion_stop || !this->pending.empty(); });
+        if (this->pending.empty())
+            return;
+
+        auto render = this->pending.front();
+        lk.unlock();
+
+        // Renders complete in submission order, so waiting on them one after the other loses no time
+        Completion completion = {
+            .handle = render.handle,
+            .surf   = render.surf,
+            .rc     = 0,
+            .status = render.entry->sw_status,
+        };
+
+        auto entry_index = this->get_entry_index(*render.entry);
+        if (render.fence.id != Decoder::sw_syncpt_id) {
+            {
+                NJ_TRACE_SPAN("fence_wait", entry_index, render.entry->image_id);
+                ScopedTimer timer(this->metrics.fence_wait_ns);
+                completion.rc = NvHostCtrl::wait(render.fence, -1);
+            }
+
+            completion.status = *static_cast<NvjpgStatus *>(render.entry->read_data_region.address());
+            if (!completion.rc)
+                this->record_status(*render.entry);
+        }
+
+        // From submission to the completion being observed
+        if (render.entry->submit_ns)
+            Tracer::record("in_flight", render.entry->submit_ns, Tracer::now(), entry_index, render.entry->image_id);
+
+        NJ_TRACE_SPAN("completion", entry_index, render.entry->image_id);
+
+        lk.lock();
+        this->pending.pop_front();
+        this->retired_handle = render.handle;
+        this->retired_cv.notify_all();
+
+        if (render.waiter) {
+            // The waiter lives in the coroutine frame, and can go away as soon as the coroutine is resumed
+            render.waiter->completion = completion;
+            auto coro = render.waiter->coro;
+
+            lk.unlock();
+            if (this->resume_executor)
+                this->resume_executor(coro);
+            else
+                coro.resume();
+            lk.lock();
+        } else if (this->completion_callback) {
+            lk.unlock();
+            this->completion_callback(completion);
+            lk.lock();
+        } else {
+            this->completions.push_back(completion);
+            this->completed_cv.notify_all();
+
+#ifndef __SWITCH__
+            // Signaled after queuing, so that a reader woken by it finds the completion
+            std::uint64_t count = 1;
+            [[maybe_unused]] auto rc = ::write(this->completion_fd, &count, sizeof(count));
+#endif
+        }
+    }
+}
+
+bool Decoder::poll_completion(Completion &completion) {
+    std::scoped_lock lk(this->completion_mutex);
+    if (this->completions.empty())
+        return false;
+
+    completion = this->completions.front();
+    this->completions.pop_front();
+    return true;
+}
+
+Result Decoder::wait_completion(Completion &completion, std::int32_t timeout_us) {
+    std::unique_lock lk(this->completion_mutex);
+
+    // Nothing will come if no render is in flight
+    auto is_ready = [this] { return !this->completions.empty() || this->pending.empty(); };
+    if (timeout_us < 0)
+        this->completed_cv.wait(lk, is_ready);
+    else if (!this->completed_cv.wait_for(lk, std::chrono::microseconds(timeout_us), is_ready))
+        return ETIMEDOUT;
+
+    if (this->completions.empty())
+        return ENODATA;
+
+    completion = this->completions.front();
+    this->completions.pop_front();
+    return 0;
+}
+
+template <typename Job>
+bool Decoder::suspend_render(Waiter &waiter, std::coroutine_handle<> coro, const Job &job) {
+    auto render = job;
+    render.handle = &waiter.completion.handle;
+
+    waiter.coro       = coro;
+    waiter.completion = {
+        .handle = 0,
+        .surf   = &job.surf,
+        .rc     = 0,
+        .status = {},
+    };
+
+    // Nothing would resume the coroutine, complete the render in place
+    if (!this->completion_thread.joinable()) {
+        auto &rc = waiter.completion.rc;
+        rc = this->render(std::span(&render, 1));
+        if (!rc)
+            rc = this->wait(job.surf);
+
+        if (auto idx = this->find_entry(job.surf); !rc && idx >= 0) {
+            auto &entry = this->entries[idx];
+            waiter.completion.status = (entry.fence.id == Decoder::sw_syncpt_id) ?
+                entry.sw_status : *static_cast<NvjpgStatus *>(entry.read_data_region.address());
+        }
+        return false;
+    }
+
+    // Past a successful render, the coroutine may already be running on another thread, and the waiter gone
+    next_waiter = &waiter;
+    auto rc = this->render(std::span(&render, 1));
+    next_waiter = nullptr;
+
+    if (rc) {
+        waiter.completion.rc = rc;
+        return false;
+    }
+
+    return true;
+}
+
+template bool Decoder::suspend_render(Waiter &waiter, std::coroutine_handle<> coro, const RenderJob      &job);
+template bool Decoder::suspend_render(Waiter &waiter, std::coroutine_handle<> coro, const VideoRenderJob &job);
+
+Result Decoder::prepare_common(RingEntry &entry, const Image &image, SurfaceBase &surf) {
     if (image.width == 0 || image.height == 0)
         return EINVAL;
 
+    if (surf.width == 0 || surf.height == 0)
+        return EINVAL;
+
     if (image.num_components == 1 && (image.components[0].sampling_horiz != 1 || image.components[0].sampling_vert != 1))
         return EINVAL;
 
-    auto scan_data = image.get_scan_data();
+#ifdef __SWITCH__
+    if (auto &map = surf.get_target_map(); !map.iova())
+        NJ_TRY_RET(map.map(this->channel.get_fd()));
+
+    if (auto *map = image.get_map(); map && !map->iova())
+        NJ_TRY_RET(map->map(this->channel.get_fd()));
+#endif
+
+    entry.image_id = image.get_id();
+
+    // Images held in a device buffer are read in place, others are copied to the arena
+    entry.scan_allocation = {};
+    if (!image.get_map()) {
+        NJ_TRACE_SPAN("scan_copy", this->get_entry_index(entry), image.get_id());
+        auto scan_data = image.get_scan_data();
+
+        NJ_TRY_RET(this->scan_arena.allocate(scan_data.size(), entry.scan_allocation));
+        std::copy(scan_data.begin(), scan_data.end(),
+            static_cast<std::uint8_t *>(entry.scan_allocation.map->address()) + entry.scan_allocation.offset);
+        this->metrics.scan_bytes_copied.add(scan_data.size());
+    }
+
+    entry.scan_size = image.get_scan_data().size();
+    return 0;
+}
+
+void Decoder::record_status(RingEntry &entry) {
+    if (!entry.unrecorded_status)
+        return;
+
+    entry.unrecorded_status = false;
+
+    auto used_bytes = static_cast<NvjpgStatus *>(entry.read_data_region.address())->used_bytes;
+    this->metrics.used_bytes.add(used_bytes);
+    this->metrics.unused_scan_bytes.record(entry.scan_size > used_bytes ? entry.scan_size - used_bytes : 0);
+}
 
-    if (scan_data.size() > entry.scan_data_map.size())
-        return ENOMEM;
+Result Decoder::prepare_render(RingEntry &entry, const Image &image, const RenderJob &job) {
+    NJ_TRY_RET(this->prepare_common(entry, image, job.surf));
 
-    std::copy_n(scan_data.begin(), std::min(scan_data.size(), entry.scan_data_map.size()),
-        static_cast<std::uint8_t *>(entry.scan_data_map.address()));
+    auto &surf = job.surf;
 
+    auto *info = this->build_picture_info_common(entry, image, job.downscale);
+    info->out_data_samp_layout  = static_cast<std::uint32_t>(image.sampling);
+    info->out_surf_type         = static_cast<std::uint32_t>(surf.type);
+    info->out_luma_surf_pitch   = surf.pitch;
+    info->out_chroma_surf_pitch = 0;
+    info->alpha                 = job.alpha;
+    info->memory_mode           = static_cast<std::uint32_t>(surf.get_memory_mode());
+    info->yuv2rgb_kernel        = get_yuv2rgb_kernel(this->colorspace);
+
+    return 0;
+}
+
+Result Decoder::prepare_render(RingEntry &entry, const Image &image, const VideoRenderJob &job) {
+    NJ_TRY_RET(this->prepare_common(entry, image, job.surf));
+
+    auto &surf = job.surf;
+
+    auto sampling = (image.num_components == 1) ? SamplingFormat::Monochrome : surf.sampling;
+
+    auto *info = this->build_picture_info_common(entry, image, job.downscale);
+    info->out_data_samp_layout  = static_cast<std::uint32_t>(sampling);
+    info->out_surf_type         = static_cast<std::uint32_t>(surf.type);
+    info->out_luma_surf_pitch   = surf.luma_pitch;
+    info->out_chroma_surf_pitch = surf.chroma_pitch;
+    info->memory_mode           = static_cast<std::uint32_t>(surf.get_memory_mode());
+
+    return 0;
+}
+
+Decoder::RenderSlots Decoder::push_render(CmdBuf &cmdbuf, RingEntry &entry, const Image &image, const RenderJob &job) {
+    auto [scan_map, scan_offset] = Decoder::get_scan_buffer(entry, image);
+    RenderSlots slots;
+
+    cmdbuf.begin(Decoder::class_id);
+    cmdbuf.push_value(NJ_REGPOS(NvjpgRegisters, operation_type),      1);
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, picture_info_offset), *entry.pic_info_region.map,  entry.pic_info_region.offset);
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, read_info_offset),    *entry.read_data_region.map, entry.read_data_region.offset);
+    slots[0] =
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, scan_data_offset),    scan_map, align_down(scan_offset, 0x100u));
+    slots[1] =
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, out_data_offset),     job.surf.get_map(), job.surf.get_offset());
+    cmdbuf.push_value(NJ_REGPOS(NvjpgRegisters, execute),             0x100);
+    this->push_syncpt_incr(cmdbuf);
+    cmdbuf.end();
+
+    return slots;
+}
+
+Decoder::RenderSlots Decoder::push_render(CmdBuf &cmdbuf, RingEntry &entry, const Image &image, const VideoRenderJob &job) {
+    auto [scan_map, scan_offset] = Decoder::get_scan_buffer(entry, image);
+    auto &surf = job.surf;
+    auto chromab_offset = surf.get_offset() + (surf.chromab_data - surf.data());
+    auto chromar_offset = surf.get_offset() + (surf.chromar_data - surf.data());
+    RenderSlots slots;
+
+    cmdbuf.begin(Decoder::class_id);
+    cmdbuf.push_value(NJ_REGPOS(NvjpgRegisters, operation_type),      1);
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, picture_info_offset), *entry.pic_info_region.map,  entry.pic_info_region.offset);
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, read_info_offset),    *entry.read_data_region.map, entry.read_data_region.offset);
+    slots[0] =
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, scan_data_offset),    scan_map, align_down(scan_offset, 0x100u));
+    slots[1] =
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, out_data_offset),     surf.get_map(), surf.get_offset());
+    slots[2] =
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, out_data_2_offset),   surf.get_map(), chromab_offset);
+    slots[3] =
+    cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, out_data_3_offset),   surf.get_map(), chromar_offset);
+    cmdbuf.push_value(NJ_REGPOS(NvjpgRegisters, execute),             0x100);
+    this->push_syncpt_incr(cmdbuf);
+    cmdbuf.end();
+
+    return slots;
+}
+
+void Decoder::patch_render(CmdBuf &cmdbuf, const RenderSlots &slots, RingEntry &entry, const Image &image,
+        const RenderJob &job) {
+    auto [scan_map, scan_offset] = Decoder::get_scan_buffer(entry, image);
+
+    cmdbuf.patch_reloc(slots[0], scan_map, align_down(scan_offset, 0x100u));
+    cmdbuf.patch_reloc(slots[1], job.surf.get_map(), job.surf.get_offset());
+}
+
+void Decoder::patch_render(CmdBuf &cmdbuf, const RenderSlots &slots, RingEntry &entry, const Image &image,
+        const VideoRenderJob &job) {
+    auto [scan_map, scan_offset] = Decoder::get_scan_buffer(entry, image);
+    auto &surf = job.surf;
+    auto chromab_offset = surf.get_offset() + (surf.chromab_data - surf.data());
+    auto chromar_offset = surf.get_offset() + (surf.chromar_data - surf.data());
+
+    cmdbuf.patch_reloc(slots[0], scan_map, align_down(scan_offset, 0x100u));
+    cmdbuf.patch_reloc(slots[1], surf.get_map(), surf.get_offset());
+    cmdbuf.patch_reloc(slots[2], surf.get_map(), chromab_offset);
+    cmdbuf.patch_reloc(slots[3], surf.get_map(), chromar_offset);
+}
+
+void Decoder::push_syncpt_incr(CmdBuf &cmdbuf) const {
     // Add syncpt increment to signal the end of the processing of our commands
-    entry.cmdbuf.begin(Decoder::class_id);
-    entry.cmdbuf.push_raw(OpcodeNonIncr(NJ_REGPOS(ThiRegisters, incr_syncpt), 1));
-    entry.cmdbuf.push_raw(this->channel.get_syncpt() | (true << 8)); // Condition: 0 = immediate, 1 = when done
-    entry.cmdbuf.end();
+    cmdbuf.push_raw(OpcodeNonIncr(NJ_REGPOS(ThiRegisters, incr_syncpt), 1));
+    cmdbuf.push_raw(this->channel.get_syncpt() | (true << 8)); // Condition: 0 = immediate, 1 = when done
+}
 
+Result Decoder::submit(CmdBuf &cmdbuf, std::uint32_t num_incrs, nvhost_ctrl_fence &fence) {
     std::array incrs = {
         nvhost_syncpt_incr{
             .syncpt_id    = this->channel.get_syncpt(),
-            .syncpt_incrs = 1,
+            .syncpt_incrs = num_incrs,
         },
     };
 
-    auto render_fence = nvhost_ctrl_fence{
+    fence = {
         .id    = this->channel.get_syncpt(),
         .value = 0,
     };
 
 #ifdef __SWITCH__
-    NJ_TRY_RET(this->channel.submit(entry.cmdbuf.get_bufs(), {}, {}, incrs, std::span(&render_fence, 1)));
+    return this->channel.submit(cmdbuf.get_bufs(), {}, {}, incrs, std::span(&fence, 1));
 #else
     std::array fences = {
         0u,
     };
 
-    auto &&[cmdbufs, exts,   class_ids] = entry.cmdbuf.get_bufs();
-    auto &&[relocs,  shifts, types]     = entry.cmdbuf.get_relocs();
+    auto &&[cmdbufs, exts,   class_ids] = cmdbuf.get_bufs();
+    auto &&[relocs,  shifts, types]     = cmdbuf.get_relocs();
 
-    NJ_TRY_RET(this->channel.submit(cmdbufs, exts, class_ids, relocs, shifts, types, incrs, fences, render_fence));
+    return this->channel.submit(cmdbufs, exts, class_ids, relocs, shifts, types, incrs, fences, fence);
 #endif
+}
 
-    entry.fence = surf.render_fence = render_fence;
+template <typename Job>
+Result Decoder::render_batch(std::span<const Job> jobs) {
+    constexpr std::size_t max_chunk_size = CmdBuf::max_bufs;
+
+    // Every render in flight needs its own picture info, status and scan buffers, so a submission
+    // covers at most as many renders as there are ring entries
+    while (!jobs.empty()) {
+        auto chunk = jobs.first(std::min({ jobs.size(), this->entries.size(), max_chunk_size }));
+        jobs = jobs.subspan(chunk.size());
+
+        std::array<RingEntry *, max_chunk_size> chunk_entries;
+        for (std::size_t i = 0; i < chunk.size(); ++i) {
+            chunk_entries[i] = &this->get_ring_entry();
+            if (++this->next_entry == this->entries.end())
+                this->next_entry = this->entries.begin();
+        }
 
-    if (++this->next_entry == this->entries.end())
-        this->next_entry = this->entries.begin();
+        // Commands for the whole chunk go in the buffer of its last entry. Once that entry is reused,
+        // the syncpoint has gone past the chunk, and the buffer is no longer read
+        auto &owner  = *chunk_entries[chunk.size() - 1];
+        auto &cmdbuf = owner.cmdbuf;
+
+        // Scan space taken by the chunk is given back if it doesn't get submitted
+        NJ_SCOPEGUARD([this] { this->scan_arena.cancel(); });
+
+        // A single render to the same kind of surface as the previous one in this buffer leaves the command stream
+        // identical except for the scan data and output relocations, which get patched in place
+        constexpr auto kind = std::is_same_v<Job, RenderJob> ? CmdBufTemplate::Surface : CmdBufTemplate::VideoSurface;
+        bool reuse = this->use_cmdbuf_templates && (chunk.size() == 1) && (owner.cmdbuf_template == kind);
+        if (!reuse) {
+            cmdbuf.clear();
+            owner.cmdbuf_template = CmdBufTemplate::None;
+        }
+
+        for (std::size_t i = 0; i < chunk.size(); ++i) {
+            auto &job = chunk[i];
+
+            // The engine only handles baseline streams
+            // Transcoded scans are copied to the ring entry, so the temporary doesn't need to outlive the iteration
+            auto *image = &job.image;
+            Image baseline;
+            if (image->progressive) {
+                NJ_TRACE_SPAN("transcode", this->get_entry_index(*chunk_entries[i]), image->get_id());
+                NJ_TRY_RET(this->transcoder.transcode(*image, baseline));
+                image = &baseline;
+            }
+
+            NJ_TRY_RET(this->prepare_render(*chunk_entries[i], *image, job));
+
+            NJ_TRACE_SPAN("cmdbuf", this->get_entry_index(*chunk_entries[i]), image->get_id());
+            if (reuse)
+                this->patch_render(cmdbuf, owner.template_slots, *chunk_entries[i], *image, job);
+            else
+                owner.template_slots = this->push_render(cmdbuf, *chunk_entries[i], *image, job);
+        }
+
+        if (chunk.size() == 1)
+            owner.cmdbuf_template = kind;
+
+        nvhost_ctrl_fence fence;
+        {
+            NJ_TRACE_SPAN("submit", this->get_entry_index(owner), owner.image_id);
+            ScopedTimer timer(this->metrics.submit_ns);
+            NJ_TRY_RET(this->submit(cmdbuf, chunk.size(), fence));
+        }
+        this->metrics.submits.add();
+
+        // Each render increments the syncpoint once, in order
+        for (std::size_t i = 0; i < chunk.size(); ++i) {
+            auto &entry = *chunk_entries[i];
+            entry.fence = chunk[i].surf.render_fence = {
+                .id    = fence.id,
+                .value = fence.value - static_cast<std::uint32_t>(chunk.size() - 1 - i),
+            };
+            chunk[i].surf.render_entry = this->get_entry_index(entry);
+            entry.unrecorded_status = true;
+            if (entry.scan_allocation.map)
+                this->scan_arena.commit(entry.fence);
+            this->metrics.scan_bytes.add(entry.scan_size);
+            this->track_render(entry, chunk[i].surf, chunk[i].handle);
+        }
+    }
 
     return 0;
 }
 
-Result Decoder::render(const Image &image, Surface &surf, std::uint8_t alpha, std::uint32_t downscale) {
-#ifdef __SWITCH__
-    if (!surf.map.iova())
-        NJ_TRY_RET(surf.map.map(this->channel.get_fd()));
-#endif
+Result Decoder::render(std::span<const RenderJob> jobs) {
+    if (this->backend == Backend::Software) {
+        for (auto &job: jobs) {
+            auto &entry = this->get_ring_entry();
+            entry.image_id = job.image.get_id();
 
-    if (surf.width == 0 || surf.height == 0)
-        return EINVAL;
+            NJ_TRACE_SPAN("sw_render", this->get_entry_index(entry), entry.image_id);
+            NJ_TRY_RET(this->sw_decoder.render(job.image, job.surf, get_yuv2rgb_kernel(this->colorspace),
+                job.alpha, job.downscale, &entry.sw_status));
+            NJ_TRY_RET(this->complete_software(entry, job.surf, job.handle));
+        }
+        return 0;
+    }
 
-    auto &entry = this->get_ring_entry();
+    return this->render_batch(jobs);
+}
 
-    auto *info = this->build_picture_info_common(entry, image, downscale);
-    info->out_data_samp_layout  = static_cast<std::uint32_t>(image.sampling);
-    info->out_surf_type         = static_cast<std::uint32_t>(surf.type);
-    info->out_luma_surf_pitch   = surf.pitch;
-    info->out_chroma_surf_pitch = 0;
-    info->alpha                 = alpha;
-    info->memory_mode           = static_cast<std::uint32_t>(surf.get_memory_mode());
+Result Decoder::render(std::span<const VideoRenderJob> jobs) {
+    if (this->backend == Backend::Software) {
+        for (auto &job: jobs) {
+            auto &entry = this->get_ring_entry();
+            entry.image_id = job.image.get_id();
 
-    switch (this->colorspace) {
-        case ColorSpace::BT601:
-            info->yuv2rgb_kernel = kernel_bt601;
-            break;
-        case ColorSpace::BT709:
-            info->yuv2rgb_kernel = kernel_bt709;
-            break;
-        case ColorSpace::BT601Ex:
-        default:
-            info->yuv2rgb_kernel = kernel_bt601ex;
-            break;
+            NJ_TRACE_SPAN("sw_render", this->get_entry_index(entry), entry.image_id);
+            NJ_TRY_RET(this->sw_decoder.render(job.image, job.surf, job.downscale, &entry.sw_status));
+            NJ_TRY_RET(this->complete_software(entry, job.surf, job.handle));
+        }
+        return 0;
     }
 
-    entry.cmdbuf.clear();
-    entry.cmdbuf.begin(Decoder::class_id);
-    entry.cmdbuf.push_value(NJ_REGPOS(NvjpgRegisters, operation_type),      1);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, picture_info_offset), entry.pic_info_map);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, read_info_offset),    entry.read_data_map);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, scan_data_offset),    entry.scan_data_map);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, out_data_offset),     surf.get_map());
-    entry.cmdbuf.push_value(NJ_REGPOS(NvjpgRegisters, execute),             0x100);
-    entry.cmdbuf.end();
+    return this->render_batch(jobs);
+}
 
-    return this->render_common(entry, image, surf);
+Result Decoder::render(const Image &image, Surface &surf, std::uint8_t alpha, std::uint32_t downscale, Handle *handle) {
+    auto job = RenderJob{ image, surf, alpha, downscale, handle };
+    return this->render(std::span(&job, 1));
 }
 
-Result Decoder::render(const Image &image, VideoSurface &surf, std::uint32_t downscale) {
-#ifdef __SWITCH__
-    if (!surf.map.iova())
-        NJ_TRY_RET(surf.map.map(this->channel.get_fd()));
-#endif
+Result Decoder::render(const Image &image, VideoSurface &surf, std::uint32_t downscale, Handle *handle) {
+    auto job = VideoRenderJob{ image, surf, downscale, handle };
+    return this->render(std::span(&job, 1));
+}
 
-    if (surf.width == 0 || surf.height == 0)
-        return EINVAL;
+std::int32_t Decoder::find_entry(const SurfaceBase &surf) const {
+    auto idx = surf.render_entry;
+    if (idx < 0 || static_cast<std::size_t>(idx) >= this->entries.size())
+        return -1;
 
-    auto &entry = this->get_ring_entry();
+    auto &fence = this->entries[idx].fence;
+    if ((fence.id != surf.render_fence.id) || (fence.value != surf.render_fence.value))
+        return -1;
 
-    auto sampling = (image.num_components == 1) ? SamplingFormat::Monochrome : surf.sampling;
+    return idx;
+}
 
-    auto *info = this->build_picture_info_common(entry, image, downscale);
-    info->out_data_samp_layout  = static_cast<std::uint32_t>(sampling);
-    info->out_surf_type         = static_cast<std::uint32_t>(surf.type);
-    info->out_luma_surf_pitch   = surf.luma_pitch;
-    info->out_chroma_surf_pitch = surf.chroma_pitch;
-    info->memory_mode           = static_cast<std::uint32_t>(surf.get_memory_mode());
+void Decoder::finish_wait(RingEntry &entry, std::size_t *num_read_bytes) {
+    if (entry.fence.id == Decoder::sw_syncpt_id) {
+        if (num_read_bytes)
+            *num_read_bytes = entry.sw_status.used_bytes;
+        return;
+    }
 
-    entry.cmdbuf.clear();
-    entry.cmdbuf.begin(Decoder::class_id);
-    entry.cmdbuf.push_value(NJ_REGPOS(NvjpgRegisters, operation_type),      1);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, picture_info_offset), entry.pic_info_map);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, read_info_offset),    entry.read_data_map);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, scan_data_offset),    entry.scan_data_map);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, out_data_offset),     surf.get_map(), 0);
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, out_data_2_offset),   surf.get_map(), surf.chromab_data - surf.data());
-    entry.cmdbuf.push_reloc(NJ_REGPOS(NvjpgRegisters, out_data_3_offset),   surf.get_map(), surf.chromar_data - surf.data());
-    entry.cmdbuf.push_value(NJ_REGPOS(NvjpgRegisters, execute),             0x100);
-    entry.cmdbuf.end();
+    // Otherwise left to the completion thread, which owns the entries in flight
+    if (!this->completion_thread.joinable())
+        this->record_status(entry);
 
-    return this->render_common(entry, image, surf);
+    if (num_read_bytes)
+        *num_read_bytes = static_cast<NvjpgStatus *>(entry.read_data_region.address())->used_bytes;
 }
 
 Result Decoder::wait(const SurfaceBase &surf, std::size_t *num_read_bytes, std::int32_t timeout_us) {
-    auto it = std::find_if(this->entries.begin(), this->entries.end(),
-        [&surf](auto &entry) {
-            return (entry.fence.id == surf.render_fence.id) && (entry.fence.value == surf.render_fence.value);
+    auto idx = this->find_entry(surf);
+    if (idx < 0)
+        return 0;
+
+    auto &entry = this->entries[idx];
+    if (entry.fence.id != Decoder::sw_syncpt_id) {
+        NJ_TRACE_SPAN("fence_wait", idx, entry.image_id);
+        ScopedTimer timer(this->metrics.fence_wait_ns);
+        NJ_TRY_RET(NvHostCtrl::wait(entry.fence, timeout_us));
+    }
+
+    this->finish_wait(entry, num_read_bytes);
+    return 0;
+}
+
+bool Decoder::is_done(const SurfaceBase &surf) const {
+    // Entries are only reused once their render has completed
+    auto idx = this->find_entry(surf);
+    if (idx < 0)
+        return true;
+
+    auto &fence = this->entries[idx].fence;
+    return (fence.id == Decoder::sw_syncpt_id) || NvHostCtrl::poll(fence);
+}
+
+Result Decoder::try_wait(const SurfaceBase &surf, std::size_t *num_read_bytes) {
+    if (!this->is_done(surf))
+        return EAGAIN;
+
+    if (auto idx = this->find_entry(surf); idx >= 0)
+        this->finish_wait(this->entries[idx], num_read_bytes);
+    return 0;
+}
+
+Result Decoder::wait_all(std::span<const SurfaceBase * const> surfs, std::int32_t timeout_us) {
+    RingEntry *last = nullptr;
+    for (auto *surf: surfs) {
+        auto idx = this->find_entry(*surf);
+        if (idx < 0 || this->entries[idx].fence.id == Decoder::sw_syncpt_id)
+            continue;
+
+        auto &entry = this->entries[idx];
+        if (!last || !NvHostCtrl::is_reached(last->fence.value, entry.fence.value))
+            last = &entry;
+    }
+
+    if (last) {
+        NJ_TRACE_SPAN("fence_wait", this->get_entry_index(*last), last->image_id);
+        ScopedTimer timer(this->metrics.fence_wait_ns);
+        NJ_TRY_RET(NvHostCtrl::wait(last->fence, timeout_us));
+    }
+
+    for (auto *surf: surfs) {
+        if (auto idx = this->find_entry(*surf); idx >= 0)
+            this->finish_wait(this->entries[idx], nullptr);
+    }
+
+    return 0;
+}
+
+Result Decoder::wait_any(std::span<const SurfaceBase * const> surfs, std::size_t *index, std::int32_t timeout_us) {
+    if (surfs.empty())
+        return EINVAL;
+
+    RingEntry *first = nullptr;
+    std::size_t first_index = 0;
+    for (std::size_t i = 0; i < surfs.size(); ++i) {
+        auto idx = this->find_entry(*surfs[i]);
+
+        // Renders without a live entry, and software ones, are already complete
+        if (idx < 0 || this->entries[idx].fence.id == Decoder::sw_syncpt_id) {
+            if (idx >= 0)
+                this->finish_wait(this->entries[idx], nullptr);
+            if (index)
+                *index = i;
+            return 0;
         }
-    );
 
-    if (it == this->entries.end())
-        return 0;
+        auto &entry = this->entries[idx];
+        if (!first || !NvHostCtrl::is_reached(entry.fence.value, first->fence.value))
+            first = &entry, first_index = i;
+    }
 
-    NJ_TRY_RET(NvHostCtrl::wait(it->fence, timeout_us));
-    if (num_read_bytes)
-        *num_read_bytes = reinterpret_cast<NvjpgStatus *>(it->read_data_map.address())->used_bytes;
+    {
+        NJ_TRACE_SPAN("fence_wait", this->get_entry_index(*first), first->image_id);
+        ScopedTimer timer(this->metrics.fence_wait_ns);
+        NJ_TRY_RET(NvHostCtrl::wait(first->fence, timeout_us));
+    }
+
+    this->finish_wait(*first, nullptr);
+    if (index)
+        *index = first_index;
     return 0;
 }
 
+Decoder::Metrics Decoder::get_metrics() const {
+    return {
+        .renders           = this->metrics.renders          .get(),
+        .submits           = this->metrics.submits          .get(),
+        .ring_stalls       = this->metrics.ring_stalls      .get(),
+        .scan_arena_waits  = this->scan_arena.get_stats().num_waits,
+        .scan_arena_grows  = this->scan_arena.get_stats().num_grows,
+        .scan_bytes_copied = this->metrics.scan_bytes_copied.get(),
+        .scan_bytes        = this->metrics.scan_bytes       .get(),
+        .used_bytes        = this->metrics.used_bytes       .get(),
+        .clock_rate        = this->get_clock_rate(),
+        .ring_stall_ns     = this->metrics.ring_stall_ns    .snapshot(),
+        .submit_ns         = this->metrics.submit_ns        .snapshot(),
+        .fence_wait_ns     = this->metrics.fence_wait_ns    .snapshot(),
+        .unused_scan_bytes = this->metrics.unused_scan_bytes.snapshot(),
+    };
+}
+
+void Decoder::reset_metrics() {
+    for (auto *counter: { &this->metrics.renders, &this->metrics.submits, &this->metrics.ring_stalls,
+            &this->metrics.scan_bytes_copied, &this->metrics.scan_bytes, &this->metrics.used_bytes })
+        counter->reset();
+
+    for (auto *histogram: { &this->metrics.ring_stall_ns, &this->metrics.submit_ns, &this->metrics.fence_wait_ns,
+            &this->metrics.unused_scan_bytes })
+        histogram->reset();
+
+    this->scan_arena.reset_stats();
+}
+
 } // namespace nj
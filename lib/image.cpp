@@ -19,7 +19,15 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifndef __SWITCH__
+#   include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+
 #include <nvjpg/bitstream.hpp>
+#include <nvjpg/trace.hpp>
 #include <nvjpg/utils.hpp>
 
 namespace nj {
@@ -30,20 +38,121 @@ void skip_segment(JpegSegmentHeader seg, Bitstream &bs) {
     bs.skip(seg.size - sizeof(seg.size));
 }
 
+#ifndef __SWITCH__
+struct FileMapping {
+    void *address;
+    std::size_t size;
+
+    FileMapping(void *address, std::size_t size): address(address), size(size) { }
+
+    ~FileMapping() {
+        ::munmap(this->address, this->size);
+    }
+};
+#endif
+
 } // namespace
 
 Image::Image(int fd) {
-    struct stat st;
-    if (auto rc = ::fstat(fd, &st); rc == -1) {
+    this->valid = !this->load(fd);
+}
+
+Image::Image(std::string_view path) {
+    auto fd = ::open(path.data(), O_RDONLY);
+    if (fd == -1) {
         this->valid = false;
         return;
     }
 
-    this->data = std::make_shared<std::vector<std::uint8_t>>(st.st_size);
-    if (auto rc = ::read(fd, this->data->data(), this->data->size()); rc == -1) {
-        this->valid = false;
-        return;
+    // The mapping outlives the descriptor
+    this->valid = !this->load(fd);
+    ::close(fd);
+}
+
+int Image::load(int fd) {
+    struct stat st;
+    if (auto rc = ::fstat(fd, &st); rc == -1)
+        return errno;
+
+    auto size = static_cast<std::size_t>(st.st_size);
+
+#ifndef __SWITCH__
+    // Parse headers and upload scans straight from the page cache, instead of a heap copy of the file
+    // The mapping is private, pages are only duplicated if the data gets written to
+    if (S_ISREG(st.st_mode) && size) {
+        auto *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            // Headers are parsed first, then the scan is read front to back: start readahead now
+            ::madvise(addr, size, MADV_SEQUENTIAL);
+            ::madvise(addr, size, MADV_WILLNEED);
+
+            this->storage = std::make_shared<FileMapping>(addr, size);
+            this->data    = std::span(static_cast<std::uint8_t *>(addr), size);
+            return 0;
+        }
     }
+#endif
+
+    auto buf = std::make_shared<std::vector<std::uint8_t>>(size);
+    if (auto rc = ::read(fd, buf->data(), buf->size()); rc == -1)
+        return errno;
+
+    this->storage = buf;
+    this->data    = std::span(*buf);
+    return 0;
+}
+
+Result ImageReader::allocate(NvMap &map, std::size_t size) {
+    NJ_TRY_RET(map.allocate(align_up(size, std::size_t(0x1000)), 0x1000, 0x1));
+#ifndef __SWITCH__
+    if (map.map() == MAP_FAILED)
+        return errno;
+#endif
+    return 0;
+}
+
+Result ImageReader::read(int fd, Image &image) const {
+    struct stat st;
+    if (auto rc = ::fstat(fd, &st); rc == -1)
+        return errno;
+
+    bool is_regular = S_ISREG(st.st_mode) && st.st_size > 0;
+    auto capacity = is_regular ? static_cast<std::size_t>(st.st_size) : std::max(this->initial_capacity, std::size_t(1));
+
+    auto map = std::make_shared<NvMap>();
+    NJ_TRY_RET(ImageReader::allocate(*map, capacity));
+
+    std::size_t size = 0;
+    while (!is_regular || size < static_cast<std::size_t>(st.st_size)) {
+        if (size == map->size()) {
+            auto grown = std::make_shared<NvMap>();
+            NJ_TRY_RET(ImageReader::allocate(*grown, 2 * map->size()));
+            std::copy_n(static_cast<std::uint8_t *>(map->address()), size, static_cast<std::uint8_t *>(grown->address()));
+            map = std::move(grown);
+        }
+
+        auto rc = ::read(fd, static_cast<std::uint8_t *>(map->address()) + size, map->size() - size);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+            return errno;
+        if (rc == 0)
+            break;
+
+        size += rc;
+    }
+
+    image = Image(std::move(map), size);
+    return 0;
+}
+
+Result ImageReader::read(std::string_view path, Image &image) const {
+    auto fd = ::open(path.data(), O_RDONLY);
+    if (fd == -1)
+        return errno;
+    NJ_SCOPEGUARD([fd] { ::close(fd); });
+
+    return this->read(fd, image);
 }
 
 JpegSegmentHeader Image::find_next_segment(Bitstream &bs) {
@@ -178,13 +287,24 @@ int Image::parse_sos(JpegSegmentHeader seg, Bitstream &bs) {
         return ENODATA;
 
     auto num_comps = bs.get<std::uint8_t>();
-    if (num_comps != this->num_components)
+    if (num_comps == 0 || num_comps > this->num_components)
         return EINVAL;
 
+    // Baseline scans have to be interleaved, only progressive ones can code components separately
+    if (!this->progressive && num_comps != this->num_components)
+        return EINVAL;
+
+    this->num_scan_components = num_comps;
+
     for (std::size_t i = 0; i < num_comps; ++i) {
         auto id   = bs.get<std::uint8_t>() - 1;
         auto info = bs.get<std::uint8_t>();
 
+        if (id < 0 || id >= this->num_components)
+            return EINVAL;
+
+        this->scan_components[i] = id;
+
         this->components[id].hm_ac_table_id = info >> 0 & mask(4u);
         this->components[id].hm_dc_table_id = info >> 4 & mask(4u);
     }
@@ -192,26 +312,16 @@ int Image::parse_sos(JpegSegmentHeader seg, Bitstream &bs) {
     this->spectral_selection_lo = bs.get<std::uint8_t>();
     this->spectral_selection_hi = bs.get<std::uint8_t>();
 
-    bs.skip(1);
+    auto approx = bs.get<std::uint8_t>();
+    this->successive_approx_lo = approx >> 0 & mask(4u);
+    this->successive_approx_hi = approx >> 4 & mask(4u);
 
     return 0;
 }
 
-int Image::parse() {
-    if (!this->valid || !this->data)
-        return EINVAL;
-
-    auto bs = Bitstream(*this->data);
-
-    // Find SOI
-    JpegSegmentHeader seg;
-    do
-        seg = find_next_segment(bs);
-    while (!bs.empty() && (seg.marker != JpegMarker::Soi));
-    bs.rewind(sizeof(seg.size));
-
+int Image::parse_segments(Bitstream &bs) {
     while (!bs.empty()) {
-        seg = find_next_segment(bs);
+        auto seg = find_next_segment(bs);
         if (bs.empty())
             return ENODATA;
 
@@ -242,7 +352,7 @@ int Image::parse() {
 
             case JpegMarker::Sos:
                 NJ_TRY_RET(this->parse_sos(seg, bs));
-                this->scan_offset = bs.current() - this->data->begin();
+                this->scan_offset = bs.current() - this->data.data();
                 return 0;
 
             case JpegMarker::Eoi:
@@ -258,4 +368,45 @@ int Image::parse() {
     return ENODATA;
 }
 
+int Image::parse() {
+    if (!this->valid || this->data.empty())
+        return EINVAL;
+
+    static std::atomic_uint64_t next_id = 0;
+    this->id = next_id.fetch_add(1, std::memory_order_relaxed) + 1;
+    NJ_TRACE_SPAN("parse", -1, this->id);
+
+    auto bs = Bitstream(this->data);
+
+    // Find SOI
+    JpegSegmentHeader seg;
+    do
+        seg = find_next_segment(bs);
+    while (!bs.empty() && (seg.marker != JpegMarker::Soi));
+    bs.rewind(sizeof(seg.size));
+
+    return this->parse_segments(bs);
+}
+
+int Image::parse_next_scan() {
+    if (!this->valid || this->data.empty() || !this->scan_offset)
+        return EINVAL;
+
+    auto data = this->data;
+
+    // The entropy-coded segment ends at the first marker which isn't a stuffed byte, a fill byte or RSTn
+    auto pos = static_cast<std::size_t>(this->scan_offset);
+    for (; pos + 1 < data.size(); ++pos) {
+        if (data[pos] == 0xff && data[pos + 1] != 0x00 && data[pos + 1] != 0xff && (data[pos + 1] & 0xf8) != 0xd0)
+            break;
+    }
+
+    if (pos + 1 >= data.size() || data[pos + 1] == static_cast<std::uint8_t>(JpegMarker::Eoi))
+        return ENODATA;
+
+    auto bs = Bitstream(data);
+    bs.skip(pos);
+    return this->parse_segments(bs);
+}
+
 } // namespace nj
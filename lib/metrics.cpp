@@ -0,0 +1,98 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cmath>
+#include <algorithm>
+
+#include <nvjpg/metrics.hpp>
+
+namespace nj {
+
+std::uint64_t Histogram::get_bucket_lower(std::size_t bucket) {
+    if (bucket < num_sub_buckets)
+        return bucket;
+
+    auto exp = bucket / num_sub_buckets + sub_bucket_bits - 1;
+    auto sub = bucket % num_sub_buckets + num_sub_buckets;
+    return std::uint64_t(sub) << (exp - sub_bucket_bits);
+}
+
+std::uint64_t Histogram::get_bucket_upper(std::size_t bucket) {
+    if (bucket < num_sub_buckets)
+        return bucket;
+
+    auto exp = bucket / num_sub_buckets + sub_bucket_bits - 1;
+    return Histogram::get_bucket_lower(bucket) + ((std::uint64_t(1) << (exp - sub_bucket_bits)) - 1);
+}
+
+void Histogram::record(std::uint64_t value) {
+    this->counts[Histogram::get_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    this->count.fetch_add(1,     std::memory_order_relaxed);
+    this->sum  .fetch_add(value, std::memory_order_relaxed);
+
+    auto cur = this->min.load(std::memory_order_relaxed);
+    while (value < cur && !this->min.compare_exchange_weak(cur, value, std::memory_order_relaxed));
+
+    cur = this->max.load(std::memory_order_relaxed);
+    while (value > cur && !this->max.compare_exchange_weak(cur, value, std::memory_order_relaxed));
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snap;
+    for (std::size_t i = 0; i < num_buckets; ++i)
+        snap.counts[i] = this->counts[i].load(std::memory_order_relaxed);
+
+    snap.count = this->count.load(std::memory_order_relaxed);
+    snap.sum   = this->sum  .load(std::memory_order_relaxed);
+    snap.min   = snap.count ? this->min.load(std::memory_order_relaxed) : 0;
+    snap.max   = this->max  .load(std::memory_order_relaxed);
+    return snap;
+}
+
+void Histogram::reset() {
+    for (auto &count: this->counts)
+        count.store(0, std::memory_order_relaxed);
+
+    this->count.store(0, std::memory_order_relaxed);
+    this->sum  .store(0, std::memory_order_relaxed);
+    this->min  .store(std::numeric_limits<std::uint64_t>::max(), std::memory_order_relaxed);
+    this->max  .store(0, std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::Snapshot::percentile(double p) const {
+    // Bucket counts are the reference, the total may have moved on while they were read
+    std::uint64_t total = 0;
+    for (auto c: this->counts)
+        total += c;
+
+    if (!total)
+        return 0;
+
+    auto target = std::max(std::uint64_t(std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * total)), std::uint64_t(1));
+
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < num_buckets; ++i) {
+        seen += this->counts[i];
+        if (seen >= target)
+            return std::min(Histogram::get_bucket_upper(i), this->max);
+    }
+
+    return this->max;
+}
+
+} // namespace nj
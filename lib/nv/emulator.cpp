@@ -0,0 +1,850 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef __SWITCH__
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <nvjpg/nv/cmdbuf.hpp>
+#include <nvjpg/nv/ioctl_types.h>
+#include <nvjpg/nv/registers.hpp>
+#include <nvjpg/sw/decoder.hpp>
+#include <nvjpg/image.hpp>
+#include <nvjpg/surface.hpp>
+#include <nvjpg/utils.hpp>
+
+#include <nvjpg/nv/emulator.hpp>
+
+namespace nj {
+
+namespace {
+
+constexpr std::uint32_t default_clock_rate = 408'000'000;
+constexpr std::uint64_t iova_base          = 0x100000;
+
+enum class FileType {
+    NvMap,
+    NvHostCtrl,
+    NvJpg,
+};
+
+struct File {
+    FileType      type;
+    std::uint32_t syncpt     = 0;
+    std::uint32_t clock_rate = default_clock_rate;
+};
+
+struct Buffer {
+    std::uint32_t size  = 0;
+    std::uint32_t align = 0;
+    std::uint64_t iova  = 0;
+    std::uint8_t *data  = nullptr;      // Null until allocated
+    bool imported       = false;        // Data is owned by the caller
+};
+
+struct Syncpt {
+    std::uint32_t value = 0;            // Increments executed by the engine
+    std::uint32_t max   = 0;            // Increments submitted
+};
+
+struct Submission {
+    std::uint32_t syncpt = 0;
+    InlineVector<nvhost_cmdbuf, CmdBuf::max_bufs> cmdbufs;
+};
+
+int fail(int err) {
+    errno = err;
+    return -1;
+}
+
+// Fences compare modulo 2^32, like the hardware counters
+bool syncpt_reached(std::uint32_t value, std::uint32_t thresh) {
+    return static_cast<std::int32_t>(value - thresh) >= 0;
+}
+
+class Emulator {
+    public:
+        static Emulator &get() {
+            static Emulator emulator;
+            return emulator;
+        }
+
+        ~Emulator() {
+            this->stop_engine();
+
+            for (auto &[handle, buf]: this->buffers)
+                std::free(buf.data);
+        }
+
+        int open(const char *path, int flags);
+        int close(int fd);
+        int ioctl(int fd, unsigned long request, void *arg);
+        void *mmap(std::size_t len, int fd, off_t offset);
+
+        void set_throughput(double mpix_per_s) {
+            std::scoped_lock lk(this->mutex);
+            this->throughput = mpix_per_s;
+        }
+
+        NvEmulator::Stats get_stats() {
+            std::scoped_lock lk(this->mutex);
+            auto stats = this->stats;
+            stats.num_handles = this->buffers.size();
+            return stats;
+        }
+
+    private:
+        int nvmap_ioctl (unsigned long request, void *arg);
+        int ctrl_ioctl  (unsigned long request, void *arg);
+        int channel_ioctl(File &file, unsigned long request, void *arg);
+
+        int submit(File &file, nvhost_submit_args &args);
+
+        // Host address of a device range, checked against the bounds of the buffer holding it
+        std::span<std::uint8_t> resolve(std::uint64_t iova, std::size_t size);
+
+        void start_engine();
+        void stop_engine();
+        void engine_main();
+
+        // Engine side of a submission, called without the lock held
+        void execute(const Submission &submission);
+        void decode(const std::array<std::uint32_t, sizeof(NvjpgRegisters) / sizeof(std::uint32_t)> &regs);
+        void increment_syncpt(std::uint32_t id);
+
+    private:
+        std::mutex mutex;
+        std::condition_variable syncpt_cv, engine_cv;
+
+        std::map<int, File> files;
+        int next_fd = 3;
+
+        std::map<std::uint32_t, Buffer>        buffers;
+        std::map<std::uint64_t, std::uint32_t> iovas;      // Base address to handle
+        std::uint32_t next_handle = 1;
+        std::uint64_t next_iova   = iova_base;
+
+        std::vector<Syncpt> syncpts = std::vector<Syncpt>(1); // Id 0 is reserved
+
+        // Executed submissions are recycled, so that submitting doesn't allocate
+        std::thread engine;
+        std::list<Submission> queue, free_submissions;
+        bool engine_stop = false;
+        double throughput = 0;
+
+        NvEmulator::Stats stats = {};
+
+        // Owned by the engine thread
+        std::vector<CmdBuf::Word> words;
+        SoftwareDecoder sw_decoder;
+        std::unique_ptr<Surface>      rgb_surf;
+        std::unique_ptr<VideoSurface> video_surf;
+};
+
+int Emulator::open(const char *path, int flags) {
+    NJ_UNUSED(flags);
+
+    File file;
+    auto name = std::string_view(path);
+    if (name == "/dev/nvmap")
+        file.type = FileType::NvMap;
+    else if (name == "/dev/nvhost-ctrl")
+        file.type = FileType::NvHostCtrl;
+    else if (name == "/dev/nvhost-nvjpg")
+        file.type = FileType::NvJpg;
+    else
+        return fail(ENOENT);
+
+    bool is_channel = file.type == FileType::NvJpg;
+    if (is_channel)
+        this->start_engine();
+
+    std::scoped_lock lk(this->mutex);
+
+    // Every channel gets a syncpoint of its own
+    if (is_channel) {
+        file.syncpt = static_cast<std::uint32_t>(this->syncpts.size());
+        this->syncpts.emplace_back();
+    }
+
+    auto fd = this->next_fd++;
+    this->files.emplace(fd, file);
+    return fd;
+}
+
+int Emulator::close(int fd) {
+    bool stop;
+    {
+        std::scoped_lock lk(this->mutex);
+        auto it = this->files.find(fd);
+        if (it == this->files.end())
+            return fail(EBADF);
+
+        this->files.erase(it);
+
+        // The engine goes idle once no channel is left, releasing its scratch surfaces
+        stop = std::none_of(this->files.begin(), this->files.end(),
+            [](auto &f) { return f.second.type == FileType::NvJpg; });
+    }
+
+    if (stop)
+        this->stop_engine();
+
+    return 0;
+}
+
+int Emulator::ioctl(int fd, unsigned long request, void *arg) {
+    FileType type;
+    {
+        std::scoped_lock lk(this->mutex);
+        auto it = this->files.find(fd);
+        if (it == this->files.end())
+            return fail(EBADF);
+        type = it->second.type;
+    }
+
+    switch (type) {
+        case FileType::NvMap:
+            return this->nvmap_ioctl(request, arg);
+        case FileType::NvHostCtrl:
+            return this->ctrl_ioctl(request, arg);
+        case FileType::NvJpg: {
+            std::scoped_lock lk(this->mutex);
+            auto it = this->files.find(fd);
+            if (it == this->files.end())
+                return fail(EBADF);
+            return this->channel_ioctl(it->second, request, arg);
+        }
+        default:
+            return fail(ENOTTY);
+    }
+}
+
+void *Emulator::mmap(std::size_t len, int fd, off_t offset) {
+    std::scoped_lock lk(this->mutex);
+
+    // Like nvmap handles, buffers are mapped through their handle
+    auto it = this->buffers.find(static_cast<std::uint32_t>(fd));
+    if (it == this->buffers.end() || !it->second.data) {
+        errno = EBADF;
+        return MAP_FAILED;
+    }
+
+    auto &buf = it->second;
+    if (offset < 0 || static_cast<std::size_t>(offset) + len > buf.size) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    ++this->stats.num_mmaps;
+    return buf.data + offset;
+}
+
+int Emulator::nvmap_ioctl(unsigned long request, void *arg) {
+    std::scoped_lock lk(this->mutex);
+    ++this->stats.num_nvmap_ioctls;
+
+    switch (request) {
+        case NVMAP_IOCTL_CREATE: {
+            auto &args = *static_cast<nvmap_create_args *>(arg);
+            if (!args.size)
+                return fail(EINVAL);
+
+            args.handle = this->next_handle++;
+            this->buffers.emplace(args.handle, Buffer{ .size = args.size });
+            this->stats.max_handles = std::max(this->stats.max_handles, this->buffers.size());
+            return 0;
+        }
+
+        case NVMAP_IOCTL_ALLOC: {
+            auto &args = *static_cast<nvmap_alloc_args *>(arg);
+            auto it = this->buffers.find(args.handle);
+            if (it == this->buffers.end())
+                return fail(EINVAL);
+
+            auto &buf = it->second;
+            if (buf.data)
+                return fail(EEXIST);
+
+            // Relocations are shifted by 8, keep device addresses aligned accordingly
+            auto align = std::max({ args.align, 0x100u, std::uint32_t(sizeof(void *)) });
+            if (align & (align - 1))
+                return fail(EINVAL);
+
+            auto size = align_up(buf.size, align);
+            buf.data = static_cast<std::uint8_t *>(std::aligned_alloc(align, size));
+            if (!buf.data)
+                return fail(ENOMEM);
+            std::memset(buf.data, 0, size);
+
+            buf.align = align;
+            buf.iova  = align_up(this->next_iova, std::uint64_t(align));
+            this->next_iova = buf.iova + size;
+            this->iovas.emplace(buf.iova, args.handle);
+            return 0;
+        }
+
+        case NVMAP_IOCTL_FROM_VA: {
+            // Like the kernel, only whole pages of caller memory can be wrapped
+            auto &args = *static_cast<nvmap_create_from_va_args *>(arg);
+            if (!args.va || !args.size || !is_aligned(args.va, std::uint64_t(0x1000)) || !is_aligned(args.size, 0x1000u))
+                return fail(EINVAL);
+
+            args.handle = this->next_handle++;
+            auto &buf = this->buffers.emplace(args.handle, Buffer{
+                .size     = args.size,
+                .align    = 0x1000,
+                .iova     = align_up(this->next_iova, std::uint64_t(0x1000)),
+                .data     = reinterpret_cast<std::uint8_t *>(args.va),
+                .imported = true,
+            }).first->second;
+            this->next_iova = buf.iova + buf.size;
+            this->iovas.emplace(buf.iova, args.handle);
+            this->stats.max_handles = std::max(this->stats.max_handles, this->buffers.size());
+            return 0;
+        }
+
+        case NVMAP_IOCTL_FREE: {
+            auto handle = static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(arg));
+            auto it = this->buffers.find(handle);
+            if (it == this->buffers.end())
+                return fail(EINVAL);
+
+            if (it->second.data) {
+                this->iovas.erase(it->second.iova);
+                if (!it->second.imported)
+                    std::free(it->second.data);
+            }
+            this->buffers.erase(it);
+            return 0;
+        }
+
+        case NVMAP_IOCTL_CACHE: {
+            // Host memory is coherent, only check the range
+            auto &args = *static_cast<nvmap_cache_args *>(arg);
+            auto it = this->buffers.find(args.handle);
+            if (it == this->buffers.end() || !it->second.data)
+                return fail(EINVAL);
+
+            auto *addr = reinterpret_cast<std::uint8_t *>(args.addr);
+            if (addr < it->second.data || addr + args.len > it->second.data + it->second.size)
+                return fail(EINVAL);
+            return 0;
+        }
+
+        default:
+            return fail(ENOTTY);
+    }
+}
+
+int Emulator::ctrl_ioctl(unsigned long request, void *arg) {
+    if (request == NVHOST_IOCTL_CTRL_SYNCPT_READ) {
+        auto &args = *static_cast<nvhost_ctrl_syncpt_read_args *>(arg);
+
+        std::scoped_lock lk(this->mutex);
+        if (args.id == 0 || args.id >= this->syncpts.size())
+            return fail(EINVAL);
+
+        args.value = this->syncpts[args.id].value;
+        return 0;
+    }
+
+    if (request != NVHOST_IOCTL_CTRL_SYNCPT_WAITEX)
+        return fail(ENOTTY);
+
+    auto &args = *static_cast<nvhost_ctrl_syncpt_waitex_args *>(arg);
+
+    std::unique_lock lk(this->mutex);
+    if (args.id == 0 || args.id >= this->syncpts.size())
+        return fail(EINVAL);
+
+    auto is_reached = [this, &args] { return syncpt_reached(this->syncpts[args.id].value, args.thresh); };
+
+    // A negative timeout waits forever, 0 polls
+    bool reached;
+    if (args.timeout < 0)
+        this->syncpt_cv.wait(lk, is_reached), reached = true;
+    else
+        reached = this->syncpt_cv.wait_for(lk, std::chrono::milliseconds(args.timeout), is_reached);
+
+    args.value = this->syncpts[args.id].value;
+    return reached ? 0 : fail(EAGAIN);
+}
+
+int Emulator::channel_ioctl(File &file, unsigned long request, void *arg) {
+    switch (request) {
+        case NVHOST_IOCTL_CHANNEL_GET_SYNCPOINT: {
+            auto &args = *static_cast<nvhost_get_param_args *>(arg);
+            if (args.param != 0)
+                return fail(EINVAL);
+            args.value = file.syncpt;
+            return 0;
+        }
+
+        case NVHOST_IOCTL_CHANNEL_GET_CLK_RATE:
+            static_cast<nvhost_clk_rate_args *>(arg)->rate = file.clock_rate;
+            return 0;
+
+        case NVHOST_IOCTL_CHANNEL_SET_CLK_RATE:
+            file.clock_rate = static_cast<nvhost_clk_rate_args *>(arg)->rate;
+            return 0;
+
+        case NVHOST_IOCTL_CHANNEL_SUBMIT:
+            return this->submit(file, *static_cast<nvhost_submit_args *>(arg));
+
+        default:
+            return fail(ENOTTY);
+    }
+}
+
+int Emulator::submit(File &file, nvhost_submit_args &args) {
+    if (args.submit_version != NVHOST_SUBMIT_VERSION_V2 || args.num_waitchks)
+        return fail(EINVAL);
+
+    if (args.num_cmdbufs > CmdBuf::max_bufs)
+        return fail(E2BIG);
+
+    auto cmdbufs = std::span(reinterpret_cast<const nvhost_cmdbuf      *>(args.cmdbufs),      args.num_cmdbufs);
+    auto relocs  = std::span(reinterpret_cast<const nvhost_reloc       *>(args.relocs),       args.num_relocs);
+    auto shifts  = std::span(reinterpret_cast<const nvhost_reloc_shift *>(args.reloc_shifts), args.num_relocs);
+    auto incrs   = std::span(reinterpret_cast<const nvhost_syncpt_incr *>(args.syncpt_incrs), args.num_syncpt_incrs);
+
+    // Check the whole submission before touching anything
+    for (auto &buf: cmdbufs) {
+        auto it = this->buffers.find(buf.mem);
+        if (it == this->buffers.end() || !it->second.data ||
+                std::uint64_t(buf.offset) + std::uint64_t(buf.words) * sizeof(CmdBuf::Word) > it->second.size)
+            return fail(EINVAL);
+    }
+
+    for (auto &reloc: relocs) {
+        auto cmdbuf_it = this->buffers.find(reloc.cmdbuf_mem), target_it = this->buffers.find(reloc.target_mem);
+        if (cmdbuf_it == this->buffers.end() || !cmdbuf_it->second.data ||
+                target_it == this->buffers.end() || !target_it->second.data)
+            return fail(EINVAL);
+        if (!is_aligned(reloc.cmdbuf_offset, std::uint32_t(sizeof(CmdBuf::Word))) ||
+                reloc.cmdbuf_offset + sizeof(CmdBuf::Word) > cmdbuf_it->second.size)
+            return fail(EINVAL);
+    }
+
+    std::uint32_t num_incrs = 0;
+    for (auto &incr: incrs) {
+        if (incr.syncpt_id != file.syncpt)
+            return fail(EINVAL);
+        num_incrs += incr.syncpt_incrs;
+    }
+
+    // Patch the command stream in place, like the kernel does
+    for (std::size_t i = 0; i < relocs.size(); ++i) {
+        auto &reloc  = relocs[i];
+        auto &target = this->buffers[reloc.target_mem];
+        auto *word   = reinterpret_cast<CmdBuf::Word *>(this->buffers[reloc.cmdbuf_mem].data + reloc.cmdbuf_offset);
+        *word = static_cast<CmdBuf::Word>((target.iova + reloc.target_offset) >> shifts[i].shift);
+    }
+
+    auto &syncpt = this->syncpts[file.syncpt];
+    syncpt.max += num_incrs;
+    args.fence  = syncpt.max;
+
+    if (this->free_submissions.empty())
+        this->free_submissions.emplace_back();
+
+    auto &submission = this->free_submissions.front();
+    submission.syncpt = file.syncpt;
+    submission.cmdbufs.clear();
+    for (auto &buf: cmdbufs)
+        submission.cmdbufs.push_back(buf);
+
+    this->queue.splice(this->queue.end(), this->free_submissions, this->free_submissions.begin());
+    this->engine_cv.notify_one();
+    return 0;
+}
+
+std::span<std::uint8_t> Emulator::resolve(std::uint64_t iova, std::size_t size) {
+    std::scoped_lock lk(this->mutex);
+
+    auto it = this->iovas.upper_bound(iova);
+    if (it == this->iovas.begin())
+        return {};
+
+    auto &buf = this->buffers[(--it)->second];
+    if (iova + size > buf.iova + buf.size)
+        return {};
+
+    return std::span(buf.data + (iova - buf.iova), buf.size - (iova - buf.iova));
+}
+
+void Emulator::start_engine() {
+    std::scoped_lock lk(this->mutex);
+    if (this->engine.joinable())
+        return;
+
+    // The fence of a submission is reached before it is recycled, so a spare one lets a render and wait loop
+    // submit again right away without allocating
+    if (this->free_submissions.size() < 2)
+        this->free_submissions.resize(2);
+
+    this->engine_stop = false;
+    this->engine = std::thread(&Emulator::engine_main, this);
+}
+
+void Emulator::stop_engine() {
+    std::thread engine;
+    {
+        std::scoped_lock lk(this->mutex);
+        this->engine_stop = true;
+        engine = std::move(this->engine);
+    }
+    this->engine_cv.notify_one();
+
+    // The engine thread allocates through the driver, so it is joined without the lock held
+    if (engine.joinable())
+        engine.join();
+}
+
+void Emulator::engine_main() {
+    std::unique_lock lk(this->mutex);
+    while (true) {
+        this->engine_cv.wait(lk, [this] { return this->engine_stop || !this->queue.empty(); });
+        if (this->queue.empty())
+            break;
+
+        std::list<Submission> current;
+        current.splice(current.begin(), this->queue, this->queue.begin());
+
+        lk.unlock();
+        this->execute(current.front());
+        lk.lock();
+
+        this->free_submissions.splice(this->free_submissions.begin(), current);
+    }
+    lk.unlock();
+
+    this->rgb_surf.reset();
+    this->video_surf.reset();
+}
+
+void Emulator::execute(const Submission &submission) {
+    constexpr auto thi_method_0   = NJ_REGPOS(ThiRegisters, method_0);
+    constexpr auto thi_method_1   = NJ_REGPOS(ThiRegisters, method_1);
+    constexpr auto thi_incr       = NJ_REGPOS(ThiRegisters, incr_syncpt);
+    constexpr auto nvjpg_execute  = NJ_REGPOS(NvjpgRegisters, execute);
+
+    std::array<std::uint32_t, sizeof(NvjpgRegisters) / sizeof(std::uint32_t)> regs = {};
+    std::uint32_t method = 0;
+
+    auto write = [&](std::uint32_t offset, std::uint32_t value) {
+        if (offset == thi_method_0) {
+            method = value;
+        } else if (offset == thi_method_1) {
+            if (method < regs.size())
+                regs[method] = value;
+            if (method == nvjpg_execute)
+                this->decode(regs);
+        } else if (offset == thi_incr) {
+            this->increment_syncpt(value & 0xff);
+        }
+    };
+
+    auto &words = this->words;
+    for (auto &buf: submission.cmdbufs.span()) {
+        {
+            std::scoped_lock lk(this->mutex);
+            auto it = this->buffers.find(buf.mem);
+            if (it == this->buffers.end() || !it->second.data)
+                continue;
+            auto *data = reinterpret_cast<const CmdBuf::Word *>(it->second.data + buf.offset);
+            words.assign(data, data + buf.words);
+        }
+
+        // Host1x opcodes
+        for (std::size_t i = 0; i < words.size();) {
+            auto word   = words[i++];
+            auto offset = word >> 16 & mask(12u);
+
+            switch (word >> 28) {
+                case 0: // Set class, with optional masked writes
+                case 3: // Mask
+                    for (std::uint32_t j = 0; j < 16 && i < words.size(); ++j) {
+                        if (word & bit(j))
+                            write(offset + j, words[i++]);
+                    }
+                    break;
+                case 1: // Incrementing
+                    for (std::uint32_t j = 0; j < (word & mask(16u)) && i < words.size(); ++j)
+                        write(offset + j, words[i++]);
+                    break;
+                case 2: // Non-incrementing
+                    for (std::uint32_t j = 0; j < (word & mask(16u)) && i < words.size(); ++j)
+                        write(offset, words[i++]);
+                    break;
+                case 4: // Immediate
+                    write(offset, word & mask(16u));
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+void Emulator::increment_syncpt(std::uint32_t id) {
+    {
+        std::scoped_lock lk(this->mutex);
+        if (id == 0 || id >= this->syncpts.size())
+            return;
+        ++this->syncpts[id].value;
+    }
+    this->syncpt_cv.notify_all();
+}
+
+// Rebuilds a baseline stream from the picture info and scan data
+std::vector<std::uint8_t> build_stream(const NvjpgPictureInfo &info, std::span<const std::uint8_t> scan) {
+    std::vector<std::uint8_t> out;
+    out.reserve(0x400 + scan.size());
+
+    auto put_marker = [&](JpegMarker marker, std::size_t size) {
+        out.insert(out.end(), {
+            static_cast<std::uint8_t>(JpegMarker::Magic), static_cast<std::uint8_t>(marker),
+            static_cast<std::uint8_t>((size + 2) >> 8), static_cast<std::uint8_t>(size + 2),
+        });
+    };
+
+    auto num_components = std::min(info.num_components, 3u);
+
+    std::uint8_t quant_mask = 0, ac_mask = 0, dc_mask = 0;
+    for (std::size_t i = 0; i < num_components; ++i) {
+        quant_mask |= bit(info.components[i].quant_table_id & 3u);
+        ac_mask    |= bit(info.components[i].hm_ac_table_id & 3u);
+        dc_mask    |= bit(info.components[i].hm_dc_table_id & 3u);
+    }
+
+    out.insert(out.end(), { static_cast<std::uint8_t>(JpegMarker::Magic), static_cast<std::uint8_t>(JpegMarker::Soi) });
+
+    for (std::uint8_t i = 0; i < info.quant_tables.size(); ++i) {
+        if (!(quant_mask & bit(i)))
+            continue;
+        put_marker(JpegMarker::Dqt, 1 + 64);
+        out.push_back(i);
+        out.insert(out.end(), info.quant_tables[i].table.begin(), info.quant_tables[i].table.end());
+    }
+
+    // Mirrors the parser, which stores the tables of class 0 as hm_ac_tables
+    auto put_table = [&](const NvjpgPictureInfo::HuffmanTable &table, std::uint8_t info_byte) {
+        std::size_t num_symbols = 0;
+        for (auto count: table.codes)
+            num_symbols += count;
+        num_symbols = std::min(num_symbols, table.symbols.size());
+
+        put_marker(JpegMarker::Dht, 1 + 16 + num_symbols);
+        out.push_back(info_byte);
+        for (auto count: table.codes)
+            out.push_back(static_cast<std::uint8_t>(count));
+        out.insert(out.end(), table.symbols.begin(), table.symbols.begin() + num_symbols);
+    };
+
+    for (std::uint8_t i = 0; i < 4; ++i) {
+        if (dc_mask & bit(i))
+            put_table(info.hm_dc_tables[i], 0x10 | i);
+        if (ac_mask & bit(i))
+            put_table(info.hm_ac_tables[i], 0x00 | i);
+    }
+
+    put_marker(JpegMarker::Sof0, 6 + 3 * num_components);
+    out.insert(out.end(), {
+        8,
+        static_cast<std::uint8_t>(info.height >> 8), static_cast<std::uint8_t>(info.height),
+        static_cast<std::uint8_t>(info.width  >> 8), static_cast<std::uint8_t>(info.width),
+        static_cast<std::uint8_t>(num_components),
+    });
+    for (std::size_t i = 0; i < num_components; ++i) {
+        auto &comp = info.components[i];
+        out.insert(out.end(), {
+            static_cast<std::uint8_t>(i + 1),
+            static_cast<std::uint8_t>(comp.sampling_horiz << 4 | comp.sampling_vert),
+            comp.quant_table_id,
+        });
+    }
+
+    if (info.restart_interval) {
+        put_marker(JpegMarker::Dri, 2);
+        out.insert(out.end(), {
+            static_cast<std::uint8_t>(info.restart_interval >> 8), static_cast<std::uint8_t>(info.restart_interval),
+        });
+    }
+
+    put_marker(JpegMarker::Sos, 4 + 2 * num_components);
+    out.push_back(static_cast<std::uint8_t>(num_components));
+    for (std::size_t i = 0; i < num_components; ++i) {
+        auto &comp = info.components[i];
+        out.insert(out.end(), {
+            static_cast<std::uint8_t>(i + 1),
+            static_cast<std::uint8_t>(comp.hm_dc_table_id << 4 | comp.hm_ac_table_id),
+        });
+    }
+    out.insert(out.end(), { 0, 63, 0 });
+
+    out.insert(out.end(), scan.begin(), scan.end());
+    out.insert(out.end(), { static_cast<std::uint8_t>(JpegMarker::Magic), static_cast<std::uint8_t>(JpegMarker::Eoi) });
+    return out;
+}
+
+// Copies rows of a scratch plane to the output buffer, within the bounds of the latter
+void copy_plane(std::span<std::uint8_t> dst, std::size_t dst_pitch, const std::uint8_t *src, std::size_t src_pitch,
+        std::size_t row_size, std::size_t num_rows) {
+    if (!dst_pitch)
+        return;
+
+    row_size = std::min(row_size, dst_pitch);
+    num_rows = std::min(num_rows, (dst.size() + dst_pitch - row_size) / dst_pitch);
+    for (std::size_t y = 0; y < num_rows; ++y)
+        std::copy_n(src + y * src_pitch, row_size, dst.data() + y * dst_pitch);
+}
+
+void Emulator::decode(const std::array<std::uint32_t, sizeof(NvjpgRegisters) / sizeof(std::uint32_t)> &regs) {
+    auto reg = [&regs](auto pos) -> std::uint64_t { return std::uint64_t(regs[pos]) << 8; };
+
+    auto info_mem   = this->resolve(reg(NJ_REGPOS(NvjpgRegisters, picture_info_offset)), sizeof(NvjpgPictureInfo));
+    auto status_mem = this->resolve(reg(NJ_REGPOS(NvjpgRegisters, read_info_offset)),    sizeof(NvjpgStatus));
+    if (info_mem.empty() || status_mem.empty())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto &info   = *reinterpret_cast<const NvjpgPictureInfo *>(info_mem.data());
+    auto *status =  reinterpret_cast<NvjpgStatus *>(status_mem.data());
+
+    auto rc = [&]() -> Result {
+        auto scan = this->resolve(reg(NJ_REGPOS(NvjpgRegisters, scan_data_offset)) + info.scan_data_offset,
+            info.scan_data_size);
+        auto out  = this->resolve(reg(NJ_REGPOS(NvjpgRegisters, out_data_offset)), 1);
+        if (scan.empty() || out.empty() || !info.width || !info.height)
+            return EINVAL;
+
+        auto stream = std::make_shared<std::vector<std::uint8_t>>(build_stream(info, scan.first(info.scan_data_size)));
+        auto image  = Image(stream);
+        NJ_TRY_RET(image.parse());
+
+        auto downscale  = info.downscale_log_2 ? 1u << info.downscale_log_2 : 0u;
+        auto out_width  = (info.width  + bit(info.downscale_log_2) - 1) >> info.downscale_log_2;
+        auto out_height = (info.height + bit(info.downscale_log_2) - 1) >> info.downscale_log_2;
+
+        if (static_cast<PixelFormat>(info.out_surf_type) != PixelFormat::YUV) {
+            auto type = static_cast<PixelFormat>(info.out_surf_type);
+            auto &surf = this->rgb_surf;
+            if (!surf || surf->width != out_width || surf->height != out_height || surf->type != type) {
+                surf = std::make_unique<Surface>(out_width, out_height, type);
+                NJ_TRY_RET(surf->allocate());
+            }
+
+            NJ_TRY_RET(this->sw_decoder.render(image, *surf, info.yuv2rgb_kernel,
+                static_cast<std::uint8_t>(info.alpha), downscale, status));
+
+            copy_plane(out, info.out_luma_surf_pitch, surf->data(), surf->pitch, out_width * surf->get_bpp(), out_height);
+            return 0;
+        }
+
+        // Monochrome pictures only write luma, any sampling works for the scratch surface
+        auto out_sampling = static_cast<SamplingFormat>(info.out_data_samp_layout);
+        auto sampling     = (out_sampling == SamplingFormat::Monochrome) ? SamplingFormat::S444 : out_sampling;
+
+        auto &surf = this->video_surf;
+        if (!surf || surf->width != out_width || surf->height != out_height || surf->sampling != sampling) {
+            surf = std::make_unique<VideoSurface>(out_width, out_height, sampling);
+            NJ_TRY_RET(surf->allocate());
+        }
+
+        NJ_TRY_RET(this->sw_decoder.render(image, *surf, downscale, status));
+
+        copy_plane(out, info.out_luma_surf_pitch, surf->luma_data, surf->luma_pitch, out_width, out_height);
+        if (out_sampling == SamplingFormat::Monochrome)
+            return 0;
+
+        auto sub_h = (sampling == SamplingFormat::S444) ? 1 : 2;
+        auto sub_v = (sampling == SamplingFormat::S420) ? 2 : 1;
+        auto chroma_width  = (out_width  + sub_h - 1) / sub_h;
+        auto chroma_height = (out_height + sub_v - 1) / sub_v;
+
+        auto chromab = this->resolve(reg(NJ_REGPOS(NvjpgRegisters, out_data_2_offset)), 1);
+        auto chromar = this->resolve(reg(NJ_REGPOS(NvjpgRegisters, out_data_3_offset)), 1);
+        copy_plane(chromab, info.out_chroma_surf_pitch, surf->chromab_data, surf->chroma_pitch, chroma_width, chroma_height);
+        copy_plane(chromar, info.out_chroma_surf_pitch, surf->chromar_data, surf->chroma_pitch, chroma_width, chroma_height);
+        return 0;
+    }();
+
+    if (rc) {
+        *status = {};
+        status->result = static_cast<std::uint32_t>(rc);
+    }
+
+    double throughput;
+    {
+        std::scoped_lock lk(this->mutex);
+        throughput = this->throughput;
+    }
+
+    if (throughput > 0)
+        std::this_thread::sleep_until(start +
+            std::chrono::duration<double, std::micro>(double(info.width) * info.height / throughput));
+}
+
+constexpr NvDeviceOps emulator_ops = {
+    .open   = [](const char *path, int flags) { return Emulator::get().open(path, flags); },
+    .close  = [](int fd) { return Emulator::get().close(fd); },
+    .ioctl  = [](int fd, unsigned long request, void *arg) { return Emulator::get().ioctl(fd, request, arg); },
+    .mmap   = [](void *addr, std::size_t len, int prot, int flags, int fd, off_t offset) {
+        NJ_UNUSED(addr, prot, flags);
+        return Emulator::get().mmap(len, fd, offset);
+    },
+    .munmap = [](void *addr, std::size_t len) {
+        // Mappings alias the buffer storage, which lives until the handle is freed
+        NJ_UNUSED(addr, len);
+        return 0;
+    },
+};
+
+} // namespace
+
+const NvDeviceOps &NvEmulator::get_ops() {
+    return emulator_ops;
+}
+
+void NvEmulator::set_engine_throughput(double mpix_per_s) {
+    Emulator::get().set_throughput(mpix_per_s);
+}
+
+NvEmulator::Stats NvEmulator::get_stats() {
+    return Emulator::get().get_stats();
+}
+
+} // namespace nj
+
+#endif // __SWITCH__
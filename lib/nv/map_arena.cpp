@@ -0,0 +1,101 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+
+#include <nvjpg/nv/map_arena.hpp>
+
+namespace nj {
+
+namespace {
+
+constexpr std::uint32_t page_size = 0x1000;
+
+} // namespace
+
+Result NvMapArena::initialize(int channel_fd, std::uint32_t block_size) {
+    this->channel_fd = channel_fd;
+    this->block_size = align_up(std::max(block_size, page_size), page_size);
+    return 0;
+}
+
+Result NvMapArena::finalize() {
+    for (auto &block: this->blocks)
+        NJ_TRY_RET(block.map->free());
+
+    this->blocks.clear();
+    return 0;
+}
+
+Result NvMapArena::add_block(std::uint32_t size) {
+    auto map = std::make_unique<NvMap>();
+    NJ_TRY_RET(map->allocate(size, page_size, 0x1));
+
+#ifdef __SWITCH__
+    NJ_TRY_RET(map->map(this->channel_fd));
+#else
+    NJ_TRY_ERRNO(map->map());
+#endif
+
+    this->blocks.push_back({ std::move(map), 0 });
+    return 0;
+}
+
+Result NvMapArena::allocate(std::uint32_t size, std::uint32_t align, NvMapRegion &region) {
+    if (!size || (align & (align - 1)))
+        return EINVAL;
+
+    align = std::clamp(align, 1u, page_size);
+
+    // First fit, there are only a few blocks
+    auto it = std::find_if(this->blocks.begin(), this->blocks.end(), [size, align](const Block &block) {
+        return align_up(block.used, align) + size <= block.map->size();
+    });
+
+    if (it == this->blocks.end()) {
+        NJ_TRY_RET(this->add_block(std::max(this->block_size, align_up(size, page_size))));
+        it = this->blocks.end() - 1;
+    }
+
+    auto offset = align_up(it->used, align);
+    it->used    = offset + size;
+
+    region = {
+        .map    = it->map.get(),
+        .offset = offset,
+        .size   = size,
+    };
+    return 0;
+}
+
+std::size_t NvMapArena::get_used_size() const {
+    std::size_t size = 0;
+    for (auto &block: this->blocks)
+        size += block.used;
+    return size;
+}
+
+std::size_t NvMapArena::get_allocated_size() const {
+    std::size_t size = 0;
+    for (auto &block: this->blocks)
+        size += block.map->size();
+    return size;
+}
+
+} // namespace nj
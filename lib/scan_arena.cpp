@@ -0,0 +1,190 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+
+#include <nvjpg/utils.hpp>
+
+#include <nvjpg/scan_arena.hpp>
+
+namespace nj {
+
+Result ScanArena::initialize(std::size_t capacity, std::size_t max_allocations, int channel_fd) {
+    this->channel_fd = channel_fd;
+
+    this->records.assign(std::max(max_allocations, std::size_t(1)), {});
+    this->first_record = this->num_records = this->num_committed = 0;
+
+    return this->add_buffer(capacity);
+}
+
+Result ScanArena::finalize() {
+    for (auto &buffer: this->buffers)
+        NJ_TRY_RET(buffer.map->free());
+
+    this->buffers.clear();
+    this->first_record = this->num_records = this->num_committed = 0;
+    this->head = this->tail = this->num_current = 0;
+    return 0;
+}
+
+Result ScanArena::resize(std::size_t capacity) {
+    return this->add_buffer(capacity);
+}
+
+Result ScanArena::add_buffer(std::size_t capacity) {
+    auto map = std::make_unique<NvMap>();
+    NJ_TRY_RET(map->allocate(align_up(std::max(capacity, std::size_t(alignment)), std::size_t(0x1000)), 0x1000, 0x1));
+
+#ifdef __SWITCH__
+    NJ_TRY_RET(map->map(this->channel_fd));
+#else
+    NJ_TRY_ERRNO(map->map());
+#endif
+
+    this->buffers.push_back({ std::move(map), ++this->generation });
+    this->head = this->tail = this->num_current = 0;
+
+    this->release_buffers();
+    return 0;
+}
+
+bool ScanArena::fit(std::uint32_t size, std::uint32_t &offset) const {
+    auto capacity = this->capacity();
+
+    if (!this->num_current) {
+        offset = 0;
+        return size <= capacity;
+    }
+
+    // Room after the newest allocation, or before the oldest one once wrapped around
+    if (this->head > this->tail) {
+        if (capacity - this->head >= size) {
+            offset = this->head;
+            return true;
+        }
+
+        offset = 0;
+        return this->tail >= size;
+    }
+
+    offset = this->head;
+    return this->tail - this->head >= size;
+}
+
+bool ScanArena::reclaim(bool wait) {
+    bool reclaimed = false;
+
+    // Committed records come first, and their renders complete in order
+    while (this->num_committed) {
+        auto &record = this->get_record(0);
+        if (!NvHostCtrl::poll(record.fence)) {
+            if (!wait || NvHostCtrl::wait(record.fence, -1))
+                break;
+            wait = false;
+        }
+
+        if (record.generation == this->generation)
+            --this->num_current;
+
+        this->first_record = (this->first_record + 1) % this->records.size();
+        --this->num_records, --this->num_committed;
+        reclaimed = true;
+    }
+
+    if (this->num_current)
+        this->tail = this->get_record(this->num_records - this->num_current).begin;
+    else
+        this->head = this->tail = 0;
+
+    this->release_buffers();
+    return reclaimed;
+}
+
+void ScanArena::release_buffers() {
+    while (this->buffers.size() > 1 &&
+            (!this->num_records || this->get_record(0).generation > this->buffers.front().generation))
+        this->buffers.pop_front();
+}
+
+Result ScanArena::allocate(std::size_t size, Allocation &allocation) {
+    auto aligned = static_cast<std::uint32_t>(align_up(std::max(size, std::size_t(1)), std::size_t(alignment)));
+
+    // There are as many records as ring entries, and the render that last used the entry being filled has completed
+    if (this->num_records == this->records.size() && !this->reclaim(true))
+        return EIO;
+
+    std::uint32_t offset;
+    while (!this->fit(aligned, offset)) {
+        if (this->reclaim(false))
+            continue;
+
+        // Renders in flight free up space as they complete, unless the space is held by the renders of the batch
+        // being prepared. Scans taking more than half the buffer grow it instead, so that the next render can be
+        // prepared while one is being decoded
+        if (this->num_committed && aligned <= this->capacity() / 2) {
+            this->num_waits.add();
+            if (!this->reclaim(true))
+                return EIO;
+            continue;
+        }
+
+        this->num_grows.add();
+        NJ_TRY_RET(this->add_buffer(std::max(this->capacity() * 2, std::size_t(aligned))));
+    }
+
+    auto &record = this->get_record(this->num_records++);
+    record = {
+        .generation = this->generation,
+        .begin      = offset,
+        .end        = offset + aligned,
+        .fence      = {},
+    };
+
+    if (!this->num_current++)
+        this->tail = offset;
+    this->head = record.end;
+
+    allocation = { this->buffers.back().map.get(), offset };
+    return 0;
+}
+
+void ScanArena::commit(const nvhost_ctrl_fence &fence) {
+    if (this->num_committed < this->num_records)
+        this->get_record(this->num_committed++).fence = fence;
+}
+
+void ScanArena::cancel() {
+    if (this->num_records == this->num_committed)
+        return;
+
+    while (this->num_records > this->num_committed) {
+        if (this->get_record(--this->num_records).generation == this->generation)
+            --this->num_current;
+    }
+
+    if (this->num_current)
+        this->head = this->get_record(this->num_records - 1).end;
+    else
+        this->head = this->tail = 0;
+
+    this->release_buffers();
+}
+
+} // namespace nj
@@ -0,0 +1,420 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#include <cmath>
+
+#include <nvjpg/nv/ctrl.hpp>
+#include <nvjpg/utils.hpp>
+
+#include <nvjpg/scheduler.hpp>
+
+namespace nj {
+
+namespace {
+
+// Starting points for the models, in microseconds per unit of each feature
+// Hardware: roughly matches the engine on a Tegra X1 (2ms for a 720x1080 image, 16ms for 3200x1800),
+// most of the fixed cost being the submission and the syncpoint wait
+constexpr CostModel::Features hw_prior = { 400.0,  0.0,  60.0,  3.0,  800.0, 700.0 };
+// Software: a single Cortex-A57 core
+constexpr CostModel::Features sw_prior = {  20.0, 50.0, 900.0, 10.0, 8000.0, 600.0 };
+
+constexpr double max_covariance_trace = 1e4;
+constexpr double error_smoothing      = 0.05;
+
+CostModel::Features get_features(const Scheduler::Job &job) {
+    return {
+        1.0,
+        job.num_mcus   / 1e3,
+        job.num_blocks / 1e3,
+        job.scan_size  / 1024.0,
+        job.out_pixels / 1e6,
+        job.progressive ? job.num_blocks / 1e3 : 0.0,
+    };
+}
+
+double to_us(auto duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+} // namespace
+
+double CostModel::predict(const Features &x) const {
+    double y = 0;
+    for (std::size_t i = 0; i < num_features; ++i)
+        y += this->weights[i] * x[i];
+    return std::max(y, 0.0);
+}
+
+void CostModel::update(const Features &x, double latency_us) {
+    auto &p = this->covariance;
+
+    Features px = {};
+    double denom = this->forgetting;
+    for (std::size_t i = 0; i < num_features; ++i) {
+        for (std::size_t j = 0; j < num_features; ++j)
+            px[i] += p[i][j] * x[j];
+        denom += x[i] * px[i];
+    }
+
+    auto prediction = this->predict(x);
+    auto residual = latency_us;
+    for (std::size_t i = 0; i < num_features; ++i)
+        residual -= this->weights[i] * x[i];
+
+    for (std::size_t i = 0; i < num_features; ++i)
+        this->weights[i] += px[i] / denom * residual;
+
+    // Only forget past samples while the covariance is bounded, otherwise directions which are
+    // never excited (eg. progressive blocks in a baseline-only workload) grow without limit
+    double trace = 0;
+    for (std::size_t i = 0; i < num_features; ++i) {
+        for (std::size_t j = 0; j < num_features; ++j)
+            p[i][j] -= px[i] * px[j] / denom;
+        trace += p[i][i];
+    }
+
+    if (trace < max_covariance_trace) {
+        for (auto &row: p)
+            for (auto &v: row)
+                v /= this->forgetting;
+    }
+
+    auto error = std::abs(prediction - latency_us) / std::max(latency_us, 1.0);
+    this->error = this->num_samples ? this->error + error_smoothing * (error - this->error) : error;
+    ++this->num_samples;
+}
+
+Scheduler::Scheduler(): hw_model(hw_prior), sw_model(sw_prior) { }
+
+Scheduler::~Scheduler() {
+    this->stop_workers();
+}
+
+Result Scheduler::initialize(std::size_t num_sw_workers, std::size_t num_ring_entries, std::size_t capacity) {
+    // Auto releases the engine resources and falls back to software when the engine can't be opened
+    NJ_TRY_RET(this->hw_decoder.initialize(num_ring_entries, capacity, Decoder::Backend::Auto));
+    this->hw_available = this->hw_decoder.get_backend() == Decoder::Backend::Hardware;
+
+    if (!this->hw_available)
+        num_sw_workers = std::max(num_sw_workers, std::size_t(1));
+
+    this->stop = false;
+    for (std::size_t i = 0; i < num_sw_workers; ++i)
+        this->workers.emplace_back(&Scheduler::worker_main, this);
+
+    this->last_hw_completion = Clock::now();
+    return 0;
+}
+
+Result Scheduler::finalize() {
+    this->stop_workers();
+
+    {
+        std::scoped_lock lk(this->mutex);
+        this->hw_jobs.clear();
+        this->hw_backlog_us = 0;
+        this->sw_completions.clear();
+    }
+
+    return this->hw_decoder.finalize();
+}
+
+void Scheduler::stop_workers() {
+    {
+        std::scoped_lock lk(this->mutex);
+        this->stop = true;
+    }
+    this->work_cv.notify_all();
+
+    for (auto &worker: this->workers)
+        worker.join();
+    this->workers.clear();
+}
+
+Scheduler::Job Scheduler::describe(const Image &image, std::uint32_t downscale) {
+    auto downscale_log_2 = downscale ? std::clamp(__builtin_ctz(downscale), 0, 3) : 0;
+
+    auto mcu_width  = std::max<std::uint32_t>(image.mcu_size_horiz, 1);
+    auto mcu_height = std::max<std::uint32_t>(image.mcu_size_vert,  1);
+    auto num_mcus   = ((image.width + mcu_width - 1) / mcu_width) * ((image.height + mcu_height - 1) / mcu_height);
+
+    std::uint32_t blocks_per_mcu = 0;
+    for (std::size_t i = 0; i < image.num_components; ++i)
+        blocks_per_mcu += (image.num_components == 1) ? 1 :
+            image.components[i].sampling_horiz * image.components[i].sampling_vert;
+
+    auto scale = [downscale_log_2](std::uint32_t dim) {
+        return (dim + (1 << downscale_log_2) - 1) >> downscale_log_2;
+    };
+
+    return {
+        .num_mcus         = num_mcus,
+        .num_blocks       = num_mcus * blocks_per_mcu,
+        .scan_size        = image.get_scan_data().size(),
+        .out_pixels       = scale(image.width) * scale(image.height),
+        .sampling         = image.sampling,
+        .downscale_log_2  = static_cast<std::uint32_t>(downscale_log_2),
+        .progressive      = image.progressive,
+        .in_device_memory = image.get_map() != nullptr,
+    };
+}
+
+Scheduler::Decision Scheduler::decide(const Job &job, const CostModel::Features &features) {
+    Decision decision = {};
+    decision.job = job;
+
+    // The engine runs jobs one at a time in submission order: the head of the queue has been running
+    // since the completion of the previous job
+    auto now = Clock::now();
+    decision.hw_queue_depth = this->hw_jobs.size();
+    decision.hw_wait_us     = this->hw_backlog_us;
+    if (!this->hw_jobs.empty()) {
+        auto head_start = std::max(this->hw_jobs.front().start, this->last_hw_completion);
+        decision.hw_wait_us = std::max(decision.hw_wait_us - to_us(now - head_start), 0.0);
+    }
+
+    {
+        std::scoped_lock lk(this->mutex);
+        decision.hw_service_us  = this->hw_model.predict(features);
+        decision.sw_service_us  = this->sw_model.predict(features);
+        decision.sw_queue_depth = this->sw_in_flight;
+        decision.sw_wait_us     = (this->sw_in_flight < this->workers.size()) ? 0.0 :
+            this->sw_backlog_us / this->workers.size();
+    }
+
+    bool hw_eligible = this->hw_available;
+    bool sw_eligible = !this->workers.empty();
+
+    switch (this->policy) {
+        case Policy::Hardware:
+            decision.target = hw_eligible ? Target::Hardware : Target::Software;
+            break;
+        case Policy::Software:
+            decision.target = sw_eligible ? Target::Software : Target::Hardware;
+            break;
+        case Policy::CostModel:
+        default:
+            if (!hw_eligible || !sw_eligible)
+                decision.target = hw_eligible ? Target::Hardware : Target::Software;
+            else
+                decision.target = (decision.hw_wait_us + decision.hw_service_us <=
+                    decision.sw_wait_us + decision.sw_service_us) ? Target::Hardware : Target::Software;
+            break;
+    }
+
+    return decision;
+}
+
+void Scheduler::poll_hardware() {
+    auto now = Clock::now();
+
+    while (!this->hw_jobs.empty()) {
+        auto &job = this->hw_jobs.front();
+
+        if (NvHostCtrl::wait(job.fence, 0)) {
+            // Later jobs can't have completed either
+            for (auto &pending: this->hw_jobs)
+                pending.last_pending = now;
+            break;
+        }
+
+        // Completion is only known to lie between the last time the job was seen pending and now,
+        // the sample is kept if that window is small compared to the latency
+        auto start       = std::max(job.start, this->last_hw_completion);
+        auto completion  = job.last_pending + (now - job.last_pending) / 2;
+        auto latency     = to_us(completion - start);
+        auto uncertainty = to_us(now - job.last_pending);
+        this->last_hw_completion = completion;
+
+        std::scoped_lock lk(this->mutex);
+        if (latency > 0 && uncertainty <= latency / 2)
+            this->hw_model.update(job.features, latency);
+
+        this->hw_backlog_us = std::max(this->hw_backlog_us - job.estimate_us, 0.0);
+        this->hw_jobs.pop_front();
+    }
+}
+
+Result Scheduler::render_common(const Image &image, SurfaceBase &surf, bool is_video, std::uint8_t alpha,
+        std::uint32_t downscale) {
+    if (surf.width == 0 || surf.height == 0)
+        return EINVAL;
+
+    this->poll_hardware();
+
+    auto job      = Scheduler::describe(image, downscale);
+    auto features = get_features(job);
+    auto decision = this->decide(job, features);
+    this->last_decision = decision;
+
+    if (decision.target == Target::Hardware) {
+        auto start = Clock::now();
+
+        this->hw_decoder.colorspace = this->colorspace;
+        auto rc = is_video ?
+            this->hw_decoder.render(image, static_cast<VideoSurface &>(surf), downscale) :
+            this->hw_decoder.render(image, static_cast<Surface &>(surf), alpha, downscale);
+        if (rc)
+            return rc;
+
+        std::scoped_lock lk(this->mutex);
+        this->hw_jobs.push_back({
+            .fence        = surf.render_fence,
+            .start        = start,
+            .last_pending = start,
+            .features     = features,
+            .estimate_us  = decision.hw_service_us,
+        });
+        this->hw_backlog_us += decision.hw_service_us;
+        ++this->num_hardware;
+        return 0;
+    }
+
+    {
+        std::scoped_lock lk(this->mutex);
+
+        // Drop the oldest results nobody waited on
+        while (this->sw_completions.size() >= 0x100 && this->sw_completions.begin()->second.done)
+            this->sw_completions.erase(this->sw_completions.begin());
+
+        auto id = ++this->sw_next_id;
+        this->sw_queue.push_back({
+            .id          = id,
+            .image       = &image,
+            .surf        = &surf,
+            .is_video    = is_video,
+            .alpha       = alpha,
+            .downscale   = downscale,
+            .kernel      = Decoder::get_yuv2rgb_kernel(this->colorspace),
+            .features    = features,
+            .estimate_us = decision.sw_service_us,
+        });
+        this->sw_completions[id] = { false, 0, 0 };
+        this->sw_backlog_us += decision.sw_service_us;
+        ++this->sw_in_flight;
+        ++this->num_software;
+
+        surf.render_fence = {
+            .id    = Decoder::sw_syncpt_id,
+            .value = id,
+        };
+    }
+
+    this->work_cv.notify_one();
+    return 0;
+}
+
+Result Scheduler::render(const Image &image, Surface &surf, std::uint8_t alpha, std::uint32_t downscale) {
+    return this->render_common(image, surf, false, alpha, downscale);
+}
+
+Result Scheduler::render(const Image &image, VideoSurface &surf, std::uint32_t downscale) {
+    return this->render_common(image, surf, true, 0, downscale);
+}
+
+Result Scheduler::wait(const SurfaceBase &surf, std::size_t *num_read_bytes, std::int32_t timeout_us) {
+    if (surf.render_fence.id != Decoder::sw_syncpt_id) {
+        auto it = std::find_if(this->hw_jobs.begin(), this->hw_jobs.end(), [&surf](auto &job) {
+            return (job.fence.id == surf.render_fence.id) && (job.fence.value == surf.render_fence.value);
+        });
+
+        bool was_pending = (it != this->hw_jobs.end()) && NvHostCtrl::wait(it->fence, 0);
+        NJ_TRY_RET(this->hw_decoder.wait(surf, num_read_bytes, timeout_us));
+
+        // Blocking on the fence gives the exact completion time
+        if (was_pending)
+            it->last_pending = Clock::now();
+
+        this->poll_hardware();
+        return 0;
+    }
+
+    std::unique_lock lk(this->mutex);
+
+    auto it = this->sw_completions.find(surf.render_fence.value);
+    if (it == this->sw_completions.end())
+        return 0;
+
+    auto is_done = [&it] { return it->second.done; };
+    if (timeout_us < 0)
+        this->done_cv.wait(lk, is_done);
+    else if (!this->done_cv.wait_for(lk, std::chrono::microseconds(timeout_us), is_done))
+        return ETIMEDOUT;
+
+    auto [done, rc, used_bytes] = it->second;
+    this->sw_completions.erase(it);
+
+    if (num_read_bytes)
+        *num_read_bytes = used_bytes;
+    return rc;
+}
+
+void Scheduler::worker_main() {
+    SoftwareDecoder decoder;
+
+    std::unique_lock lk(this->mutex);
+    while (true) {
+        this->work_cv.wait(lk, [this] { return this->stop || !this->sw_queue.empty(); });
+        if (this->sw_queue.empty())
+            return;
+
+        auto job = this->sw_queue.front();
+        this->sw_queue.pop_front();
+        lk.unlock();
+
+        NvjpgStatus status = {};
+        auto start = Clock::now();
+        auto rc = job.is_video ?
+            decoder.render(*job.image, static_cast<VideoSurface &>(*job.surf), job.downscale, &status) :
+            decoder.render(*job.image, static_cast<Surface &>(*job.surf), job.kernel, job.alpha, job.downscale, &status);
+        auto latency = to_us(Clock::now() - start);
+
+        lk.lock();
+        if (!rc)
+            this->sw_model.update(job.features, latency);
+
+        --this->sw_in_flight;
+        this->sw_backlog_us = std::max(this->sw_backlog_us - job.estimate_us, 0.0);
+
+        if (auto it = this->sw_completions.find(job.id); it != this->sw_completions.end())
+            it->second = { true, rc, status.used_bytes };
+        this->done_cv.notify_all();
+    }
+}
+
+CostModel Scheduler::get_model(Target target) const {
+    std::scoped_lock lk(this->mutex);
+    return (target == Target::Hardware) ? this->hw_model : this->sw_model;
+}
+
+Scheduler::Stats Scheduler::get_stats() const {
+    std::scoped_lock lk(this->mutex);
+    return {
+        .num_hardware   = this->num_hardware,
+        .num_software   = this->num_software,
+        .hw_queue_depth = this->hw_jobs.size(),
+        .sw_queue_depth = this->sw_in_flight,
+        .hw_backlog_us  = this->hw_backlog_us,
+        .sw_backlog_us  = this->sw_backlog_us,
+    };
+}
+
+} // namespace nj
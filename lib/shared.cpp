@@ -0,0 +1,213 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+
+#include <nvjpg/utils.hpp>
+
+#include <nvjpg/shared.hpp>
+
+namespace nj {
+
+SharedDecoder::~SharedDecoder() {
+    if (this->submitter.joinable())
+        this->finalize();
+}
+
+Result SharedDecoder::initialize(std::size_t num_ring_entries, std::size_t capacity, std::size_t queue_size,
+        Decoder::Backend backend) {
+    if (!num_ring_entries || !queue_size)
+        return EINVAL;
+
+    NJ_TRY_RET(this->decoder.initialize(num_ring_entries, capacity, backend));
+    NJ_TRY_RET(this->decoder.start_completion_thread([this](const Decoder::Completion &completion) {
+        this->complete(completion);
+    }));
+
+    // A batch can't cover more renders than there are ring entries to hold them
+    this->max_batch_size = std::min(num_ring_entries, CmdBuf::max_bufs);
+    this->jobs      .reserve(this->max_batch_size);
+    this->video_jobs.reserve(this->max_batch_size);
+
+    this->queue     = std::make_unique<MpmcQueue<Request>>(queue_size);
+    this->stop      = false;
+    this->submitter = std::thread(&SharedDecoder::submitter_main, this);
+    return 0;
+}
+
+Result SharedDecoder::finalize() {
+    if (this->submitter.joinable()) {
+        this->stop.store(true, std::memory_order_release);
+        this->num_pushed.fetch_add(1, std::memory_order_release);
+        this->num_pushed.notify_one();
+        this->submitter.join();
+    }
+
+    // Completes the renders still in flight
+    NJ_TRY_RET(this->decoder.stop_completion_thread());
+
+    this->queue.reset();
+
+    // Driver calls are checked through errno, which ticket waits may have left set
+    errno = 0;
+    return this->decoder.finalize();
+}
+
+Result SharedDecoder::submit_common(const Request &request) {
+    if (!this->queue)
+        return EINVAL;
+
+    request.ticket->done.store(false, std::memory_order_relaxed);
+    request.ticket->completion = {};
+
+    this->num_requests.add();
+    while (!this->queue->push(request)) {
+        // The submitter is behind, which only happens when the ring is full
+        this->num_queue_full.add();
+        std::this_thread::yield();
+    }
+
+    this->num_pushed.fetch_add(1, std::memory_order_release);
+    this->num_pushed.notify_one();
+    return 0;
+}
+
+Result SharedDecoder::submit(const Image &image, Surface &surf, Ticket &ticket, std::uint8_t alpha, std::uint32_t downscale) {
+    return this->submit_common({ &image, &surf, &ticket, false, alpha, downscale });
+}
+
+Result SharedDecoder::submit(const Image &image, VideoSurface &surf, Ticket &ticket, std::uint32_t downscale) {
+    return this->submit_common({ &image, &surf, &ticket, true, 0, downscale });
+}
+
+void SharedDecoder::submitter_main() {
+    std::vector<Request> batch;
+    batch.reserve(this->max_batch_size);
+
+    while (true) {
+        // Read before popping, so that a push racing with the queue running empty changes it and ends the wait
+        auto pushed = this->num_pushed.load(std::memory_order_acquire);
+
+        Request request;
+        while ((batch.size() < this->max_batch_size) && this->queue->pop(request))
+            batch.push_back(request);
+
+        if (batch.empty()) {
+            if (this->stop.load(std::memory_order_acquire))
+                return;
+
+            this->num_pushed.wait(pushed, std::memory_order_acquire);
+            continue;
+        }
+
+        this->submit_batch(batch);
+        batch.clear();
+    }
+}
+
+void SharedDecoder::submit_batch(std::span<const Request> requests) {
+    while (!requests.empty()) {
+        auto is_video = requests.front().is_video;
+        auto run_size = std::find_if(requests.begin(), requests.end(),
+            [is_video](const Request &request) { return request.is_video != is_video; }) - requests.begin();
+
+        if (is_video)
+            this->submit_run(requests.first(run_size), this->video_jobs);
+        else
+            this->submit_run(requests.first(run_size), this->jobs);
+
+        requests = requests.subspan(run_size);
+    }
+}
+
+template <typename Job>
+void SharedDecoder::submit_run(std::span<const Request> requests, std::vector<Job> &jobs) {
+    jobs.clear();
+    for (auto &request: requests) {
+        auto &completion = request.ticket->completion;
+        completion.surf  = request.surf;
+
+        if constexpr (std::is_same_v<Job, Decoder::RenderJob>)
+            jobs.push_back({ *request.image, static_cast<Surface &>(*request.surf), request.alpha, request.downscale,
+                &completion.handle });
+        else
+            jobs.push_back({ *request.image, static_cast<VideoSurface &>(*request.surf), request.downscale,
+                &completion.handle });
+    }
+
+    // Tickets are queued before submitting, since the completion thread can retire renders before render returns
+    {
+        std::scoped_lock lk(this->in_flight_mutex);
+        for (auto &request: requests)
+            this->in_flight.push_back(request.ticket);
+    }
+
+    this->num_batches.add();
+    auto rc = this->decoder.render(std::span<const Job>(jobs));
+    if (!rc)
+        return;
+
+    // Renders are tracked in order until one fails, so the tickets that never got a handle are at the back
+    std::size_t num_untracked = 0;
+    {
+        std::scoped_lock lk(this->in_flight_mutex);
+        while (!this->in_flight.empty() && !this->in_flight.back()->completion.handle) {
+            this->in_flight.pop_back();
+            ++num_untracked;
+        }
+    }
+
+    if (!num_untracked)
+        return;
+
+    // Retry the batch one render at a time, so that an invalid image only fails its own request
+    if (requests.size() > 1) {
+        for (auto i = requests.size() - num_untracked; i < requests.size(); ++i)
+            this->submit_run(requests.subspan(i, 1), jobs);
+        return;
+    }
+
+    auto *ticket = requests.front().ticket;
+    ticket->completion.rc = rc;
+    ticket->done.store(true, std::memory_order_release);
+    ticket->done.notify_all();
+}
+
+void SharedDecoder::complete(const Decoder::Completion &completion) {
+    Ticket *ticket;
+    {
+        std::scoped_lock lk(this->in_flight_mutex);
+        ticket = this->in_flight.front();
+        this->in_flight.pop_front();
+    }
+
+    ticket->completion = completion;
+    ticket->done.store(true, std::memory_order_release);
+    ticket->done.notify_all();
+}
+
+SharedDecoder::Stats SharedDecoder::get_stats() const {
+    return {
+        .num_requests   = this->num_requests  .get(),
+        .num_batches    = this->num_batches   .get(),
+        .num_queue_full = this->num_queue_full.get(),
+    };
+}
+
+} // namespace nj
@@ -26,27 +26,25 @@ namespace nj {
 namespace {
 
 std::size_t compute_pitch(std::size_t width, std::size_t bpp) {
-    return align_up(width * bpp, 0x100ul);
+    return align_up(width * bpp, SurfaceLayout::pitch_align);
 }
 
-std::size_t compute_size(std::size_t pitch, std::size_t height) {
-    return align_up(pitch * height, 0x20000ul);
+std::size_t compute_plane_size(std::size_t pitch, std::size_t height, std::size_t row_align) {
+    return align_up(pitch * align_up(height, row_align), SurfaceLayout::plane_align);
 }
 
 } // namespace
 
-int Surface::allocate()  {
-    this->pitch = compute_pitch(this->width, this->get_bpp());
-    NJ_TRY_RET(this->map.allocate(compute_size(this->pitch, this->height), 0x400, 0x1));
-#ifndef __SWITCH__
-    NJ_TRY_ERRNO(this->map.map());
-#endif
-    return 0;
+SurfaceLayout Surface::compute_layout(std::size_t width, std::size_t height, PixelFormat pixel_fmt) {
+    SurfaceLayout layout;
+    layout.pitches[0] = compute_pitch(width, Surface(0, 0, pixel_fmt).get_bpp());
+    layout.size       = compute_plane_size(layout.pitches[0], height, SurfaceLayout::row_align);
+    return layout;
 }
 
-int VideoSurface::allocate() {
+SurfaceLayout VideoSurface::compute_layout(std::size_t width, std::size_t height, SamplingFormat sampling) {
     auto hsubsamp = 0, vsubsamp = 0;
-    switch (this->sampling) {
+    switch (sampling) {
         case SamplingFormat::S420:
             hsubsamp = 2, vsubsamp = 2;
             break;
@@ -57,22 +55,54 @@ int VideoSurface::allocate() {
             hsubsamp = 1, vsubsamp = 1;
             break;
         default:
-            return EINVAL;
+            return {};
     }
 
-    this->luma_pitch   = compute_pitch(this->width, 1);
-    this->chroma_pitch = compute_pitch(this->width / hsubsamp, 1);
+    // Odd dimensions still get a chroma sample for the last column/row
+    auto chroma_width = (width + hsubsamp - 1) / hsubsamp, chroma_height = (height + vsubsamp - 1) / vsubsamp;
+
+    SurfaceLayout layout;
+    layout.pitches[0] = compute_pitch(width, 1);
+    layout.pitches[1] = layout.pitches[2] = compute_pitch(chroma_width, 1);
+
+    auto luma_size   = compute_plane_size(layout.pitches[0], height,        SurfaceLayout::row_align);
+    auto chroma_size = compute_plane_size(layout.pitches[1], chroma_height, SurfaceLayout::row_align / vsubsamp);
+
+    layout.offsets[1] = luma_size;
+    layout.offsets[2] = luma_size + chroma_size;
+    layout.size       = luma_size + 2 * chroma_size;
+    return layout;
+}
+
+int Surface::allocate()  {
+    auto layout = Surface::compute_layout(this->width, this->height, this->type);
+
+    this->pitch = layout.pitches[0];
+    NJ_TRY_RET(this->map.allocate(layout.size, 0x400, 0x1));
+#ifndef __SWITCH__
+    NJ_TRY_ERRNO(this->map.map());
+#endif
+    this->payload = layout.size;
+    return 0;
+}
+
+int VideoSurface::allocate() {
+    auto layout = VideoSurface::compute_layout(this->width, this->height, this->sampling);
+    if (!layout.size)
+        return EINVAL;
+
+    this->luma_pitch   = layout.pitches[0];
+    this->chroma_pitch = layout.pitches[1];
 
-    auto luma_size   = compute_size(this->luma_pitch, this->height);
-    auto chroma_size = compute_size(this->chroma_pitch, this->height / vsubsamp);
-    NJ_TRY_RET(this->map.allocate(luma_size + 2 * chroma_size, 0x400, 0x1));
+    NJ_TRY_RET(this->map.allocate(layout.size, 0x400, 0x1));
 #ifndef __SWITCH__
     NJ_TRY_ERRNO(this->map.map());
 #endif
+    this->payload = layout.size;
 
     this->luma_data    = static_cast<std::uint8_t *>(this->map.address());
-    this->chromab_data = static_cast<std::uint8_t *>(this->map.address()) + luma_size;
-    this->chromar_data = static_cast<std::uint8_t *>(this->map.address()) + luma_size + chroma_size;
+    this->chromab_data = static_cast<std::uint8_t *>(this->map.address()) + layout.offsets[1];
+    this->chromar_data = static_cast<std::uint8_t *>(this->map.address()) + layout.offsets[2];
     return 0;
 }
 
@@ -0,0 +1,189 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#include <bit>
+
+#include <nvjpg/nv/ctrl.hpp>
+#include <nvjpg/decoder.hpp>
+
+#include <nvjpg/surface_pool.hpp>
+
+namespace nj {
+
+SurfacePool::~SurfacePool() {
+    std::scoped_lock lk(this->mutex);
+    this->free_list.clear();
+}
+
+std::size_t SurfacePool::get_size_class(std::size_t dim) {
+    constexpr std::size_t min_step = 16;
+    if (dim <= min_step)
+        return min_step;
+
+    auto step = std::max(std::bit_floor(dim) / 4, min_step);
+    return align_up(dim, step);
+}
+
+bool SurfacePool::is_idle(const SurfaceBase &surf) {
+    // Never rendered to, or by the software backend, which completes before render returns
+    auto &fence = surf.render_fence;
+    if ((!fence.id && !fence.value) || fence.id == Decoder::sw_syncpt_id)
+        return true;
+
+    return NvHostCtrl::poll(fence);
+}
+
+Result SurfacePool::acquire(std::size_t width, std::size_t height, PixelFormat format, Ptr<Surface> &surf) {
+    if (!width || !height || format == PixelFormat::YUV)
+        return EINVAL;
+
+    Entry entry;
+    NJ_TRY_RET(this->acquire_common({ get_size_class(width), get_size_class(height), format, SamplingFormat::Monochrome },
+        entry));
+
+    entry.surf->width = width, entry.surf->height = height;
+    surf = Ptr<Surface>(entry.surf.release(), Releaser{ this });
+    return 0;
+}
+
+Result SurfacePool::acquire(std::size_t width, std::size_t height, SamplingFormat sampling, Ptr<VideoSurface> &surf) {
+    if (!width || !height)
+        return EINVAL;
+
+    Entry entry;
+    NJ_TRY_RET(this->acquire_common({ get_size_class(width), get_size_class(height), PixelFormat::YUV, sampling },
+        entry));
+
+    entry.video_surf->width = width, entry.video_surf->height = height;
+    surf = Ptr<VideoSurface>(entry.video_surf.release(), Releaser{ this });
+    return 0;
+}
+
+Result SurfacePool::acquire_common(const Key &key, Entry &entry) {
+    {
+        std::scoped_lock lk(this->mutex);
+        ++this->num_acquires;
+
+        // The most recently released surface is the likeliest to still be in cache
+        for (auto it = this->free_list.begin(); it != this->free_list.end(); ++it) {
+            if (it->key != key || !is_idle(it->get()))
+                continue;
+
+            auto size = it->get().size();
+            this->free_size -= size, this->used_size += size;
+
+            entry = std::move(*it);
+            this->free_list.erase(it);
+            return 0;
+        }
+    }
+
+    // Allocate without holding the lock, the cap is checked once the size is known
+    Entry fresh;
+    fresh.key = key;
+    errno = 0;  // Mapping failures are reported through errno
+    if (key.format == PixelFormat::YUV) {
+        fresh.video_surf = std::make_unique<VideoSurface>(key.width, key.height, key.sampling);
+        NJ_TRY_RET(fresh.video_surf->allocate());
+    } else {
+        fresh.surf = std::make_unique<Surface>(key.width, key.height, key.format);
+        NJ_TRY_RET(fresh.surf->allocate());
+    }
+
+    auto size = fresh.get().size();
+
+    std::scoped_lock lk(this->mutex);
+    if (!this->trim_to_fit(size))
+        return ENOMEM;
+
+    ++this->num_allocations;
+    this->used_size += size;
+    entry = std::move(fresh);
+    return 0;
+}
+
+void SurfacePool::release(SurfaceBase *surf) {
+    if (!surf)
+        return;
+
+    Entry entry;
+    if (surf->type == PixelFormat::YUV) {
+        entry.video_surf.reset(static_cast<VideoSurface *>(surf));
+        entry.key = { get_size_class(surf->width), get_size_class(surf->height), surf->type, entry.video_surf->sampling };
+    } else {
+        entry.surf.reset(static_cast<Surface *>(surf));
+        entry.key = { get_size_class(surf->width), get_size_class(surf->height), surf->type, SamplingFormat::Monochrome };
+    }
+
+    std::scoped_lock lk(this->mutex);
+    auto size = surf->size();
+    this->used_size -= size, this->free_size += size;
+    this->free_list.push_front(std::move(entry));
+    this->trim_to_fit(0);
+}
+
+bool SurfacePool::trim_to_fit(std::size_t size) {
+    auto fits = [this, size] {
+        return !this->max_size || (this->used_size + this->free_size + size <= this->max_size);
+    };
+
+    // Surfaces the engine may still be writing to are skipped
+    for (auto it = this->free_list.end(); !fits() && it != this->free_list.begin();) {
+        if (!is_idle((--it)->get()))
+            continue;
+
+        this->free_size -= it->get().size();
+        ++this->num_trims;
+        it = this->free_list.erase(it);
+    }
+
+    return fits();
+}
+
+void SurfacePool::set_max_size(std::size_t max_size) {
+    std::scoped_lock lk(this->mutex);
+    this->max_size = max_size;
+    this->trim_to_fit(0);
+}
+
+void SurfacePool::trim() {
+    std::scoped_lock lk(this->mutex);
+    std::erase_if(this->free_list, [this](const Entry &entry) {
+        if (!is_idle(entry.get()))
+            return false;
+
+        this->free_size -= entry.get().size();
+        ++this->num_trims;
+        return true;
+    });
+}
+
+SurfacePool::Stats SurfacePool::get_stats() const {
+    std::scoped_lock lk(this->mutex);
+    return {
+        .num_acquires    = this->num_acquires,
+        .num_allocations = this->num_allocations,
+        .num_trims       = this->num_trims,
+        .used_size       = this->used_size,
+        .free_size       = this->free_size,
+    };
+}
+
+} // namespace nj
@@ -0,0 +1,58 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cerrno>
+
+#include <nvjpg/surface_view.hpp>
+
+namespace nj {
+
+Result SurfaceView::set_layout(std::size_t offset, std::size_t pitch, std::size_t size, std::size_t map_size) {
+    if (!this->width || !this->height)
+        return EINVAL;
+
+    if (!is_aligned(offset, SurfaceLayout::plane_align) || !is_aligned(pitch, SurfaceLayout::pitch_align))
+        return EINVAL;
+
+    auto row_size = this->width * this->get_bpp();
+    auto payload  = (this->height - 1) * pitch + row_size;
+    if (pitch < row_size || size < payload || offset + size > map_size)
+        return EINVAL;
+
+    this->pitch   = pitch;
+    this->payload = payload;
+    return 0;
+}
+
+Result SurfaceView::wrap(NvMap &map, std::size_t offset, std::size_t pitch, std::size_t size) {
+    NJ_TRY_RET(this->set_layout(offset, pitch, size, map.size()));
+    this->bind(map, offset);
+    return 0;
+}
+
+Result SurfaceView::import(void *address, std::size_t size, std::size_t pitch, std::size_t offset) {
+    NJ_TRY_RET(this->set_layout(offset, pitch, size - std::min(offset, size), size));
+
+    if (this->map.handle())
+        NJ_TRY_RET(this->map.free());
+
+    NJ_TRY_RET(this->map.import(address, size));
+    this->bound_map = nullptr, this->offset = offset;
+    return 0;
+}
+
+} // namespace nj
@@ -0,0 +1,227 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#include <array>
+
+#include <nvjpg/sw/huffman.hpp>
+
+#include <nvjpg/sw/coefficients.hpp>
+
+namespace nj {
+
+Result CoefficientBuffer::decode(const Image &image) {
+    if (!image.progressive || image.sampling_precision != 8)
+        return EINVAL;
+
+    if (image.width == 0 || image.height == 0 || image.mcu_size_horiz == 0 || image.mcu_size_vert == 0)
+        return EINVAL;
+
+    if (image.num_components != 1 && image.num_components != 3)
+        return EINVAL;
+
+    auto max_h = image.mcu_size_horiz / 8, max_v = image.mcu_size_vert / 8;
+
+    this->num_mcu_h      = (image.width  + image.mcu_size_horiz - 1) / image.mcu_size_horiz;
+    this->num_mcu_v      = (image.height + image.mcu_size_vert  - 1) / image.mcu_size_vert;
+    this->num_components = image.num_components;
+
+    for (std::size_t i = 0; i < image.num_components; ++i) {
+        auto &src = image.components[i];
+        auto &dst = this->components[i];
+
+        if (src.sampling_horiz < 1 || src.sampling_horiz > 4 || src.sampling_vert < 1 || src.sampling_vert > 4)
+            return EINVAL;
+
+        dst.blocks_h     = src.sampling_horiz, dst.blocks_v = src.sampling_vert;
+        dst.width        = this->num_mcu_h * dst.blocks_h;
+        dst.height       = this->num_mcu_v * dst.blocks_v;
+        dst.coded_width  = ((image.width  * dst.blocks_h + max_h - 1) / max_h + 7) / 8;
+        dst.coded_height = ((image.height * dst.blocks_v + max_v - 1) / max_v + 7) / 8;
+        dst.coefs.assign(static_cast<std::size_t>(dst.width) * dst.height * 64, 0);
+    }
+
+    // Scans redefine tables and scan parameters, so walk them on a copy of the parsing state
+    auto scan = image;
+    auto *first_scan = image.get_scan_data().data();
+
+    while (true) {
+        std::size_t consumed;
+        NJ_TRY_RET(this->decode_scan(scan, consumed));
+        this->used_bytes = static_cast<std::size_t>(scan.get_scan_data().data() - first_scan) + consumed;
+
+        if (auto rc = scan.parse_next_scan(); rc == ENODATA)
+            break;
+        else if (rc)
+            return rc;
+    }
+
+    return 0;
+}
+
+Result CoefficientBuffer::decode_scan(const Image &scan, std::size_t &consumed) {
+    int ss = scan.spectral_selection_lo, se = scan.spectral_selection_hi;
+    int ah = scan.successive_approx_hi,  al = scan.successive_approx_lo;
+
+    // DC scans can be interleaved, AC scans hold a single component (G.1.1.1.1)
+    if ((ss == 0) ? (se != 0) : (se < ss || se > 63 || scan.num_scan_components != 1))
+        return EINVAL;
+
+    if (al > 13 || scan.num_scan_components == 0)
+        return EINVAL;
+
+    // The parser stores tables of class 0 (DC) in hm_ac_tables, and class 1 (AC) in hm_dc_tables
+    std::array<HuffmanDecoder, 3> tables;
+    for (std::size_t i = 0; i < scan.num_scan_components; ++i) {
+        auto &comp  = scan.components[scan.scan_components[i]];
+        auto &table = (ss == 0) ? scan.hm_ac_tables[comp.hm_dc_table_id & 3] : scan.hm_dc_tables[comp.hm_ac_table_id & 3];
+        NJ_TRY_RET(tables[i].build(table));
+    }
+
+    auto br = BitReader(scan.get_scan_data());
+    std::array<std::int32_t, 3> dc_pred = {};
+    std::uint32_t eobrun = 0, mcu_idx = 0;
+
+    // Calls decode_block(scan component index, block) on every block of the scan, in coding order
+    auto for_each_block = [&](auto &&decode_block) {
+        auto restart = [&] {
+            if (scan.restart_interval && mcu_idx && !(mcu_idx % scan.restart_interval)) {
+                br.restart();
+                dc_pred = {}, eobrun = 0;
+            }
+            ++mcu_idx;
+        };
+
+        if (scan.num_scan_components == 1) {
+            // Non-interleaved, one block per MCU over the area covered by the component
+            auto &comp = this->components[scan.scan_components[0]];
+            for (int y = 0; y < comp.coded_height; ++y) {
+                for (int x = 0; x < comp.coded_width; ++x) {
+                    restart();
+                    decode_block(0, comp.block(x, y));
+                }
+            }
+            return;
+        }
+
+        for (int y = 0; y < this->num_mcu_v; ++y) {
+            for (int x = 0; x < this->num_mcu_h; ++x) {
+                restart();
+                for (std::size_t i = 0; i < scan.num_scan_components; ++i) {
+                    auto &comp = this->components[scan.scan_components[i]];
+                    for (int v = 0; v < comp.blocks_v; ++v)
+                        for (int h = 0; h < comp.blocks_h; ++h)
+                            decode_block(i, comp.block(x * comp.blocks_h + h, y * comp.blocks_v + v));
+                }
+            }
+        }
+    };
+
+    if (ss == 0 && ah == 0) {
+        // DC first pass
+        for_each_block([&](std::size_t i, std::int16_t *block) {
+            auto size = tables[i].decode(br);
+            dc_pred[i] += br.get_extend(size & 0xf);
+            block[0] = static_cast<std::int16_t>(dc_pred[i] * (1 << al));
+        });
+    } else if (ss == 0) {
+        // DC refinement, one bit per block
+        for_each_block([&](std::size_t, std::int16_t *block) {
+            if (br.get(1))
+                block[0] |= static_cast<std::int16_t>(1 << al);
+        });
+    } else if (ah == 0) {
+        // AC first pass
+        for_each_block([&](std::size_t, std::int16_t *block) {
+            if (eobrun) {
+                --eobrun;
+                return;
+            }
+
+            for (int k = ss; k <= se; ++k) {
+                auto rs = tables[0].decode(br);
+                int run = rs >> 4, size = rs & 0xf;
+
+                if (size) {
+                    k += run;
+                    if (k > 63)
+                        break;
+                    block[zigzag_to_natural[k]] = static_cast<std::int16_t>(br.get_extend(size) * (1 << al));
+                } else if (run == 15) {
+                    k += 15;
+                } else {
+                    eobrun = (1u << run) + br.get(run) - 1;
+                    break;
+                }
+            }
+        });
+    } else {
+        // AC refinement (G.1.2.3), same structure as in libjpeg
+        auto p1 = 1 << al;
+
+        for_each_block([&](std::size_t, std::int16_t *block) {
+            // Appends a correction bit to a coefficient which was already non-zero
+            auto refine = [&](std::int16_t &coef) {
+                if (br.get(1) && !(coef & p1))
+                    coef = static_cast<std::int16_t>(coef + ((coef >= 0) ? p1 : -p1));
+            };
+
+            int k = ss;
+
+            if (!eobrun) {
+                for (; k <= se; ++k) {
+                    auto rs = tables[0].decode(br);
+                    int run = rs >> 4, size = rs & 0xf, value = 0;
+
+                    if (size) {
+                        value = br.get(1) ? p1 : -p1;
+                    } else if (run != 15) {
+                        eobrun = (1u << run) + br.get(run);
+                        break;
+                    }
+
+                    // Skip run coefficients with a zero history, refining the others on the way
+                    for (; k <= se; ++k) {
+                        auto &coef = block[zigzag_to_natural[k]];
+                        if (coef)
+                            refine(coef);
+                        else if (--run < 0)
+                            break;
+                    }
+
+                    if (value && k <= se)
+                        block[zigzag_to_natural[k]] = static_cast<std::int16_t>(value);
+                }
+            }
+
+            if (eobrun) {
+                for (; k <= se; ++k) {
+                    if (auto &coef = block[zigzag_to_natural[k]]; coef)
+                        refine(coef);
+                }
+                --eobrun;
+            }
+        });
+    }
+
+    consumed = br.consumed();
+    return 0;
+}
+
+} // namespace nj
@@ -0,0 +1,506 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <nvjpg/sw/coefficients.hpp>
+#include <nvjpg/sw/huffman.hpp>
+#include <nvjpg/sw/kernels.hpp>
+#include <nvjpg/utils.hpp>
+
+#include <nvjpg/sw/decoder.hpp>
+
+namespace nj {
+
+namespace {
+
+// Box filter of a 8x8 block by 2^log2 in both directions
+void downscale_block(const std::uint8_t *in, std::uint8_t *out, std::size_t stride, std::uint32_t log2) {
+    auto factor = 1 << log2, size = 8 >> log2;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            int sum = 0;
+            for (int j = 0; j < factor; ++j)
+                for (int i = 0; i < factor; ++i)
+                    sum += in[(y * factor + j) * 8 + x * factor + i];
+            out[y * stride + x] = static_cast<std::uint8_t>((sum + (1 << (2 * log2 - 1))) >> (2 * log2));
+        }
+    }
+}
+
+class Context {
+    public:
+        struct Component {
+            const HuffmanDecoder *dc_table, *ac_table;
+            std::array<std::uint16_t, 64> quant_table;  // In natural order
+            std::int32_t dc_pred;
+            int blocks_h, blocks_v;                     // Sampling factors
+            int shift_h, shift_v;                       // Log2 of the subsampling relative to the luma plane
+            int stride;
+            std::vector<std::uint8_t> plane;            // Samples for the current MCU row
+        };
+
+    public:
+        Context(const Image &image, std::uint32_t downscale): image(image), kernels(SoftwareKernels::get()) {
+            if (downscale)
+                downscale = std::clamp(__builtin_ctz(downscale), 0, 3);
+            this->downscale_log_2 = downscale;
+        }
+
+        Result initialize() {
+            auto &image = this->image;
+
+            if (image.sampling_precision != 8)
+                return EINVAL;
+
+            if (image.width == 0 || image.height == 0)
+                return EINVAL;
+
+            if (image.num_components != 1 && image.num_components != 3)
+                return EINVAL;
+
+            if (image.num_components == 1 && (image.components[0].sampling_horiz != 1 || image.components[0].sampling_vert != 1))
+                return EINVAL;
+
+            // The parser stores tables of class 0 (DC) in hm_ac_tables, and class 1 (AC) in hm_dc_tables
+            for (std::size_t i = 0; i < image.hm_ac_tables.size(); ++i) {
+                NJ_TRY_RET(this->dc_tables[i].build(image.hm_ac_tables[i]));
+                NJ_TRY_RET(this->ac_tables[i].build(image.hm_dc_tables[i]));
+            }
+
+            this->num_mcu_h  = (image.width  + image.mcu_size_horiz - 1) / image.mcu_size_horiz;
+            this->num_mcu_v  = (image.height + image.mcu_size_vert  - 1) / image.mcu_size_vert;
+            this->mcu_width  = image.mcu_size_horiz >> this->downscale_log_2;
+            this->mcu_height = image.mcu_size_vert  >> this->downscale_log_2;
+            this->out_width  = (image.width  + mask(this->downscale_log_2)) >> this->downscale_log_2;
+            this->out_height = (image.height + mask(this->downscale_log_2)) >> this->downscale_log_2;
+
+            auto max_h = image.mcu_size_horiz / 8, max_v = image.mcu_size_vert / 8;
+            auto block_size = 8 >> this->downscale_log_2;
+
+            for (std::size_t i = 0; i < image.num_components; ++i) {
+                auto &src = image.components[i];
+                auto &dst = this->components[i];
+
+                if (src.sampling_horiz < 1 || src.sampling_horiz > 2 || src.sampling_vert < 1 || src.sampling_vert > 2)
+                    return EINVAL;
+
+                dst.dc_table = &this->dc_tables[src.hm_dc_table_id & 3];
+                dst.ac_table = &this->ac_tables[src.hm_ac_table_id & 3];
+                dst.blocks_h = src.sampling_horiz, dst.blocks_v = src.sampling_vert;
+                dst.shift_h  = (max_h != dst.blocks_h), dst.shift_v = (max_v != dst.blocks_v);
+                dst.stride   = this->num_mcu_h * dst.blocks_h * block_size;
+                dst.dc_pred  = 0;
+                dst.plane.resize(dst.stride * dst.blocks_v * block_size);
+
+                auto &quant = image.quant_tables[src.quant_table_id & 3].table;
+                for (std::size_t j = 0; j < 64; ++j)
+                    dst.quant_table[zigzag_to_natural[j]] = quant[j];
+            }
+
+            return 0;
+        }
+
+        void output_block(Component &comp, const std::int16_t *block, int x, int y) {
+            alignas(16) std::array<std::uint8_t, 64> pixels;
+
+            auto block_size = 8 >> this->downscale_log_2;
+            auto *dst = comp.plane.data() + y * block_size * comp.stride + x * block_size;
+            if (!this->downscale_log_2) {
+                this->kernels.idct_8x8(block, comp.quant_table.data(), dst, comp.stride);
+            } else {
+                this->kernels.idct_8x8(block, comp.quant_table.data(), pixels.data(), 8);
+                downscale_block(pixels.data(), dst, comp.stride, this->downscale_log_2);
+            }
+        }
+
+        void decode_mcu(BitReader &br, int mcu_x) {
+            alignas(16) std::array<std::int16_t, 64> block;
+
+            for (std::size_t i = 0; i < this->image.num_components; ++i) {
+                auto &comp = this->components[i];
+
+                for (int v = 0; v < comp.blocks_v; ++v) {
+                    for (int h = 0; h < comp.blocks_h; ++h) {
+                        block = {};
+
+                        auto size = comp.dc_table->decode(br);
+                        comp.dc_pred += br.get_extend(size & 0xf);
+                        block[0] = static_cast<std::int16_t>(comp.dc_pred);
+
+                        for (int k = 1; k < 64; ++k) {
+                            auto rs = comp.ac_table->decode(br);
+                            auto run = rs >> 4, size = rs & 0xf;
+
+                            if (!size) {
+                                if (run != 15)
+                                    break;
+                                k += 15;
+                                continue;
+                            }
+
+                            k += run;
+                            if (k > 63)
+                                break;
+                            block[zigzag_to_natural[k]] = static_cast<std::int16_t>(br.get_extend(size));
+                        }
+
+                        this->output_block(comp, block.data(), mcu_x * comp.blocks_h + h, v);
+                    }
+                }
+            }
+        }
+
+        void reset_predictors() {
+            for (auto &comp: this->components)
+                comp.dc_pred = 0;
+        }
+
+        // Decodes rows [row_begin, row_end), br starting at the restart segment of the first MCU of row_begin
+        // Calls emit(mcu_y) after each row of MCUs has been decoded
+        void decode_rows(BitReader &br, int row_begin, int row_end, auto &&emit) {
+            auto first_idx = static_cast<std::uint32_t>(row_begin * this->num_mcu_h), mcu_idx = first_idx;
+            this->reset_predictors();
+
+            for (int y = row_begin; y < row_end; ++y) {
+                for (int x = 0; x < this->num_mcu_h; ++x, ++mcu_idx) {
+                    if (this->image.restart_interval && mcu_idx != first_idx && !(mcu_idx % this->image.restart_interval)) {
+                        br.restart();
+                        this->reset_predictors();
+                    }
+
+                    this->decode_mcu(br, x);
+                }
+                emit(y);
+            }
+        }
+
+        void transform_rows(const CoefficientBuffer &coefs, int row_begin, int row_end, auto &&emit) {
+            for (int y = row_begin; y < row_end; ++y) {
+                for (int x = 0; x < this->num_mcu_h; ++x) {
+                    for (std::size_t i = 0; i < this->image.num_components; ++i) {
+                        auto &comp = this->components[i];
+                        auto &src  = coefs.components[i];
+                        for (int v = 0; v < comp.blocks_v; ++v)
+                            for (int h = 0; h < comp.blocks_h; ++h)
+                                this->output_block(comp, src.block(x * comp.blocks_h + h, y * comp.blocks_v + v),
+                                    x * comp.blocks_h + h, v);
+                    }
+                }
+                emit(y);
+            }
+        }
+
+    public:
+        const Image &image;
+        const SoftwareKernels &kernels;
+        std::uint32_t downscale_log_2;
+
+        int num_mcu_h, num_mcu_v;
+        int mcu_width, mcu_height;  // In output pixels
+        int out_width, out_height;
+        std::size_t used_bytes = 0;
+
+        std::array<Component, 3> components = {};
+        std::array<HuffmanDecoder, 4> dc_tables, ac_tables;
+};
+
+// Yields full-resolution rows of a component, upsampling horizontally when needed
+// The last row is cached, so that vertically subsampled planes are only upsampled once per source row
+class RowUpsampler {
+    public:
+        RowUpsampler(const Context &ctx, const Context::Component &comp, std::size_t width):
+            kernels(ctx.kernels), comp(comp), width(width) {
+            if (comp.shift_h)
+                this->buffer.resize(width);
+        }
+
+        const std::uint8_t *get(int y) {
+            auto *src = this->comp.plane.data() + (y >> this->comp.shift_v) * this->comp.stride;
+            if (!this->comp.shift_h)
+                return src;
+
+            if (src != this->last_src) {
+                this->kernels.upsample_h2(src, this->buffer.data(), this->width);
+                this->last_src = src;
+            }
+            return this->buffer.data();
+        }
+
+        // Must be called when the plane is overwritten by a new row of MCUs
+        void invalidate() {
+            this->last_src = nullptr;
+        }
+
+    private:
+        const SoftwareKernels &kernels;
+        const Context::Component &comp;
+        std::size_t width;
+        std::vector<std::uint8_t> buffer;
+        const std::uint8_t *last_src = nullptr;
+};
+
+void fill_status(NvjpgStatus *status, const Context &ctx) {
+    if (!status)
+        return;
+
+    *status = {};
+    status->used_bytes = static_cast<std::uint32_t>(ctx.used_bytes);
+    status->mcu_x      = ctx.num_mcu_h;
+    status->mcu_y      = ctx.num_mcu_v;
+}
+
+// Offsets of the restart segments following the first one, ie. right after each RSTn marker
+std::vector<std::size_t> index_restart_markers(std::span<const std::uint8_t> scan) {
+    std::vector<std::size_t> offsets;
+
+    auto *cur = scan.data(), *end = scan.data() + scan.size();
+    while ((cur = static_cast<const std::uint8_t *>(std::memchr(cur, 0xff, end - cur))) && cur + 1 < end) {
+        if ((cur[1] & 0xf8) == 0xd0)
+            offsets.push_back(cur + 2 - scan.data()), cur += 2;
+        else if (cur[1] == 0x00 || cur[1] == 0xff)
+            cur += 1;
+        else
+            break; // End of the scan
+    }
+
+    return offsets;
+}
+
+struct RowRange {
+    int begin, end;
+    std::size_t offset; // Start of the entropy-coded segment of the first row
+};
+
+// Splits the image in at most max_ranges ranges of MCU rows which can be decoded independently
+// Baseline images need a restart segment starting at the first MCU of each range
+std::vector<RowRange> split_rows(const Context &ctx, std::size_t max_ranges) {
+    auto &image = ctx.image;
+    auto interval = static_cast<int>(image.restart_interval);
+
+    std::vector<RowRange> whole = { { 0, ctx.num_mcu_v, 0 } };
+    if (max_ranges <= 1 || (!image.progressive && !interval))
+        return whole;
+
+    std::vector<std::size_t> markers;
+    if (!image.progressive)
+        markers = index_restart_markers(image.get_scan_data());
+
+    auto get_offset = [&](int row) -> std::optional<std::size_t> {
+        if (image.progressive)
+            return 0;
+
+        auto first_mcu = row * ctx.num_mcu_h;
+        if (first_mcu % interval)
+            return std::nullopt;
+
+        auto segment = static_cast<std::size_t>(first_mcu / interval);
+        if (segment == 0)
+            return 0;
+        if (segment - 1 < markers.size())
+            return markers[segment - 1];
+        return std::nullopt;
+    };
+
+    auto target = std::max((ctx.num_mcu_v + static_cast<int>(max_ranges) - 1) / static_cast<int>(max_ranges), 1);
+
+    std::vector<RowRange> ranges;
+    RowRange range = { 0, 0, 0 };
+    for (int row = 1; row < ctx.num_mcu_v; ++row) {
+        if (row - range.begin < target)
+            continue;
+
+        if (auto offset = get_offset(row); offset) {
+            range.end = row;
+            ranges.push_back(range);
+            range = { row, 0, *offset };
+        }
+    }
+
+    range.end = ctx.num_mcu_v;
+    ranges.push_back(range);
+    return ranges;
+}
+
+// Decodes the image, calling the emitter returned by make_emit(ctx) after each row of MCUs
+// With a pool, ranges of rows are processed concurrently, each by its own copy of the context
+Result decode_image(Context &ctx, ThreadPool *pool, auto &&make_emit) {
+    auto &image = ctx.image;
+
+    CoefficientBuffer coefs;
+    if (image.progressive)
+        NJ_TRY_RET(coefs.decode(image));
+
+    auto ranges = split_rows(ctx, pool ? 4 * pool->size() : 1);
+    auto scan = image.get_scan_data();
+    std::size_t used_bytes = 0;
+
+    auto process = [&](Context &ctx, const RowRange &range) {
+        auto emit = make_emit(ctx);
+        if (image.progressive) {
+            ctx.transform_rows(coefs, range.begin, range.end, emit);
+        } else {
+            auto br = BitReader(scan.subspan(range.offset));
+            ctx.decode_rows(br, range.begin, range.end, emit);
+            if (range.end == ctx.num_mcu_v)
+                used_bytes = range.offset + br.consumed();
+        }
+    };
+
+    if (ranges.size() == 1) {
+        process(ctx, ranges[0]);
+    } else {
+        pool->parallel_for(ranges.size(), [&](std::size_t i) {
+            auto local = ctx;
+            process(local, ranges[i]);
+        });
+    }
+
+    ctx.used_bytes = image.progressive ? coefs.get_used_bytes() : used_bytes;
+    return 0;
+}
+
+} // namespace
+
+Result SoftwareDecoder::render(const Image &image, Surface &surf, const Kernel &kernel, std::uint8_t alpha,
+        std::uint32_t downscale, NvjpgStatus *status) const {
+    if (surf.width == 0 || surf.height == 0 || !surf.get_map().address())
+        return EINVAL;
+
+    Context ctx(image, downscale);
+    NJ_TRY_RET(ctx.initialize());
+
+    auto layout = get_pixel_layout(surf.type);
+    auto *out   = surf.get_target_data();
+    auto width  = std::min(ctx.out_width,  static_cast<int>(surf.width));
+    auto height = std::min(ctx.out_height, static_cast<int>(surf.height));
+
+    auto is_color = image.num_components == 3;
+    auto row_width = static_cast<std::size_t>(ctx.num_mcu_h * ctx.mcu_width);
+
+    std::vector<std::uint8_t> neutral_chroma(is_color ? 0 : row_width, 0x80);
+
+    auto make_emit = [&](Context &ctx) {
+        return [&, &ctx = ctx,
+                luma = RowUpsampler(ctx, ctx.components[0], row_width),
+                cb   = RowUpsampler(ctx, ctx.components[1], is_color ? row_width : 0),
+                cr   = RowUpsampler(ctx, ctx.components[2], is_color ? row_width : 0)](int mcu_y) mutable {
+            auto y0 = mcu_y * ctx.mcu_height;
+            auto h  = std::min(ctx.mcu_height, height - y0);
+
+            luma.invalidate(), cb.invalidate(), cr.invalidate();
+            for (int y = 0; y < h; ++y) {
+                auto *dst = out + (y0 + y) * surf.pitch;
+                ctx.kernels.yuv_to_rgb(luma.get(y),
+                    is_color ? cb.get(y) : neutral_chroma.data(), is_color ? cr.get(y) : neutral_chroma.data(),
+                    dst, width, kernel, layout, alpha);
+            }
+        };
+    };
+
+    NJ_TRY_RET(decode_image(ctx, this->pool.get(), make_emit));
+    fill_status(status, ctx);
+
+    return 0;
+}
+
+Result SoftwareDecoder::render(const Image &image, VideoSurface &surf, std::uint32_t downscale, NvjpgStatus *status) const {
+    if (surf.width == 0 || surf.height == 0 || !surf.get_map().address())
+        return EINVAL;
+
+    Context ctx(image, downscale);
+    NJ_TRY_RET(ctx.initialize());
+
+    auto sampling = (image.num_components == 1) ? SamplingFormat::Monochrome : surf.sampling;
+
+    int sub_h = 1, sub_v = 1;
+    switch (sampling) {
+        case SamplingFormat::S420:
+            sub_h = 2, sub_v = 2;
+            break;
+        case SamplingFormat::S422:
+            sub_h = 2, sub_v = 1;
+            break;
+        case SamplingFormat::S440:
+            sub_h = 1, sub_v = 2;
+            break;
+        default:
+            break;
+    }
+
+    auto *base         = surf.get_target_data();
+    auto *luma_data    = base + (surf.luma_data    - surf.data());
+    auto *chromab_data = base + (surf.chromab_data - surf.data());
+    auto *chromar_data = base + (surf.chromar_data - surf.data());
+
+    auto width  = std::min(ctx.out_width,  static_cast<int>(surf.width));
+    auto height = std::min(ctx.out_height, static_cast<int>(surf.height));
+
+    auto chroma_plane_size = static_cast<std::size_t>(surf.chromar_data - surf.chromab_data);
+    auto chroma_width  = std::min((width  + sub_h - 1) / sub_h, static_cast<int>(surf.chroma_pitch));
+    auto chroma_height = std::min((height + sub_v - 1) / sub_v,
+        surf.chroma_pitch ? static_cast<int>(chroma_plane_size / surf.chroma_pitch) : 0);
+
+    // Copies a row of samples, replicating or decimating them to match the subsampling of the surface
+    auto copy_row = [&kernels = ctx.kernels](const std::uint8_t *src, std::uint8_t *dst, int width, int shift, int sub) {
+        if ((1 << shift) == sub)
+            std::memcpy(dst, src, width);
+        else if (shift && sub == 1)
+            kernels.upsample_h2(src, dst, width);
+        else
+            for (int x = 0; x < width; ++x)
+                dst[x] = src[(x * sub) >> shift];
+    };
+
+    auto make_emit = [&](Context &ctx) {
+        return [&, &ctx = ctx](int mcu_y) {
+            auto &luma = ctx.components[0];
+            auto y0 = mcu_y * ctx.mcu_height;
+            auto h  = std::min(ctx.mcu_height, height - y0);
+
+            for (int y = 0; y < h; ++y)
+                copy_row(luma.plane.data() + (y >> luma.shift_v) * luma.stride,
+                    luma_data + (y0 + y) * surf.luma_pitch, width, luma.shift_h, 1);
+
+            if (sampling == SamplingFormat::Monochrome)
+                return;
+
+            // Chroma samples are taken at the position of the top-left luma sample they cover
+            auto cy0 = (y0 + sub_v - 1) / sub_v, cy1 = std::min((y0 + h + sub_v - 1) / sub_v, chroma_height);
+
+            for (auto &&[comp, plane]: { std::pair(&ctx.components[1], chromab_data), std::pair(&ctx.components[2], chromar_data) }) {
+                for (int cy = cy0; cy < cy1; ++cy)
+                    copy_row(comp->plane.data() + ((cy * sub_v - y0) >> comp->shift_v) * comp->stride,
+                        plane + cy * surf.chroma_pitch, chroma_width, comp->shift_h, sub_h);
+            }
+        };
+    };
+
+    NJ_TRY_RET(decode_image(ctx, this->pool.get(), make_emit));
+    fill_status(status, ctx);
+
+    return 0;
+}
+
+} // namespace nj
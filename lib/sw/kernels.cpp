@@ -0,0 +1,139 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+
+#include <nvjpg/sw/kernels_impl.hpp>
+
+#include <nvjpg/sw/kernels.hpp>
+
+namespace nj {
+
+#if defined(__x86_64__)
+extern const SoftwareKernels sw_kernels_sse4, sw_kernels_avx2;
+#elif defined(__aarch64__)
+extern const SoftwareKernels sw_kernels_neon;
+#endif
+
+namespace {
+
+// One dimension of the 8-point IDCT, on 8 values spaced by stride
+template <int Shift>
+void idct_1d(const std::int32_t *in, std::size_t stride, std::int32_t *out) {
+    using namespace idct;
+
+    auto z2 = in[2 * stride], z3 = in[6 * stride];
+    auto z1 = (z2 + z3) * fix_0_541196100;
+    auto tmp2 = z1 + z3 * -fix_1_847759065;
+    auto tmp3 = z1 + z2 *  fix_0_765366865;
+
+    z2 = in[0], z3 = in[4 * stride];
+    auto tmp0 = (z2 + z3) * (1 << const_bits);
+    auto tmp1 = (z2 - z3) * (1 << const_bits);
+
+    auto tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    auto tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+    tmp0 = in[7 * stride], tmp1 = in[5 * stride], tmp2 = in[3 * stride], tmp3 = in[1 * stride];
+    z1 = tmp0 + tmp3, z2 = tmp1 + tmp2, z3 = tmp0 + tmp2;
+    auto z4 = tmp1 + tmp3;
+    auto z5 = (z3 + z4) * fix_1_175875602;
+
+    tmp0 *= fix_0_298631336, tmp1 *= fix_2_053119869;
+    tmp2 *= fix_3_072711026, tmp3 *= fix_1_501321110;
+    z1 *= -fix_0_899976223, z2 *= -fix_2_562915447;
+    z3 *= -fix_1_961570560, z4 *= -fix_0_390180644;
+    z3 += z5, z4 += z5;
+
+    tmp0 += z1 + z3, tmp1 += z2 + z4;
+    tmp2 += z2 + z3, tmp3 += z1 + z4;
+
+    out[0] = descale(tmp10 + tmp3, Shift), out[7] = descale(tmp10 - tmp3, Shift);
+    out[1] = descale(tmp11 + tmp2, Shift), out[6] = descale(tmp11 - tmp2, Shift);
+    out[2] = descale(tmp12 + tmp1, Shift), out[5] = descale(tmp12 - tmp1, Shift);
+    out[3] = descale(tmp13 + tmp0, Shift), out[4] = descale(tmp13 - tmp0, Shift);
+}
+
+void idct_8x8_scalar(const std::int16_t *coefs, const std::uint16_t *quant, std::uint8_t *out, std::size_t stride) {
+    std::array<std::int32_t, 64> in, ws;
+    for (std::size_t i = 0; i < 64; ++i)
+        in[i] = coefs[i] * quant[i];
+
+    // Columns, results are stored transposed
+    for (std::size_t i = 0; i < 8; ++i)
+        idct_1d<idct::pass1_shift>(&in[i], 8, &ws[i * 8]);
+
+    // Rows
+    for (std::size_t i = 0; i < 8; ++i) {
+        std::array<std::int32_t, 8> row;
+        idct_1d<idct::pass2_shift>(&ws[i], 8, row.data());
+        for (std::size_t j = 0; j < 8; ++j)
+            out[i * stride + j] = static_cast<std::uint8_t>(std::clamp(row[j] + 128, 0, 255));
+    }
+}
+
+void upsample_h2_scalar(const std::uint8_t *in, std::uint8_t *out, std::size_t width) {
+    for (std::size_t i = 0; i < width; ++i)
+        out[i] = in[i / 2];
+}
+
+void yuv_to_rgb_scalar(const std::uint8_t *y, const std::uint8_t *cb, const std::uint8_t *cr, std::uint8_t *out,
+        std::size_t width, const SoftwareKernels::Yuv2RgbKernel &kernel, PixelLayout layout, std::uint8_t alpha) {
+    yuv_to_rgb_range(y, cb, cr, out, 0, width, kernel, layout, alpha);
+}
+
+} // namespace
+
+constinit const SoftwareKernels sw_kernels_scalar = {
+    .idct_8x8    = idct_8x8_scalar,
+    .upsample_h2 = upsample_h2_scalar,
+    .yuv_to_rgb  = yuv_to_rgb_scalar,
+    .name        = "scalar",
+};
+
+std::span<const SoftwareKernels *const> SoftwareKernels::get_all() {
+    struct List {
+        std::array<const SoftwareKernels *, 3> kernels;
+        std::size_t count;
+    };
+
+    static const auto list = [] {
+        List list = { { &sw_kernels_scalar }, 1 };
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.1"))
+            list.kernels[list.count++] = &sw_kernels_sse4;
+        if (__builtin_cpu_supports("avx2"))
+            list.kernels[list.count++] = &sw_kernels_avx2;
+#elif defined(__aarch64__)
+        // Advanced SIMD is mandatory in armv8-a
+        list.kernels[list.count++] = &sw_kernels_neon;
+#endif
+        return list;
+    }();
+
+    return std::span(list.kernels.data(), list.count);
+}
+
+const SoftwareKernels &SoftwareKernels::get() {
+    static const auto *best = SoftwareKernels::get_all().back();
+    return *best;
+}
+
+} // namespace nj
@@ -0,0 +1,187 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__aarch64__)
+
+#include <cstdint>
+#include <utility>
+#include <arm_neon.h>
+
+#include <nvjpg/sw/kernels_impl.hpp>
+
+#include <nvjpg/sw/kernels.hpp>
+
+namespace nj {
+
+namespace {
+
+template <int Shift>
+inline void idct_1d_neon(int32x4_t *v) {
+    using namespace idct;
+
+    auto z2 = v[2], z3 = v[6];
+    auto z1 = vmulq_n_s32(vaddq_s32(z2, z3), fix_0_541196100);
+    auto tmp2 = vmlaq_n_s32(z1, z3, -fix_1_847759065);
+    auto tmp3 = vmlaq_n_s32(z1, z2,  fix_0_765366865);
+
+    z2 = v[0], z3 = v[4];
+    auto tmp0 = vshlq_n_s32(vaddq_s32(z2, z3), const_bits);
+    auto tmp1 = vshlq_n_s32(vsubq_s32(z2, z3), const_bits);
+
+    auto tmp10 = vaddq_s32(tmp0, tmp3), tmp13 = vsubq_s32(tmp0, tmp3);
+    auto tmp11 = vaddq_s32(tmp1, tmp2), tmp12 = vsubq_s32(tmp1, tmp2);
+
+    tmp0 = v[7], tmp1 = v[5], tmp2 = v[3], tmp3 = v[1];
+    z1 = vaddq_s32(tmp0, tmp3), z2 = vaddq_s32(tmp1, tmp2), z3 = vaddq_s32(tmp0, tmp2);
+    auto z4 = vaddq_s32(tmp1, tmp3);
+    auto z5 = vmulq_n_s32(vaddq_s32(z3, z4), fix_1_175875602);
+
+    tmp0 = vmulq_n_s32(tmp0, fix_0_298631336), tmp1 = vmulq_n_s32(tmp1, fix_2_053119869);
+    tmp2 = vmulq_n_s32(tmp2, fix_3_072711026), tmp3 = vmulq_n_s32(tmp3, fix_1_501321110);
+    z3 = vmlaq_n_s32(z5, z3, -fix_1_961570560), z4 = vmlaq_n_s32(z5, z4, -fix_0_390180644);
+    z1 = vmulq_n_s32(z1, -fix_0_899976223),     z2 = vmulq_n_s32(z2, -fix_2_562915447);
+
+    tmp0 = vaddq_s32(tmp0, vaddq_s32(z1, z3)), tmp1 = vaddq_s32(tmp1, vaddq_s32(z2, z4));
+    tmp2 = vaddq_s32(tmp2, vaddq_s32(z2, z3)), tmp3 = vaddq_s32(tmp3, vaddq_s32(z1, z4));
+
+    auto round = vdupq_n_s32(1 << (Shift - 1));
+    auto descale = [&round](int32x4_t x) { return vshrq_n_s32(vaddq_s32(x, round), Shift); };
+
+    v[0] = descale(vaddq_s32(tmp10, tmp3)), v[7] = descale(vsubq_s32(tmp10, tmp3));
+    v[1] = descale(vaddq_s32(tmp11, tmp2)), v[6] = descale(vsubq_s32(tmp11, tmp2));
+    v[2] = descale(vaddq_s32(tmp12, tmp1)), v[5] = descale(vsubq_s32(tmp12, tmp1));
+    v[3] = descale(vaddq_s32(tmp13, tmp0)), v[4] = descale(vsubq_s32(tmp13, tmp0));
+}
+
+inline void transpose_4x4_neon(int32x4_t &a, int32x4_t &b, int32x4_t &c, int32x4_t &d) {
+    auto t0 = vtrnq_s32(a, b), t1 = vtrnq_s32(c, d);
+    a = vcombine_s32(vget_low_s32 (t0.val[0]), vget_low_s32 (t1.val[0]));
+    b = vcombine_s32(vget_low_s32 (t0.val[1]), vget_low_s32 (t1.val[1]));
+    c = vcombine_s32(vget_high_s32(t0.val[0]), vget_high_s32(t1.val[0]));
+    d = vcombine_s32(vget_high_s32(t0.val[1]), vget_high_s32(t1.val[1]));
+}
+
+// The block is processed as two halves of 4 columns (l) and (r), each row of a half being one vector
+inline void transpose_8x8_neon(int32x4_t *l, int32x4_t *r) {
+    transpose_4x4_neon(l[0], l[1], l[2], l[3]);
+    transpose_4x4_neon(l[4], l[5], l[6], l[7]);
+    transpose_4x4_neon(r[0], r[1], r[2], r[3]);
+    transpose_4x4_neon(r[4], r[5], r[6], r[7]);
+
+    // Swap the off-diagonal quadrants
+    for (int i = 0; i < 4; ++i)
+        std::swap(l[i + 4], r[i]);
+}
+
+void idct_8x8_neon(const std::int16_t *coefs, const std::uint16_t *quant, std::uint8_t *out, std::size_t stride) {
+    int32x4_t l[8], r[8];
+    for (int i = 0; i < 8; ++i) {
+        auto c = vld1q_s16(coefs + i * 8);
+        auto q = vreinterpretq_s16_u16(vld1q_u16(quant + i * 8));
+        l[i] = vmull_s16(vget_low_s16 (c), vget_low_s16 (q));
+        r[i] = vmull_s16(vget_high_s16(c), vget_high_s16(q));
+    }
+
+    // Columns
+    idct_1d_neon<idct::pass1_shift>(l);
+    idct_1d_neon<idct::pass1_shift>(r);
+    transpose_8x8_neon(l, r);
+
+    // Rows (now laid out as columns), l holding rows 0-3 and r rows 4-7
+    idct_1d_neon<idct::pass2_shift>(l);
+    idct_1d_neon<idct::pass2_shift>(r);
+    transpose_8x8_neon(l, r);
+
+    auto bias = vdupq_n_s16(128);
+    for (int i = 0; i < 8; ++i) {
+        auto row = vqaddq_s16(vcombine_s16(vqmovn_s32(l[i]), vqmovn_s32(r[i])), bias);
+        vst1_u8(out + i * stride, vqmovun_s16(row));
+    }
+}
+
+void upsample_h2_neon(const std::uint8_t *in, std::uint8_t *out, std::size_t width) {
+    std::size_t i = 0;
+    for (; i + 32 <= width; i += 32) {
+        auto x = vld1q_u8(in + i / 2);
+        vst2q_u8(out + i, (uint8x16x2_t{ { x, x } }));
+    }
+
+    for (; i < width; ++i)
+        out[i] = in[i / 2];
+}
+
+void yuv_to_rgb_neon(const std::uint8_t *y, const std::uint8_t *cb, const std::uint8_t *cr, std::uint8_t *out,
+        std::size_t width, const SoftwareKernels::Yuv2RgbKernel &kernel, PixelLayout layout, std::uint8_t alpha) {
+    auto y_gain = static_cast<std::int32_t>(kernel[0]), y_off = static_cast<std::int32_t>(kernel[5]);
+    auto vr     = static_cast<std::int32_t>(kernel[1]), ug    = static_cast<std::int32_t>(kernel[2]);
+    auto vg     = static_cast<std::int32_t>(kernel[3]), ub    = static_cast<std::int32_t>(kernel[4]);
+
+    auto bias = vdupq_n_s32(0x8000);
+
+    // Computes 4 pixels of each channel, saturation to 8 bits is done by the narrowing instructions
+    auto convert = [&](int16x4_t vy, int16x4_t u, int16x4_t v, int32x4_t &r, int32x4_t &g, int32x4_t &b) {
+        auto yy = vmlaq_n_s32(bias, vsubq_s32(vmovl_s16(vy), vdupq_n_s32(y_off)), y_gain);
+        r = vshrq_n_s32(vmlaq_n_s32(yy, vmovl_s16(v), vr), 16);
+        g = vshrq_n_s32(vmlaq_n_s32(vmlaq_n_s32(yy, vmovl_s16(u), ug), vmovl_s16(v), vg), 16);
+        b = vshrq_n_s32(vmlaq_n_s32(yy, vmovl_s16(u), ub), 16);
+    };
+
+    auto narrow = [](int32x4_t lo, int32x4_t hi) {
+        return vqmovn_u16(vcombine_u16(vqmovun_s32(lo), vqmovun_s32(hi)));
+    };
+
+    std::size_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        auto vy = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + i)));
+        auto u  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cb + i))), vdupq_n_s16(128));
+        auto v  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cr + i))), vdupq_n_s16(128));
+
+        int32x4_t r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        convert(vget_low_s16 (vy), vget_low_s16 (u), vget_low_s16 (v), r_lo, g_lo, b_lo);
+        convert(vget_high_s16(vy), vget_high_s16(u), vget_high_s16(v), r_hi, g_hi, b_hi);
+
+        if (layout.bpp == 4) {
+            uint8x8x4_t pix;
+            pix.val[layout.r] = narrow(r_lo, r_hi);
+            pix.val[layout.g] = narrow(g_lo, g_hi);
+            pix.val[layout.b] = narrow(b_lo, b_hi);
+            pix.val[layout.a] = vdup_n_u8(alpha);
+            vst4_u8(out + i * 4, pix);
+        } else {
+            uint8x8x3_t pix;
+            pix.val[layout.r] = narrow(r_lo, r_hi);
+            pix.val[layout.g] = narrow(g_lo, g_hi);
+            pix.val[layout.b] = narrow(b_lo, b_hi);
+            vst3_u8(out + i * 3, pix);
+        }
+    }
+
+    yuv_to_rgb_range(y, cb, cr, out, i, width, kernel, layout, alpha);
+}
+
+} // namespace
+
+extern constinit const SoftwareKernels sw_kernels_neon = {
+    .idct_8x8    = idct_8x8_neon,
+    .upsample_h2 = upsample_h2_neon,
+    .yuv_to_rgb  = yuv_to_rgb_neon,
+    .name        = "neon",
+};
+
+} // namespace nj
+
+#endif // defined(__aarch64__)
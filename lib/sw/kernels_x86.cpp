@@ -0,0 +1,391 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__x86_64__)
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+#include <nvjpg/sw/kernels_impl.hpp>
+
+#include <nvjpg/sw/kernels.hpp>
+
+// Functions carry their target ISA as attribute, so that the library can be built for a baseline x86-64
+// and still select these implementations at runtime
+#define NJ_SSE4 __attribute__((target("sse4.1")))
+#define NJ_AVX2 __attribute__((target("avx2")))
+
+namespace nj {
+
+namespace {
+
+/*
+ * SSE4.1
+ */
+
+NJ_SSE4 inline __m128i mul_sse4(__m128i x, std::int32_t c) {
+    return _mm_mullo_epi32(x, _mm_set1_epi32(c));
+}
+
+template <int Shift>
+NJ_SSE4 inline void idct_1d_sse4(const __m128i *in, __m128i *out) {
+    using namespace idct;
+
+    auto z2 = in[2], z3 = in[6];
+    auto z1 = mul_sse4(_mm_add_epi32(z2, z3), fix_0_541196100);
+    auto tmp2 = _mm_add_epi32(z1, mul_sse4(z3, -fix_1_847759065));
+    auto tmp3 = _mm_add_epi32(z1, mul_sse4(z2,  fix_0_765366865));
+
+    z2 = in[0], z3 = in[4];
+    auto tmp0 = _mm_slli_epi32(_mm_add_epi32(z2, z3), const_bits);
+    auto tmp1 = _mm_slli_epi32(_mm_sub_epi32(z2, z3), const_bits);
+
+    auto tmp10 = _mm_add_epi32(tmp0, tmp3), tmp13 = _mm_sub_epi32(tmp0, tmp3);
+    auto tmp11 = _mm_add_epi32(tmp1, tmp2), tmp12 = _mm_sub_epi32(tmp1, tmp2);
+
+    tmp0 = in[7], tmp1 = in[5], tmp2 = in[3], tmp3 = in[1];
+    z1 = _mm_add_epi32(tmp0, tmp3), z2 = _mm_add_epi32(tmp1, tmp2), z3 = _mm_add_epi32(tmp0, tmp2);
+    auto z4 = _mm_add_epi32(tmp1, tmp3);
+    auto z5 = mul_sse4(_mm_add_epi32(z3, z4), fix_1_175875602);
+
+    tmp0 = mul_sse4(tmp0, fix_0_298631336), tmp1 = mul_sse4(tmp1, fix_2_053119869);
+    tmp2 = mul_sse4(tmp2, fix_3_072711026), tmp3 = mul_sse4(tmp3, fix_1_501321110);
+    z1 = mul_sse4(z1, -fix_0_899976223), z2 = mul_sse4(z2, -fix_2_562915447);
+    z3 = mul_sse4(z3, -fix_1_961570560), z4 = mul_sse4(z4, -fix_0_390180644);
+    z3 = _mm_add_epi32(z3, z5), z4 = _mm_add_epi32(z4, z5);
+
+    tmp0 = _mm_add_epi32(tmp0, _mm_add_epi32(z1, z3)), tmp1 = _mm_add_epi32(tmp1, _mm_add_epi32(z2, z4));
+    tmp2 = _mm_add_epi32(tmp2, _mm_add_epi32(z2, z3)), tmp3 = _mm_add_epi32(tmp3, _mm_add_epi32(z1, z4));
+
+    auto round = _mm_set1_epi32(1 << (Shift - 1));
+    auto descale = [&round](__m128i x) NJ_SSE4 { return _mm_srai_epi32(_mm_add_epi32(x, round), Shift); };
+
+    out[0] = descale(_mm_add_epi32(tmp10, tmp3)), out[7] = descale(_mm_sub_epi32(tmp10, tmp3));
+    out[1] = descale(_mm_add_epi32(tmp11, tmp2)), out[6] = descale(_mm_sub_epi32(tmp11, tmp2));
+    out[2] = descale(_mm_add_epi32(tmp12, tmp1)), out[5] = descale(_mm_sub_epi32(tmp12, tmp1));
+    out[3] = descale(_mm_add_epi32(tmp13, tmp0)), out[4] = descale(_mm_sub_epi32(tmp13, tmp0));
+}
+
+NJ_SSE4 inline void transpose_4x4_sse4(__m128i &a, __m128i &b, __m128i &c, __m128i &d) {
+    auto t0 = _mm_unpacklo_epi32(a, b), t1 = _mm_unpacklo_epi32(c, d);
+    auto t2 = _mm_unpackhi_epi32(a, b), t3 = _mm_unpackhi_epi32(c, d);
+    a = _mm_unpacklo_epi64(t0, t1), b = _mm_unpackhi_epi64(t0, t1);
+    c = _mm_unpacklo_epi64(t2, t3), d = _mm_unpackhi_epi64(t2, t3);
+}
+
+// The block is processed as two halves of 4 columns (l) and (r), each row of a half being one vector
+NJ_SSE4 inline void transpose_8x8_sse4(__m128i *l, __m128i *r) {
+    transpose_4x4_sse4(l[0], l[1], l[2], l[3]);
+    transpose_4x4_sse4(l[4], l[5], l[6], l[7]);
+    transpose_4x4_sse4(r[0], r[1], r[2], r[3]);
+    transpose_4x4_sse4(r[4], r[5], r[6], r[7]);
+
+    // Swap the off-diagonal quadrants
+    for (int i = 0; i < 4; ++i)
+        std::swap(l[i + 4], r[i]);
+}
+
+NJ_SSE4 void idct_8x8_sse4(const std::int16_t *coefs, const std::uint16_t *quant, std::uint8_t *out, std::size_t stride) {
+    __m128i l[8], r[8];
+    for (int i = 0; i < 8; ++i) {
+        auto c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(coefs + i * 8));
+        auto q = _mm_loadu_si128(reinterpret_cast<const __m128i *>(quant + i * 8));
+        l[i] = _mm_mullo_epi32(_mm_cvtepi16_epi32(c), _mm_cvtepu16_epi32(q));
+        r[i] = _mm_mullo_epi32(_mm_cvtepi16_epi32(_mm_srli_si128(c, 8)), _mm_cvtepu16_epi32(_mm_srli_si128(q, 8)));
+    }
+
+    // Columns
+    idct_1d_sse4<idct::pass1_shift>(l, l);
+    idct_1d_sse4<idct::pass1_shift>(r, r);
+    transpose_8x8_sse4(l, r);
+
+    // Rows (now laid out as columns), l holding rows 0-3 and r rows 4-7
+    idct_1d_sse4<idct::pass2_shift>(l, l);
+    idct_1d_sse4<idct::pass2_shift>(r, r);
+    transpose_8x8_sse4(l, r);
+
+    auto bias = _mm_set1_epi16(128);
+    for (int i = 0; i < 8; i += 2) {
+        auto row0 = _mm_adds_epi16(_mm_packs_epi32(l[i + 0], r[i + 0]), bias);
+        auto row1 = _mm_adds_epi16(_mm_packs_epi32(l[i + 1], r[i + 1]), bias);
+        auto pix  = _mm_packus_epi16(row0, row1);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + (i + 0) * stride), pix);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + (i + 1) * stride), _mm_srli_si128(pix, 8));
+    }
+}
+
+NJ_SSE4 void upsample_h2_sse4(const std::uint8_t *in, std::uint8_t *out, std::size_t width) {
+    std::size_t i = 0;
+    for (; i + 16 <= width; i += 16) {
+        auto x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + i / 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_unpacklo_epi8(x, x));
+    }
+
+    for (; i < width; ++i)
+        out[i] = in[i / 2];
+}
+
+// Converts 4 pixels to 32-bit words holding each channel at its byte offset
+struct Yuv2RgbSse4 {
+    __m128i y_off, y_gain, vr, ug, vg, ub, bias, zero, max;
+    __m128i r_shift, g_shift, b_shift, alpha;
+
+    NJ_SSE4 Yuv2RgbSse4(const SoftwareKernels::Yuv2RgbKernel &kernel, PixelLayout layout, std::uint8_t alpha) {
+        this->y_gain  = _mm_set1_epi32(static_cast<std::int32_t>(kernel[0]));
+        this->vr      = _mm_set1_epi32(static_cast<std::int32_t>(kernel[1]));
+        this->ug      = _mm_set1_epi32(static_cast<std::int32_t>(kernel[2]));
+        this->vg      = _mm_set1_epi32(static_cast<std::int32_t>(kernel[3]));
+        this->ub      = _mm_set1_epi32(static_cast<std::int32_t>(kernel[4]));
+        this->y_off   = _mm_set1_epi32(static_cast<std::int32_t>(kernel[5]));
+        this->bias    = _mm_set1_epi32(0x8000);
+        this->zero    = _mm_setzero_si128();
+        this->max     = _mm_set1_epi32(255);
+        this->r_shift = _mm_cvtsi32_si128(layout.r * 8);
+        this->g_shift = _mm_cvtsi32_si128(layout.g * 8);
+        this->b_shift = _mm_cvtsi32_si128(layout.b * 8);
+        this->alpha   = _mm_set1_epi32((layout.a >= 0) ? alpha << (layout.a * 8) : 0);
+    }
+
+    NJ_SSE4 __m128i clamp(__m128i x) const {
+        return _mm_min_epi32(_mm_max_epi32(_mm_srai_epi32(x, 16), this->zero), this->max);
+    }
+
+    NJ_SSE4 __m128i operator()(const std::uint8_t *y, const std::uint8_t *cb, const std::uint8_t *cr) const {
+        std::int32_t y4, cb4, cr4;
+        std::memcpy(&y4, y, sizeof(y4)), std::memcpy(&cb4, cb, sizeof(cb4)), std::memcpy(&cr4, cr, sizeof(cr4));
+
+        auto vy = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(y4));
+        auto u  = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(cb4)), _mm_set1_epi32(128));
+        auto v  = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(cr4)), _mm_set1_epi32(128));
+
+        auto yy = _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(vy, this->y_off), this->y_gain), this->bias);
+        auto r  = this->clamp(_mm_add_epi32(yy, _mm_mullo_epi32(v, this->vr)));
+        auto g  = this->clamp(_mm_add_epi32(yy, _mm_add_epi32(_mm_mullo_epi32(u, this->ug), _mm_mullo_epi32(v, this->vg))));
+        auto b  = this->clamp(_mm_add_epi32(yy, _mm_mullo_epi32(u, this->ub)));
+
+        return _mm_or_si128(_mm_or_si128(_mm_sll_epi32(r, this->r_shift), _mm_sll_epi32(g, this->g_shift)),
+            _mm_or_si128(_mm_sll_epi32(b, this->b_shift), this->alpha));
+    }
+};
+
+NJ_SSE4 void yuv_to_rgb_sse4(const std::uint8_t *y, const std::uint8_t *cb, const std::uint8_t *cr, std::uint8_t *out,
+        std::size_t width, const SoftwareKernels::Yuv2RgbKernel &kernel, PixelLayout layout, std::uint8_t alpha) {
+    auto convert = Yuv2RgbSse4(kernel, layout, alpha);
+
+    std::size_t i = 0;
+    if (layout.bpp == 4) {
+        for (; i + 4 <= width; i += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 4), convert(y + i, cb + i, cr + i));
+    } else {
+        // Drop the unused byte of each word
+        auto pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        for (; i + 4 <= width; i += 4) {
+            auto pix = _mm_shuffle_epi8(convert(y + i, cb + i, cr + i), pack);
+            auto hi  = _mm_extract_epi32(pix, 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i * 3), pix);
+            std::memcpy(out + i * 3 + 8, &hi, sizeof(hi));
+        }
+    }
+
+    yuv_to_rgb_range(y, cb, cr, out, i, width, kernel, layout, alpha);
+}
+
+/*
+ * AVX2
+ */
+
+NJ_AVX2 inline __m256i mul_avx2(__m256i x, std::int32_t c) {
+    return _mm256_mullo_epi32(x, _mm256_set1_epi32(c));
+}
+
+template <int Shift>
+NJ_AVX2 inline void idct_1d_avx2(__m256i *v) {
+    using namespace idct;
+
+    auto z2 = v[2], z3 = v[6];
+    auto z1 = mul_avx2(_mm256_add_epi32(z2, z3), fix_0_541196100);
+    auto tmp2 = _mm256_add_epi32(z1, mul_avx2(z3, -fix_1_847759065));
+    auto tmp3 = _mm256_add_epi32(z1, mul_avx2(z2,  fix_0_765366865));
+
+    z2 = v[0], z3 = v[4];
+    auto tmp0 = _mm256_slli_epi32(_mm256_add_epi32(z2, z3), const_bits);
+    auto tmp1 = _mm256_slli_epi32(_mm256_sub_epi32(z2, z3), const_bits);
+
+    auto tmp10 = _mm256_add_epi32(tmp0, tmp3), tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+    auto tmp11 = _mm256_add_epi32(tmp1, tmp2), tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+    tmp0 = v[7], tmp1 = v[5], tmp2 = v[3], tmp3 = v[1];
+    z1 = _mm256_add_epi32(tmp0, tmp3), z2 = _mm256_add_epi32(tmp1, tmp2), z3 = _mm256_add_epi32(tmp0, tmp2);
+    auto z4 = _mm256_add_epi32(tmp1, tmp3);
+    auto z5 = mul_avx2(_mm256_add_epi32(z3, z4), fix_1_175875602);
+
+    tmp0 = mul_avx2(tmp0, fix_0_298631336), tmp1 = mul_avx2(tmp1, fix_2_053119869);
+    tmp2 = mul_avx2(tmp2, fix_3_072711026), tmp3 = mul_avx2(tmp3, fix_1_501321110);
+    z1 = mul_avx2(z1, -fix_0_899976223), z2 = mul_avx2(z2, -fix_2_562915447);
+    z3 = mul_avx2(z3, -fix_1_961570560), z4 = mul_avx2(z4, -fix_0_390180644);
+    z3 = _mm256_add_epi32(z3, z5), z4 = _mm256_add_epi32(z4, z5);
+
+    tmp0 = _mm256_add_epi32(tmp0, _mm256_add_epi32(z1, z3)), tmp1 = _mm256_add_epi32(tmp1, _mm256_add_epi32(z2, z4));
+    tmp2 = _mm256_add_epi32(tmp2, _mm256_add_epi32(z2, z3)), tmp3 = _mm256_add_epi32(tmp3, _mm256_add_epi32(z1, z4));
+
+    auto round = _mm256_set1_epi32(1 << (Shift - 1));
+    auto descale = [&round](__m256i x) NJ_AVX2 { return _mm256_srai_epi32(_mm256_add_epi32(x, round), Shift); };
+
+    v[0] = descale(_mm256_add_epi32(tmp10, tmp3)), v[7] = descale(_mm256_sub_epi32(tmp10, tmp3));
+    v[1] = descale(_mm256_add_epi32(tmp11, tmp2)), v[6] = descale(_mm256_sub_epi32(tmp11, tmp2));
+    v[2] = descale(_mm256_add_epi32(tmp12, tmp1)), v[5] = descale(_mm256_sub_epi32(tmp12, tmp1));
+    v[3] = descale(_mm256_add_epi32(tmp13, tmp0)), v[4] = descale(_mm256_sub_epi32(tmp13, tmp0));
+}
+
+NJ_AVX2 inline void transpose_8x8_avx2(__m256i *v) {
+    __m256i t[8], u[8];
+    for (int i = 0; i < 8; i += 4) {
+        t[i + 0] = _mm256_unpacklo_epi32(v[i + 0], v[i + 1]), t[i + 1] = _mm256_unpackhi_epi32(v[i + 0], v[i + 1]);
+        t[i + 2] = _mm256_unpacklo_epi32(v[i + 2], v[i + 3]), t[i + 3] = _mm256_unpackhi_epi32(v[i + 2], v[i + 3]);
+
+        u[i + 0] = _mm256_unpacklo_epi64(t[i + 0], t[i + 2]), u[i + 1] = _mm256_unpackhi_epi64(t[i + 0], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]), u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        v[i + 0] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        v[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+NJ_AVX2 void idct_8x8_avx2(const std::int16_t *coefs, const std::uint16_t *quant, std::uint8_t *out, std::size_t stride) {
+    __m256i v[8];
+    for (int i = 0; i < 8; ++i) {
+        auto c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(coefs + i * 8));
+        auto q = _mm_loadu_si128(reinterpret_cast<const __m128i *>(quant + i * 8));
+        v[i] = _mm256_mullo_epi32(_mm256_cvtepi16_epi32(c), _mm256_cvtepu16_epi32(q));
+    }
+
+    idct_1d_avx2<idct::pass1_shift>(v);
+    transpose_8x8_avx2(v);
+    idct_1d_avx2<idct::pass2_shift>(v);
+    transpose_8x8_avx2(v);
+
+    auto bias = _mm_set1_epi16(128);
+    for (int i = 0; i < 8; i += 2) {
+        auto row0 = _mm_packs_epi32(_mm256_castsi256_si128(v[i + 0]), _mm256_extracti128_si256(v[i + 0], 1));
+        auto row1 = _mm_packs_epi32(_mm256_castsi256_si128(v[i + 1]), _mm256_extracti128_si256(v[i + 1], 1));
+        auto pix  = _mm_packus_epi16(_mm_adds_epi16(row0, bias), _mm_adds_epi16(row1, bias));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + (i + 0) * stride), pix);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + (i + 1) * stride), _mm_srli_si128(pix, 8));
+    }
+}
+
+NJ_AVX2 void upsample_h2_avx2(const std::uint8_t *in, std::uint8_t *out, std::size_t width) {
+    std::size_t i = 0;
+    for (; i + 32 <= width; i += 32) {
+        // Zero-extending then multiplying by 0x101 duplicates each byte
+        auto x = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i / 2)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_mullo_epi16(x, _mm256_set1_epi16(0x101)));
+    }
+
+    for (; i < width; ++i)
+        out[i] = in[i / 2];
+}
+
+NJ_AVX2 inline __m256i load_u8x8_avx2(const std::uint8_t *p) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)));
+}
+
+struct Yuv2RgbAvx2 {
+    __m256i y_off, y_gain, vr, ug, vg, ub, bias, zero, max;
+    __m128i r_shift, g_shift, b_shift;
+    __m256i alpha;
+
+    NJ_AVX2 Yuv2RgbAvx2(const SoftwareKernels::Yuv2RgbKernel &kernel, PixelLayout layout, std::uint8_t alpha) {
+        this->y_gain  = _mm256_set1_epi32(static_cast<std::int32_t>(kernel[0]));
+        this->vr      = _mm256_set1_epi32(static_cast<std::int32_t>(kernel[1]));
+        this->ug      = _mm256_set1_epi32(static_cast<std::int32_t>(kernel[2]));
+        this->vg      = _mm256_set1_epi32(static_cast<std::int32_t>(kernel[3]));
+        this->ub      = _mm256_set1_epi32(static_cast<std::int32_t>(kernel[4]));
+        this->y_off   = _mm256_set1_epi32(static_cast<std::int32_t>(kernel[5]));
+        this->bias    = _mm256_set1_epi32(0x8000);
+        this->zero    = _mm256_setzero_si256();
+        this->max     = _mm256_set1_epi32(255);
+        this->r_shift = _mm_cvtsi32_si128(layout.r * 8);
+        this->g_shift = _mm_cvtsi32_si128(layout.g * 8);
+        this->b_shift = _mm_cvtsi32_si128(layout.b * 8);
+        this->alpha   = _mm256_set1_epi32((layout.a >= 0) ? alpha << (layout.a * 8) : 0);
+    }
+
+    NJ_AVX2 __m256i clamp(__m256i x) const {
+        return _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(x, 16), this->zero), this->max);
+    }
+
+    NJ_AVX2 __m256i operator()(const std::uint8_t *y, const std::uint8_t *cb, const std::uint8_t *cr) const {
+        auto vy = load_u8x8_avx2(y);
+        auto u  = _mm256_sub_epi32(load_u8x8_avx2(cb), _mm256_set1_epi32(128));
+        auto v  = _mm256_sub_epi32(load_u8x8_avx2(cr), _mm256_set1_epi32(128));
+
+        auto yy = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(vy, this->y_off), this->y_gain), this->bias);
+        auto r  = this->clamp(_mm256_add_epi32(yy, _mm256_mullo_epi32(v, this->vr)));
+        auto g  = this->clamp(_mm256_add_epi32(yy, _mm256_add_epi32(_mm256_mullo_epi32(u, this->ug), _mm256_mullo_epi32(v, this->vg))));
+        auto b  = this->clamp(_mm256_add_epi32(yy, _mm256_mullo_epi32(u, this->ub)));
+
+        return _mm256_or_si256(_mm256_or_si256(_mm256_sll_epi32(r, this->r_shift), _mm256_sll_epi32(g, this->g_shift)),
+            _mm256_or_si256(_mm256_sll_epi32(b, this->b_shift), this->alpha));
+    }
+};
+
+NJ_AVX2 void yuv_to_rgb_avx2(const std::uint8_t *y, const std::uint8_t *cb, const std::uint8_t *cr, std::uint8_t *out,
+        std::size_t width, const SoftwareKernels::Yuv2RgbKernel &kernel, PixelLayout layout, std::uint8_t alpha) {
+    auto convert = Yuv2RgbAvx2(kernel, layout, alpha);
+
+    std::size_t i = 0;
+    if (layout.bpp == 4) {
+        for (; i + 8 <= width; i += 8)
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i * 4), convert(y + i, cb + i, cr + i));
+    } else {
+        // Drop the unused byte of each word, then move the 12 remaining bytes of each lane next to each other
+        auto pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                     0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        auto perm = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+        for (; i + 8 <= width; i += 8) {
+            auto pix = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(convert(y + i, cb + i, cr + i), pack), perm);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 3), _mm256_castsi256_si128(pix));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i * 3 + 16), _mm256_extracti128_si256(pix, 1));
+        }
+    }
+
+    yuv_to_rgb_range(y, cb, cr, out, i, width, kernel, layout, alpha);
+}
+
+} // namespace
+
+extern constinit const SoftwareKernels sw_kernels_sse4 = {
+    .idct_8x8    = idct_8x8_sse4,
+    .upsample_h2 = upsample_h2_sse4,
+    .yuv_to_rgb  = yuv_to_rgb_sse4,
+    .name        = "sse4.1",
+};
+
+extern constinit const SoftwareKernels sw_kernels_avx2 = {
+    .idct_8x8    = idct_8x8_avx2,
+    .upsample_h2 = upsample_h2_avx2,
+    .yuv_to_rgb  = yuv_to_rgb_avx2,
+    .name        = "avx2",
+};
+
+} // namespace nj
+
+#endif // defined(__x86_64__)
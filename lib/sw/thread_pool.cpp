@@ -0,0 +1,98 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+
+#include <nvjpg/sw/thread_pool.hpp>
+
+namespace nj {
+
+ThreadPool::ThreadPool(std::size_t num_threads) {
+    num_threads = std::max(num_threads, std::size_t(1));
+
+    this->workers.reserve(num_threads - 1);
+    for (std::size_t i = 0; i < num_threads - 1; ++i)
+        this->workers.emplace_back(&ThreadPool::worker_main, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::scoped_lock lk(this->mutex);
+        this->stop = true;
+    }
+    this->start_cv.notify_all();
+
+    for (auto &worker: this->workers)
+        worker.join();
+}
+
+void ThreadPool::run_tasks() {
+    std::size_t i;
+    while ((i = this->next_index.fetch_add(1, std::memory_order_relaxed)) < this->task_count)
+        (*this->task)(i);
+}
+
+void ThreadPool::worker_main() {
+    std::uint64_t seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock lk(this->mutex);
+            this->start_cv.wait(lk, [&] { return this->stop || this->generation != seen_generation; });
+            if (this->stop)
+                return;
+            seen_generation = this->generation;
+        }
+
+        this->run_tasks();
+
+        {
+            std::scoped_lock lk(this->mutex);
+            if (--this->num_busy == 0)
+                this->done_cv.notify_one();
+        }
+    }
+}
+
+void ThreadPool::parallel_for(std::size_t count, const std::function<void(std::size_t)> &fn) {
+    if (this->workers.empty() || count <= 1) {
+        for (std::size_t i = 0; i < count; ++i)
+            fn(i);
+        return;
+    }
+
+    std::scoped_lock submit_lk(this->submit_mutex);
+
+    {
+        std::scoped_lock lk(this->mutex);
+        this->task       = &fn;
+        this->task_count = count;
+        this->num_busy   = this->workers.size();
+        this->next_index.store(0, std::memory_order_relaxed);
+        ++this->generation;
+    }
+    this->start_cv.notify_all();
+
+    this->run_tasks();
+
+    // Workers still reference the task until they have all checked in
+    std::unique_lock lk(this->mutex);
+    this->done_cv.wait(lk, [this] { return this->num_busy == 0; });
+    this->task = nullptr;
+}
+
+} // namespace nj
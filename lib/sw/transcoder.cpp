@@ -0,0 +1,399 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <array>
+#include <limits>
+
+#include <nvjpg/sw/huffman.hpp>
+
+#include <nvjpg/sw/transcoder.hpp>
+
+namespace nj {
+
+namespace {
+
+// Largest magnitude categories allowed in 8-bit baseline streams (F.1.2.1.1, F.1.2.2.1)
+constexpr int max_dc_category = 11, max_ac_category = 10;
+
+// Luma uses the first pair of tables, chroma the second
+constexpr int get_table_id(std::size_t component) {
+    return (component == 0) ? 0 : 1;
+}
+
+constexpr int get_category(std::int32_t val) {
+    return val ? 32 - __builtin_clz(static_cast<std::uint32_t>(std::abs(val))) : 0;
+}
+
+// Builds a code limited to 16 bits from the frequency of each symbol, with the procedure of K.2
+// Symbol 256 is reserved so that no code is made of only 1 bits, as in libjpeg
+Image::HuffmanTable build_optimal_table(std::array<std::int64_t, 257> freqs) {
+    std::array<int, 257> code_sizes = {}, others;
+    std::array<int, 258> bits = {};
+    others.fill(-1);
+    freqs[256] = 1;
+
+    while (true) {
+        // Two least frequent symbols, ties are broken towards the largest index
+        int c1 = -1, c2 = -1;
+        auto v1 = std::numeric_limits<std::int64_t>::max(), v2 = v1;
+        for (int i = 0; i < static_cast<int>(freqs.size()); ++i) {
+            if (!freqs[i])
+                continue;
+
+            if (freqs[i] <= v1)
+                v2 = v1, c2 = c1, v1 = freqs[i], c1 = i;
+            else if (freqs[i] <= v2)
+                v2 = freqs[i], c2 = i;
+        }
+
+        if (c2 < 0)
+            break;
+
+        freqs[c1] += freqs[c2], freqs[c2] = 0;
+
+        // Both branches get one bit deeper
+        for (++code_sizes[c1]; others[c1] >= 0; ++code_sizes[c1])
+            c1 = others[c1];
+        others[c1] = c2;
+        for (++code_sizes[c2]; others[c2] >= 0; ++code_sizes[c2])
+            c2 = others[c2];
+    }
+
+    for (auto size: code_sizes)
+        if (size)
+            ++bits[size];
+
+    // Move the symbols with codes longer than 16 bits up the tree (K.3)
+    for (int i = static_cast<int>(bits.size()) - 1; i > 16; --i) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (!bits[j])
+                --j;
+
+            bits[i] -= 2, bits[i - 1] += 1;
+            bits[j + 1] += 2, bits[j] -= 1;
+        }
+    }
+
+    // Drop the reserved symbol, which holds the last of the longest codes
+    int len = 16;
+    while (!bits[len])
+        --len;
+    --bits[len];
+
+    Image::HuffmanTable table = {};
+    for (int i = 1; i <= 16; ++i)
+        table.codes[i - 1] = bits[i];
+
+    std::size_t idx = 0;
+    for (int size = 1; size < static_cast<int>(bits.size()); ++size) {
+        for (int sym = 0; sym < 256; ++sym) {
+            if (code_sizes[sym] == size && idx < table.symbols.size())
+                table.symbols[idx++] = static_cast<std::uint8_t>(sym);
+        }
+    }
+
+    return table;
+}
+
+class HuffmanEncoder {
+    public:
+        HuffmanEncoder(const Image::HuffmanTable &table) {
+            std::uint32_t code = 0;
+            std::size_t idx = 0;
+            for (int len = 1; len <= 16; ++len) {
+                for (std::uint32_t i = 0; i < table.codes[len - 1] && idx < table.symbols.size(); ++i, ++code, ++idx) {
+                    this->codes[table.symbols[idx]] = static_cast<std::uint16_t>(code);
+                    this->sizes[table.symbols[idx]] = static_cast<std::uint8_t>(len);
+                }
+                code <<= 1;
+            }
+        }
+
+    public:
+        std::array<std::uint16_t, 256> codes = {};
+        std::array<std::uint8_t,  256> sizes = {};
+};
+
+// Writes entropy-coded data, inserting stuffing bytes
+class BitWriter {
+    public:
+        // Writes after the current contents, first filling the reserved capacity
+        BitWriter(std::vector<std::uint8_t> &out): out(out), pos(out.size()) {
+            this->out.resize(this->out.capacity());
+        }
+
+        // Count must not exceed 32
+        void put(std::uint32_t bits, int count) {
+            this->acc = (this->acc << count) | (bits & ((std::uint64_t(1) << count) - 1));
+            this->num_bits += count;
+
+            if (this->num_bits >= 32)
+                this->flush_word();
+        }
+
+        // Pads the last byte with 1 bits (F.1.2.3), and trims the output
+        void flush() {
+            if (auto pad = -this->num_bits & 7; pad)
+                this->put(0xff, pad);
+
+            this->reserve(8);
+            for (; this->num_bits >= 8; this->num_bits -= 8)
+                this->put_byte(static_cast<std::uint8_t>(this->acc >> (this->num_bits - 8)));
+
+            this->out.resize(this->pos);
+        }
+
+    private:
+        void reserve(std::size_t size) {
+            if (this->pos + size > this->out.size()) [[unlikely]]
+                this->out.resize(std::max(2 * this->out.size(), this->pos + size));
+        }
+
+        void put_byte(std::uint8_t byte) {
+            this->out[this->pos++] = byte;
+            if (byte == 0xff)
+                this->out[this->pos++] = 0x00;
+        }
+
+        void flush_word() {
+            this->num_bits -= 32;
+            auto word = static_cast<std::uint32_t>(this->acc >> this->num_bits);
+
+            this->reserve(8);
+
+            // Fast path when no byte is 0xff and needs stuffing
+            if (auto inv = ~word; !((inv - 0x01010101) & ~inv & 0x80808080)) {
+                word = __builtin_bswap32(word);
+                std::memcpy(this->out.data() + this->pos, &word, sizeof(word));
+                this->pos += sizeof(word);
+                return;
+            }
+
+            for (int i = 24; i >= 0; i -= 8)
+                this->put_byte(static_cast<std::uint8_t>(word >> i));
+        }
+
+    private:
+        std::vector<std::uint8_t> &out;
+        std::size_t pos;
+        std::uint64_t acc = 0;
+        int num_bits = 0;
+};
+
+// Calls sink.code(is_ac, table id, symbol, value, value bits) for every symbol of the baseline
+// entropy-coded representation of the coefficients, in coding order
+// Returns false if a coefficient can't be represented in a baseline stream
+bool encode_coefficients(const CoefficientBuffer &coefs, auto &&sink) {
+    std::array<std::int32_t, 3> dc_pred = {};
+
+    auto encode_block = [&](std::size_t comp, const std::int16_t *block) {
+        auto table = get_table_id(comp);
+
+        auto diff = block[0] - dc_pred[comp];
+        dc_pred[comp] = block[0];
+
+        auto category = get_category(diff);
+        if (category > max_dc_category)
+            return false;
+
+        sink.code(false, table, category, (diff < 0) ? diff - 1 : diff, category);
+
+        // Walk the non-zero coefficients only
+        std::uint64_t nonzero = 0;
+        for (int k = 1; k < 64; ++k)
+            nonzero |= static_cast<std::uint64_t>(block[zigzag_to_natural[k]] != 0) << k;
+
+        int last = 0;
+        for (; nonzero; nonzero &= nonzero - 1) {
+            auto k = __builtin_ctzll(nonzero);
+            std::int32_t val = block[zigzag_to_natural[k]];
+
+            auto run = k - last - 1;
+            for (; run > 15; run -= 16)
+                sink.code(true, table, 0xf0, 0, 0);
+
+            category = get_category(val);
+            if (category > max_ac_category)
+                return false;
+
+            sink.code(true, table, run << 4 | category, (val < 0) ? val - 1 : val, category);
+            last = k;
+        }
+
+        if (last != 63)
+            sink.code(true, table, 0x00, 0, 0);
+
+        return true;
+    };
+
+    if (coefs.num_components == 1) {
+        // Single-component scans are non-interleaved
+        auto &comp = coefs.components[0];
+        for (int y = 0; y < comp.coded_height; ++y)
+            for (int x = 0; x < comp.coded_width; ++x)
+                if (!encode_block(0, comp.block(x, y)))
+                    return false;
+        return true;
+    }
+
+    for (int y = 0; y < coefs.num_mcu_v; ++y) {
+        for (int x = 0; x < coefs.num_mcu_h; ++x) {
+            for (std::size_t i = 0; i < coefs.num_components; ++i) {
+                auto &comp = coefs.components[i];
+                for (int v = 0; v < comp.blocks_v; ++v)
+                    for (int h = 0; h < comp.blocks_h; ++h)
+                        if (!encode_block(i, comp.block(x * comp.blocks_h + h, y * comp.blocks_v + v)))
+                            return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void put_marker(std::vector<std::uint8_t> &out, JpegMarker marker) {
+    out.push_back(static_cast<std::uint8_t>(JpegMarker::Magic));
+    out.push_back(static_cast<std::uint8_t>(marker));
+}
+
+void put_be16(std::vector<std::uint8_t> &out, std::uint32_t val) {
+    out.push_back(static_cast<std::uint8_t>(val >> 8));
+    out.push_back(static_cast<std::uint8_t>(val));
+}
+
+} // namespace
+
+Result ProgressiveTranscoder::transcode(const Image &image, Image &out) {
+    NJ_TRY_RET(this->coefs.decode(image));
+
+    auto &coefs = this->coefs;
+    auto num_tables = (coefs.num_components == 1) ? 1 : 2;
+
+    // First pass, gather symbol statistics
+    struct {
+        void code(bool is_ac, int table, int sym, std::int32_t, int) {
+            ++this->freqs[is_ac][table][sym];
+        }
+
+        std::array<std::array<std::array<std::int64_t, 257>, 2>, 2> freqs = {};
+    } stats;
+
+    if (!encode_coefficients(coefs, stats))
+        return EINVAL;
+
+    std::array<std::array<Image::HuffmanTable, 2>, 2> tables;  // [is_ac][table id]
+    for (int i = 0; i < num_tables; ++i) {
+        tables[0][i] = build_optimal_table(stats.freqs[0][i]);
+        tables[1][i] = build_optimal_table(stats.freqs[1][i]);
+    }
+
+    auto data = std::make_shared<std::vector<std::uint8_t>>();
+    auto &buf = *data;
+    buf.reserve(coefs.get_used_bytes() + coefs.get_used_bytes() / 8 + 0x400);
+
+    put_marker(buf, JpegMarker::Soi);
+
+    for (std::size_t i = 0; i < image.quant_tables.size(); ++i) {
+        if (!(image.quant_mask & bit(i)))
+            continue;
+
+        put_marker(buf, JpegMarker::Dqt);
+        put_be16(buf, 2 + 1 + 64);
+        buf.push_back(static_cast<std::uint8_t>(i));
+        buf.insert(buf.end(), image.quant_tables[i].table.begin(), image.quant_tables[i].table.end());
+    }
+
+    put_marker(buf, JpegMarker::Sof0);
+    put_be16(buf, 8 + 3 * coefs.num_components);
+    buf.push_back(8);
+    put_be16(buf, image.height);
+    put_be16(buf, image.width);
+    buf.push_back(static_cast<std::uint8_t>(coefs.num_components));
+    for (std::size_t i = 0; i < coefs.num_components; ++i) {
+        auto &comp = image.components[i];
+        buf.push_back(static_cast<std::uint8_t>(i + 1));
+        if (coefs.num_components == 1) // Sampling factors are meaningless for a single component
+            buf.push_back(0x11);
+        else
+            buf.push_back(static_cast<std::uint8_t>(comp.sampling_horiz << 4 | comp.sampling_vert));
+        buf.push_back(comp.quant_table_id);
+    }
+
+    for (int is_ac = 0; is_ac < 2; ++is_ac) {
+        for (int i = 0; i < num_tables; ++i) {
+            auto &table = tables[is_ac][i];
+
+            std::size_t num_symbols = 0;
+            for (auto count: table.codes)
+                num_symbols += count;
+
+            put_marker(buf, JpegMarker::Dht);
+            put_be16(buf, 2 + 1 + 16 + num_symbols);
+            buf.push_back(static_cast<std::uint8_t>(is_ac << 4 | i));
+            for (auto count: table.codes)
+                buf.push_back(static_cast<std::uint8_t>(count));
+            buf.insert(buf.end(), table.symbols.begin(), table.symbols.begin() + num_symbols);
+        }
+    }
+
+    put_marker(buf, JpegMarker::Sos);
+    put_be16(buf, 6 + 2 * coefs.num_components);
+    buf.push_back(static_cast<std::uint8_t>(coefs.num_components));
+    for (std::size_t i = 0; i < coefs.num_components; ++i) {
+        auto table = get_table_id(i);
+        buf.push_back(static_cast<std::uint8_t>(i + 1));
+        buf.push_back(static_cast<std::uint8_t>(table << 4 | table));
+    }
+    buf.push_back(0);  // Ss
+    buf.push_back(63); // Se
+    buf.push_back(0);  // Ah/Al
+
+    // Second pass, write the entropy-coded data
+    using Encoders = std::array<std::array<HuffmanEncoder, 2>, 2>;
+    Encoders encoders = {{
+        { HuffmanEncoder(tables[0][0]), HuffmanEncoder(tables[0][1]) },
+        { HuffmanEncoder(tables[1][0]), HuffmanEncoder(tables[1][1]) },
+    }};
+
+    struct {
+        // Codes are at most 16 bits long and values 11 bits, so both fit in a single write
+        void code(bool is_ac, int table, int sym, std::int32_t val, int count) {
+            auto &enc = (*this->encoders)[is_ac][table];
+            auto bits = static_cast<std::uint32_t>(enc.codes[sym]) << count | (static_cast<std::uint32_t>(val) & mask(static_cast<std::uint32_t>(count)));
+            this->writer.put(bits, enc.sizes[sym] + count);
+        }
+
+        const Encoders *encoders;
+        BitWriter writer;
+    } writer = { &encoders, BitWriter(buf) };
+
+    encode_coefficients(coefs, writer);
+    writer.writer.flush();
+
+    put_marker(buf, JpegMarker::Eoi);
+
+    out = Image(std::move(data));
+    return out.parse();
+}
+
+} // namespace nj
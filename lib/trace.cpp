@@ -0,0 +1,135 @@
+// Copyright (C) 2021 averne
+//
+// This file is part of oss-nvjpg.
+//
+// oss-nvjpg is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// oss-nvjpg is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with oss-nvjpg.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cinttypes>
+#include <algorithm>
+#include <string>
+
+#include <nvjpg/trace.hpp>
+
+namespace nj {
+
+namespace {
+
+std::unique_ptr<Tracer::Event[]> events;
+std::size_t                      num_slots = 0;
+std::atomic_size_t               next_event = 0, num_dropped = 0;
+std::atomic_uint32_t             next_thread = 0;
+
+std::uint32_t get_thread_id() {
+    thread_local auto id = next_thread.fetch_add(1, std::memory_order_relaxed) + 1;
+    return id;
+}
+
+} // namespace
+
+Result Tracer::enable(std::size_t capacity) {
+    if (!capacity)
+        return EINVAL;
+
+    if (capacity != num_slots) {
+        // Spans may be writing to the current buffer
+        if (Tracer::is_enabled())
+            return EBUSY;
+
+        events    = std::make_unique<Event[]>(capacity);
+        num_slots = capacity;
+        Tracer::clear();
+    }
+
+    Tracer::enabled.store(true, std::memory_order_relaxed);
+    return 0;
+}
+
+void Tracer::disable() {
+    Tracer::enabled.store(false, std::memory_order_relaxed);
+}
+
+void Tracer::clear() {
+    for (std::size_t i = 0; i < std::min(next_event.load(), num_slots); ++i)
+        events[i].name.store(nullptr, std::memory_order_relaxed);
+
+    next_event  = 0;
+    num_dropped = 0;
+}
+
+std::size_t Tracer::get_num_events() {
+    return std::min(next_event.load(std::memory_order_relaxed), num_slots);
+}
+
+std::size_t Tracer::get_num_dropped() {
+    return num_dropped.load(std::memory_order_relaxed);
+}
+
+std::span<const Tracer::Event> Tracer::get_events() {
+    return { events.get(), Tracer::get_num_events() };
+}
+
+void Tracer::record(const char *name, std::uint64_t begin_ns, std::uint64_t end_ns, std::int32_t entry, std::uint64_t image) {
+    auto idx = next_event.fetch_add(1, std::memory_order_relaxed);
+    if (idx >= num_slots) {
+        num_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto &event    = events[idx];
+    event.begin_ns = begin_ns;
+    event.end_ns   = end_ns;
+    event.thread   = get_thread_id();
+    event.entry    = entry;
+    event.image    = image;
+    event.name.store(name, std::memory_order_release);
+}
+
+Result Tracer::save(std::FILE *fp) {
+    if (!fp)
+        return EINVAL;
+
+    std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", fp);
+
+    bool first = true;
+    for (std::size_t i = 0; i < Tracer::get_num_events(); ++i) {
+        auto &event = events[i];
+        auto *name  = event.name.load(std::memory_order_acquire);
+        if (!name)
+            continue;
+
+        // Complete events, timestamps and durations in microseconds
+        std::fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"nvjpg\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu32
+            ",\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"entry\":%" PRId32 ",\"image\":%" PRIu64 "}}",
+            first ? "" : ",", name, event.thread, event.begin_ns / 1e3, (event.end_ns - event.begin_ns) / 1e3,
+            event.entry, event.image);
+        first = false;
+    }
+
+    std::fputs("\n]}\n", fp);
+    return std::ferror(fp) ? EIO : 0;
+}
+
+Result Tracer::save(std::string_view path) {
+    auto *fp = std::fopen(std::string(path).c_str(), "w");
+    if (!fp)
+        return errno;
+
+    auto rc = Tracer::save(fp);
+    if (std::fclose(fp) && !rc)
+        rc = errno;
+    return rc;
+}
+
+} // namespace nj